@@ -5,6 +5,13 @@
 #include "rhd/hash_map.h"
 #include "std.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
 struct ast_context
 {
     struct parse_context parse_context;
@@ -19,6 +26,17 @@ struct ast_context
     jmp_buf jmp;
 	
 	int numtypes;
+
+    int numthreads;
+    bool lazy; //only parse function bodies when they're used
+    struct linked_list *deferred_bodies; //function bodies that are parsed by the parser threads
+    struct linked_list *arenas; //node lists of the parser threads
+};
+
+struct deferred_body
+{
+    struct ast_node *decl;
+    int start, end; //token range of the body, including the braces
 };
 
 static void statement(struct ast_context *ctx, struct ast_node **node);
@@ -291,6 +309,10 @@ static struct ast_node *ident_factor(struct ast_context *ctx)
     int is_func_call = !ast_accept(ctx, '(');
     if(!decl && !is_func_call)
 	{
+        //enum values are constants
+        struct ast_node *ev = find_type_definition(ctx, ident_string);
+        if(ev && ev->type == AST_ENUM_VALUE)
+            return int_literal(ctx, ev->enum_value_data.value);
         ast_error(ctx, "declaration not found for '%s'", ident_string);
         return NULL;
 	}
@@ -391,33 +413,42 @@ struct ast_node_type_function
     struct ast_node *(*function)();
 };
 
-static struct ast_node_type_function factors[] = {
-    { TK_IDENT, ident_factor },
-    { '(', parens_factor },
-    { '-', unary_expr_factor },
-    { '+', unary_expr_factor },
-    { '!', unary_expr_factor },
-    { '~', unary_expr_factor },
-    { '*', unary_expr_factor },
-    { '&', unary_expr_factor },
-    { TK_PLUS_PLUS, unary_expr_factor },
-    { TK_MINUS_MINUS, unary_expr_factor },
-    { TK_INTEGER, integer_factor },
-    { TK_FLOAT, float_factor },
-    { TK_STRING, string_factor },
-    { TK_SIZEOF, sizeof_factor }
+//prefix parse functions, indexed by token type
+static struct ast_node *(*factors[TK_MAX])() = {
+    [TK_IDENT] = ident_factor,
+    ['('] = parens_factor,
+    ['-'] = unary_expr_factor,
+    ['+'] = unary_expr_factor,
+    ['!'] = unary_expr_factor,
+    ['~'] = unary_expr_factor,
+    ['*'] = unary_expr_factor,
+    ['&'] = unary_expr_factor,
+    [TK_PLUS_PLUS] = unary_expr_factor,
+    [TK_MINUS_MINUS] = unary_expr_factor,
+    [TK_INTEGER] = integer_factor,
+    [TK_FLOAT] = float_factor,
+    [TK_STRING] = string_factor,
+    [TK_SIZEOF] = sizeof_factor
 };
 
+//type of the next token without consuming it
+static int ast_peek(struct ast_context *ctx)
+{
+    struct parse_context *pc = &ctx->parse_context;
+    if(pc->token_index >= pc->num_tokens)
+        return TK_INVALID;
+    return pc->tokens[pc->token_index].type;
+}
+
 static void factor( struct ast_context* ctx, struct ast_node **node )
 {
     *node = NULL;
-    for(int i = 0; i < COUNT_OF(factors); ++i)
+    int type = ast_peek(ctx);
+    if(type >= 0 && type < TK_MAX && factors[type])
 	{
-        if(!ast_accept(ctx, factors[i].type))
-		{
-			*node = factors[i].function( ctx );
-			return;
-		}
+		parse_advance(&ctx->parse_context);
+		*node = factors[type]( ctx );
+		return;
 	}
 	ast_error(ctx, "expected factor");
 }
@@ -441,125 +472,97 @@ void array_subscripting(struct ast_context *ctx, struct ast_node **node)
     }
 }
 
-static void term(struct ast_context *ctx, struct ast_node **node)
-{
-    array_subscripting(ctx, node);
-    
-    while(!ast_accept(ctx, '/') || !ast_accept(ctx, '*') || !ast_accept(ctx, '%'))
-    {
-		int operator = ast_token(ctx)->type;
-		struct ast_node* rhs;
-		array_subscripting( ctx , &rhs );
-        *node = bin_expr(ctx, operator, *node, rhs);
-    }
-}
-
-
-static void add_and_subtract(struct ast_context *ctx, struct ast_node **node)
+enum PRECEDENCE
 {
-    term(ctx, node);
-    while(!ast_accept(ctx, '+') || !ast_accept(ctx, '-'))
-    {
-        int operator = ast_token(ctx)->type;
-    	struct ast_node *rhs;
-        term(ctx, &rhs);
-        *node = bin_expr(ctx, operator, *node, rhs);
-    }
-}
+    PREC_NONE,
+    PREC_ASSIGNMENT, // = += -= etc, right associative
+    PREC_TERNARY, // ?:
+    PREC_BITWISE_OR, // |
+    PREC_BITWISE_XOR, // ^
+    PREC_BITWISE_AND, // &
+    PREC_RELATIONAL, // < > <= >= == !=
+    PREC_SHIFT, // << >>
+    PREC_ADDITIVE, // + -
+    PREC_MULTIPLICATIVE // * / %
+};
 
-static void bitwise_shift(struct ast_context *ctx, struct ast_node **node)
-{
-    add_and_subtract(ctx, node);
-    while(!ast_accept(ctx, TK_LSHIFT) || !ast_accept(ctx, TK_RSHIFT))
-    {
-        int operator = ast_token(ctx)->type;
-    	struct ast_node *rhs;
-        add_and_subtract(ctx, &rhs);
-        *node = bin_expr(ctx, operator, *node, rhs);
-    }
-}
+//binary operator precedence, indexed by token type
+static const char binary_precedence[TK_MAX] = {
+    ['='] = PREC_ASSIGNMENT,
+    [TK_PLUS_ASSIGN] = PREC_ASSIGNMENT,
+    [TK_MINUS_ASSIGN] = PREC_ASSIGNMENT,
+    [TK_DIVIDE_ASSIGN] = PREC_ASSIGNMENT,
+    [TK_MULTIPLY_ASSIGN] = PREC_ASSIGNMENT,
+    [TK_MOD_ASSIGN] = PREC_ASSIGNMENT,
+    [TK_AND_ASSIGN] = PREC_ASSIGNMENT,
+    [TK_OR_ASSIGN] = PREC_ASSIGNMENT,
+    [TK_XOR_ASSIGN] = PREC_ASSIGNMENT,
+    ['?'] = PREC_TERNARY,
+    ['|'] = PREC_BITWISE_OR,
+    ['^'] = PREC_BITWISE_XOR,
+    ['&'] = PREC_BITWISE_AND,
+    ['<'] = PREC_RELATIONAL,
+    ['>'] = PREC_RELATIONAL,
+    [TK_LEQUAL] = PREC_RELATIONAL,
+    [TK_GEQUAL] = PREC_RELATIONAL,
+    [TK_EQUAL] = PREC_RELATIONAL,
+    [TK_NOT_EQUAL] = PREC_RELATIONAL,
+    [TK_LSHIFT] = PREC_SHIFT,
+    [TK_RSHIFT] = PREC_SHIFT,
+    ['+'] = PREC_ADDITIVE,
+    ['-'] = PREC_ADDITIVE,
+    ['*'] = PREC_MULTIPLICATIVE,
+    ['/'] = PREC_MULTIPLICATIVE,
+    ['%'] = PREC_MULTIPLICATIVE
+};
 
-static void relational(struct ast_context *ctx, struct ast_node **node)
+static int operator_precedence(int type)
 {
-    bitwise_shift(ctx, node);
-    while(!ast_accept(ctx, '>') || !ast_accept(ctx, '<') || !ast_accept(ctx, TK_LEQUAL) || !ast_accept(ctx, TK_GEQUAL) || !ast_accept(ctx, TK_EQUAL) || !ast_accept(ctx, TK_NOT_EQUAL))
-    {
-        int operator = ast_token(ctx)->type;
-    	struct ast_node *rhs;
-        bitwise_shift(ctx, &rhs);
-        *node = bin_expr(ctx, operator, *node, rhs);
-    }
+    if(type < 0 || type >= TK_MAX)
+        return PREC_NONE;
+    return binary_precedence[type];
 }
 
-static void bitwise_and(struct ast_context *ctx, struct ast_node **node)
+//precedence climbing, parses operators that bind atleast as tight as min_precedence
+static void binary_expression(struct ast_context *ctx, struct ast_node **node, int min_precedence)
 {
-    relational(ctx, node);
-    while(!ast_accept(ctx, '&'))
-    {
-        int operator = ast_token(ctx)->type;
-    	struct ast_node *rhs;
-        relational(ctx, &rhs);
-        *node = bin_expr(ctx, operator, *node, rhs);
-    }
-}
+    array_subscripting(ctx, node);
 
-static void bitwise_xor(struct ast_context *ctx, struct ast_node **node)
-{
-    bitwise_and(ctx, node);
-    while(!ast_accept(ctx, '^'))
+    while(1)
     {
-        int operator = ast_token(ctx)->type;
-    	struct ast_node *rhs;
-        bitwise_and(ctx, &rhs);
-        *node = bin_expr(ctx, operator, *node, rhs);
-    }
-}
+        int operator = ast_peek(ctx);
+        int precedence = operator_precedence(operator);
+        if(precedence == PREC_NONE || precedence < min_precedence)
+            break;
+        parse_advance(&ctx->parse_context);
 
-static void bitwise_or(struct ast_context *ctx, struct ast_node **node)
-{
-    bitwise_xor(ctx, node);
-    while(!ast_accept(ctx, '|'))
-    {
-        int operator = ast_token(ctx)->type;
-    	struct ast_node *rhs;
-        bitwise_xor(ctx, &rhs);
-        *node = bin_expr(ctx, operator, *node, rhs);
+        struct ast_node *rhs;
+        if(precedence == PREC_ASSIGNMENT)
+        {
+            binary_expression(ctx, &rhs, PREC_ASSIGNMENT);
+            *node = assignment_expr(ctx, operator, *node, rhs);
+        } else if(precedence == PREC_TERNARY)
+        {
+            struct ast_node *consequent, *alternative, *ternary_node;
+            binary_expression(ctx, &consequent, PREC_BITWISE_OR);
+            ast_expect(ctx, ':', "expected : for ternary operator");
+            binary_expression(ctx, &alternative, PREC_BITWISE_OR);
+            ternary_node = push_node( ctx, AST_TERNARY_EXPR );
+            ternary_node->ternary_expr_data.condition = *node;
+            ternary_node->ternary_expr_data.consequent = consequent;
+            ternary_node->ternary_expr_data.alternative = alternative;
+            *node = ternary_node;
+        } else
+        {
+            binary_expression(ctx, &rhs, precedence + 1);
+            *node = bin_expr(ctx, operator, *node, rhs);
+        }
     }
 }
 
-static void ternary(struct ast_context *ctx, struct ast_node **node)
-{
-    bitwise_or(ctx, node);
-    
-    while(!ast_accept(ctx, '?'))
-    {
-    	struct ast_node *consequent, *alternative, *ternary_node;
-        bitwise_or(ctx, &consequent);
-        ast_expect(ctx, ':', "expected : for ternary operator");
-    	bitwise_or(ctx, &alternative);
-		ternary_node = push_node( ctx, AST_TERNARY_EXPR );
-        ternary_node->ternary_expr_data.condition = *node;
-        ternary_node->ternary_expr_data.consequent = consequent;
-        ternary_node->ternary_expr_data.alternative = alternative;
-        *node = ternary_node;
-	}
-}
-
 static void regular_assignment(struct ast_context *ctx, struct ast_node **node)
 {
-    ternary(ctx, node);
-
-	static const int assignment_operators[] = {'=',TK_PLUS_ASSIGN,TK_MINUS_ASSIGN,TK_DIVIDE_ASSIGN,TK_MULTIPLY_ASSIGN,TK_MOD_ASSIGN,TK_AND_ASSIGN,TK_OR_ASSIGN,TK_XOR_ASSIGN};
-    for(int i = 0; i < COUNT_OF(assignment_operators); ++i)
-	{
-        while ( !ast_accept( ctx, assignment_operators[i] ) )
-		{
-            int operator = ast_token(ctx)->type;
-			struct ast_node* rhs;
-            ternary( ctx , &rhs );
-			*node = assignment_expr( ctx, operator, *node, rhs );
-		}
-	}
+    binary_expression(ctx, node, PREC_ASSIGNMENT);
 }
 
 static void expression( struct ast_context* ctx, struct ast_node** node )
@@ -667,6 +670,9 @@ static void print_ast(struct ast_node *n, int depth)
 				print_ast(n->func_decl_data.parameters[i]->variable_decl_data.data_type, depth + 1);
 			}
 			print_ast(n->func_decl_data.body, depth + 1);
+		} else if(ast_function_is_lazy(n))
+		{
+			printf("function '%s' (body not parsed yet)\n", n->func_decl_data.id->identifier_data.name);
 		} else
 		{
 			printf("import function '%s'\n", n->func_decl_data.id->identifier_data.name);
@@ -1117,10 +1123,10 @@ static void handle_enum_declaration(struct ast_context *ctx)
             ast_expect(ctx, TK_INTEGER, "expected integer for enum value '%s'\n", enum_node.enum_data.name);
             currentvalue = ast_token(ctx)->integer;
         }
-        enum_value_node->enum_value_data.value = currentvalue;
+        enum_value_node->enum_value_data.value = currentvalue++;
 
 		// add each enum value as type itself aswell, so we can access it easy
-        //TODO: FIX atm type isn't recognized because it's not a declaration of a variable
+        //identifiers that name one are turned into integer literals by ident_factor
 		add_type_definition(ctx, enum_value_node->enum_value_data.ident, enum_value_node);
 		enum_node.enum_data.values[enum_node.enum_data.numvalues++] = enum_value_node;
     } while(!ast_accept(ctx, ','));
@@ -1130,6 +1136,89 @@ static void handle_enum_declaration(struct ast_context *ctx)
     add_type_definition(ctx, enum_node.enum_data.name, &enum_node);
 }
 
+enum ATTRIBUTE
+{
+    ATTRIBUTE_PACKED = 1,
+    ATTRIBUTE_ALWAYS_INLINE = 2,
+    ATTRIBUTE_NOINLINE = 4
+};
+
+//__attribute__((...)) on a struct, union or function, returns the ATTRIBUTE flags and sets regparm if it's given
+static int attributes(struct ast_context *ctx, int *regparm)
+{
+    int flags = 0;
+    struct parse_context *pc = &ctx->parse_context;
+    while(ast_peek(ctx) == TK_IDENT && !strcmp(pc->tokens[pc->token_index].string, "__attribute__"))
+    {
+        ast_expect(ctx, TK_IDENT, "expected __attribute__");
+        ast_expect(ctx, '(', "expected (( after __attribute__");
+        ast_expect(ctx, '(', "expected (( after __attribute__");
+        do
+        {
+            ast_expect(ctx, TK_IDENT, "expected attribute name");
+            const char *name = ast_token(ctx)->string;
+            if(!strcmp(name, "packed") || !strcmp(name, "__packed__"))
+                flags |= ATTRIBUTE_PACKED;
+            else if(!strcmp(name, "always_inline") || !strcmp(name, "__always_inline__"))
+                flags |= ATTRIBUTE_ALWAYS_INLINE;
+            else if(!strcmp(name, "noinline") || !strcmp(name, "__noinline__"))
+                flags |= ATTRIBUTE_NOINLINE;
+            else if(!strcmp(name, "fastcall") || !strcmp(name, "__fastcall__"))
+                *regparm = 2;
+            else if(!strcmp(name, "regparm") || !strcmp(name, "__regparm__"))
+            {
+                ast_expect(ctx, '(', "expected ( after regparm");
+                ast_expect(ctx, TK_INTEGER, "expected number of registers for regparm");
+                *regparm = ast_token(ctx)->integer;
+                ast_assert(ctx, *regparm >= 0 && *regparm <= 3, "regparm takes 0 to 3 registers");
+                ast_expect(ctx, ')', "expected ) after regparm");
+            } else
+                ast_error(ctx, "unsupported attribute '%s'", name);
+        } while(!ast_accept(ctx, ','));
+        ast_expect(ctx, ')', "expected )) after attribute");
+        ast_expect(ctx, ')', "expected )) after attribute");
+    }
+    return flags;
+}
+
+static int struct_attributes(struct ast_context *ctx)
+{
+    int regparm = -1;
+    return attributes(ctx, &regparm) & ATTRIBUTE_PACKED;
+}
+
+//inline and attributes before the return type or after the parameters of a function, noinline wins over the others
+//__fastcall can go before the name as well
+static int function_specifiers(struct ast_context *ctx, int inlining, int *regparm)
+{
+    struct parse_context *pc = &ctx->parse_context;
+    while(ast_peek(ctx) == TK_IDENT)
+    {
+        const char *s = pc->tokens[pc->token_index].string;
+        int hint = INLINE_DEFAULT;
+        if(!strcmp(s, "inline") || !strcmp(s, "__inline") || !strcmp(s, "__inline__"))
+        {
+            ast_expect(ctx, TK_IDENT, "expected inline");
+            hint = INLINE_HINT;
+        } else if(!strcmp(s, "__fastcall") || !strcmp(s, "_fastcall"))
+        {
+            ast_expect(ctx, TK_IDENT, "expected __fastcall");
+            *regparm = 2;
+        } else if(!strcmp(s, "__attribute__"))
+        {
+            int flags = attributes(ctx, regparm);
+            if(flags & ATTRIBUTE_NOINLINE)
+                hint = INLINE_NEVER;
+            else if(flags & ATTRIBUTE_ALWAYS_INLINE)
+                hint = INLINE_ALWAYS;
+        } else
+            break;
+        if(hint > inlining)
+            inlining = hint;
+    }
+    return inlining;
+}
+
 static void handle_struct_or_union_declaration(struct ast_context *ctx)
 {
     int is_union_type = ast_token(ctx)->type == TK_UNION;
@@ -1137,6 +1226,7 @@ static void handle_struct_or_union_declaration(struct ast_context *ctx)
 
     struct ast_node struct_node = {.parent = NULL, .type = is_union_type ? AST_UNION_DECL : AST_STRUCT_DECL, .rvalue = 0};			
     struct_node.struct_decl_data.numfields = 0;
+    struct_node.struct_decl_data.packed = struct_attributes(ctx);
     if(ast_accept(ctx, '{'))
     {
         ast_expect(ctx, TK_IDENT, "no name for %s type", type_string);
@@ -1160,16 +1250,148 @@ static void handle_struct_or_union_declaration(struct ast_context *ctx)
     }
 
     ast_expect(ctx, '}', "no ending brace for %s type", type_string);
+    if(struct_attributes(ctx))
+        struct_node.struct_decl_data.packed = 1;
     ast_expect(ctx, ';', "no ending semicolon for %s type", type_string);
 
     //linked_list_prepend(program_node->program_data.body, struct_node);
     add_type_definition(ctx, struct_node.struct_decl_data.name, &struct_node);
 }
 
+//skips over a brace balanced block without parsing it, returns the token index of the opening brace
+static int skip_block(struct ast_context *ctx)
+{
+	ast_expect(ctx, '{', "expected { after function");
+	int start = ctx->parse_context.token_index - 1;
+	int depth = 1;
+	while(depth > 0)
+	{
+		struct token *tk = parse_advance(&ctx->parse_context);
+		ast_assert(ctx, tk && tk->type != TK_EOF, "unexpected end of file in function body");
+		if(tk->type == '{')
+			++depth;
+		else if(tk->type == '}')
+			--depth;
+	}
+	return start;
+}
+
+static void parse_deferred_body(struct ast_context *ctx, struct deferred_body *body)
+{
+	ctx->function = body->decl;
+	ctx->parse_context.token_index = body->start;
+	ctx->parse_context.num_tokens = body->end; //don't read past the closing brace
+	struct ast_node* block_node = NULL;
+	statement_node(ctx, &block_node);
+	ast_assert(ctx, block_node->type == AST_BLOCK_STMT, "expected { after function");
+	ast_assert(ctx, ctx->parse_context.token_index == body->end, "function body wasn't fully parsed");
+	body->decl->func_decl_data.body = block_node;
+	ctx->function = NULL;
+}
+
+struct parser_thread
+{
+	struct ast_context ctx;
+	struct deferred_body *bodies;
+	int numbodies;
+	int next, stride;
+	int error;
+};
+
+static void *parser_thread_main(void *arg)
+{
+	struct parser_thread *t = arg;
+	if(setjmp(t->ctx.jmp))
+	{
+		t->error = 1;
+		return NULL;
+	}
+	//each thread takes every n-th body
+	for(; t->next < t->numbodies; t->next += t->stride)
+		parse_deferred_body(&t->ctx, &t->bodies[t->next]);
+	return NULL;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI parser_thread_proc(LPVOID arg)
+{
+	parser_thread_main(arg);
+	return 0;
+}
+#endif
+
+static int parse_deferred_bodies(struct ast_context *ctx)
+{
+	int numbodies = 0;
+	linked_list_reversed_foreach(ctx->deferred_bodies, struct deferred_body*, it, { ++numbodies; });
+	if(!numbodies)
+		return 0;
+
+	struct deferred_body *bodies = malloc(sizeof(struct deferred_body) * numbodies);
+	int n = 0;
+	linked_list_reversed_foreach(ctx->deferred_bodies, struct deferred_body*, it, { bodies[n++] = *it; });
+
+	int numthreads = ctx->numthreads < numbodies ? ctx->numthreads : numbodies;
+	struct parser_thread *threads = calloc(numthreads, sizeof(struct parser_thread));
+	for(int i = 0; i < numthreads; ++i)
+	{
+		struct parser_thread *t = &threads[i];
+		t->bodies = bodies;
+		t->numbodies = numbodies;
+		t->next = i;
+		t->stride = numthreads;
+		//type definitions are only read from here on, so they can be shared
+		t->ctx.type_definitions = ctx->type_definitions;
+		t->ctx.numtypes = ctx->numtypes;
+		t->ctx.parse_context.tokens = ctx->parse_context.tokens;
+		t->ctx.node_list = linked_list_create(struct ast_node);
+		linked_list_prepend(ctx->arenas, t->ctx.node_list);
+	}
+
+	int error = 0;
+#ifdef _WIN32
+	HANDLE *handles = malloc(sizeof(HANDLE) * numthreads);
+	for(int i = 0; i < numthreads; ++i)
+		handles[i] = CreateThread(NULL, 0, parser_thread_proc, &threads[i], 0, NULL);
+	for(int i = 0; i < numthreads; ++i)
+	{
+		if(!handles[i])
+		{
+			parser_thread_main(&threads[i]);
+			continue;
+		}
+		WaitForSingleObject(handles[i], INFINITE);
+		CloseHandle(handles[i]);
+	}
+	free(handles);
+#else
+	pthread_t *handles = malloc(sizeof(pthread_t) * numthreads);
+	int *started = calloc(numthreads, sizeof(int));
+	for(int i = 0; i < numthreads; ++i)
+		started[i] = !pthread_create(&handles[i], NULL, parser_thread_main, &threads[i]);
+	for(int i = 0; i < numthreads; ++i)
+	{
+		//couldn't create the thread, parse it's bodies on this thread instead
+		if(!started[i])
+			parser_thread_main(&threads[i]);
+		else
+			pthread_join(handles[i], NULL);
+	}
+	free(started);
+	free(handles);
+#endif
+	for(int i = 0; i < numthreads; ++i)
+		error |= threads[i].error;
+	free(threads);
+	free(bodies);
+	return error;
+}
+
 static struct ast_node *program(struct ast_context *ctx)
 {
     struct ast_node *program_node = push_node(ctx, AST_PROGRAM);
     program_node->program_data.body = linked_list_create(void*);
+    program_node->program_data.type_definitions = ctx->type_definitions;
     
     while(1)
     {
@@ -1189,9 +1411,12 @@ static struct ast_node *program(struct ast_context *ctx)
             continue;
         }
 
+		int regparm = -1;
+		int inlining = function_specifiers(ctx, INLINE_DEFAULT, &regparm);
 		struct ast_node* type_decl = NULL;
         int td = type_declaration( ctx , &type_decl );
         ast_assert(ctx, !td, "error in type declaration");
+		inlining = function_specifiers(ctx, inlining, &regparm);
 		// TODO: implement global variables assignment, function prototypes and a preprocessor
 		if ( !type_decl )
 			ast_error( ctx, "expected function return type got '%s'", token_type_to_string( parse_token(&ctx->parse_context)->type ) );
@@ -1231,23 +1456,90 @@ static struct ast_node *program(struct ast_context *ctx)
 		}
 
 		ast_expect( ctx, ')', "expected ) after function" );
+		decl->func_decl_data.inlining = function_specifiers(ctx, inlining, &regparm);
+		decl->func_decl_data.regparm = regparm;
 
 		struct ast_node* block_node = NULL;
 		//check if it's just a forward decl
 		if (ast_accept(ctx, ';'))
 		{
-			statement_node(ctx, &block_node);
-			ast_assert(ctx, block_node->type == AST_BLOCK_STMT, "expected { after function");
+			if(ctx->lazy)
+			{
+				decl->func_decl_data.lazy_body_start = skip_block(ctx);
+				decl->func_decl_data.lazy_body_end = ctx->parse_context.token_index;
+			} else if(ctx->numthreads > 1)
+			{
+				//all file scope types are known once we're done, leave the body for the parser threads
+				struct deferred_body body = { .decl = decl };
+				body.start = skip_block(ctx);
+				body.end = ctx->parse_context.token_index;
+				linked_list_prepend(ctx->deferred_bodies, body);
+			} else
+			{
+				statement_node(ctx, &block_node);
+				ast_assert(ctx, block_node->type == AST_BLOCK_STMT, "expected { after function");
+			}
 		}
 		linked_list_prepend( program_node->program_data.body, decl );
         ctx->function = NULL;
 		decl->func_decl_data.body = block_node;
 	}
+	if(ctx->numthreads > 1)
+	{
+		ast_assert(ctx, !parse_deferred_bodies(ctx), "failed to parse function bodies");
+		program_node->program_data.arenas = ctx->arenas;
+	}
     return program_node;
 }
 
+static void destroy_arenas(struct linked_list **arenas)
+{
+	if(!*arenas)
+		return;
+	linked_list_reversed_foreach(*arenas, struct linked_list**, it, { linked_list_destroy(it); });
+	linked_list_destroy(arenas);
+}
+
+//frees the tree, including the nodes that were allocated by parser threads
+void destroy_ast(struct linked_list **ll, struct ast_node *root)
+{
+	if(root && root->type == AST_PROGRAM)
+	{
+		destroy_arenas(&root->program_data.arenas);
+		free(root->program_data.parser);
+		root->program_data.parser = NULL;
+	}
+	linked_list_destroy(ll);
+}
+
+//parses the body of a function that was skipped in lazy mode, the tokens have to be kept around until then
+int ast_parse_function_body(struct ast_node *program, struct ast_node *decl)
+{
+	if(!ast_function_is_lazy(decl))
+		return 0;
+	struct ast_context *ctx = program->program_data.parser;
+	assert(ctx);
+	if(setjmp(ctx->jmp))
+	{
+		printf("parsing body of function '%s' failed\n", decl->func_decl_data.id->identifier_data.name);
+		ctx->function = NULL;
+		return 1;
+	}
+	struct deferred_body body = {
+		.decl = decl,
+		.start = decl->func_decl_data.lazy_body_start,
+		.end = decl->func_decl_data.lazy_body_end
+	};
+	parse_deferred_body(ctx, &body);
+	if(ctx->verbose)
+		print_ast(decl, 0);
+	return 0;
+}
+
 //TODO: fix head/root expression/statement flow
-int generate_ast(struct token *tokens, int num_tokens, struct linked_list **ll/*for freeing the whole tree*/, struct ast_node **root, bool verbose)
+//numthreads > 1 parses the function bodies on seperate threads
+//lazy only parses the function bodies when ast_parse_function_body is called, one at a time so it turns the threads off
+int generate_ast(struct token *tokens, int num_tokens, struct linked_list **ll/*for freeing the whole tree*/, struct ast_node **root, bool verbose, int numthreads, bool lazy)
 {
     struct ast_context context = {
         .root_node = NULL,
@@ -1256,7 +1548,9 @@ int generate_ast(struct token *tokens, int num_tokens, struct linked_list **ll/*
         .function = NULL,
         .last_node = NULL,
         .type_definitions = hash_map_create(struct ast_node),
-		.numtypes = 0
+		.numtypes = 0,
+		.numthreads = lazy ? 1 : numthreads,
+		.lazy = lazy
     };
 
     context.parse_context.current_token = NULL;
@@ -1271,6 +1565,11 @@ int generate_ast(struct token *tokens, int num_tokens, struct linked_list **ll/*
     }
     
 	context.node_list = linked_list_create( struct ast_node );
+	if(context.numthreads > 1)
+	{
+		context.deferred_bodies = linked_list_create(struct deferred_body);
+		context.arenas = linked_list_create(struct linked_list*);
+	}
     context.root_node = program(&context);
     
     if(context.root_node)
@@ -1280,9 +1579,21 @@ int generate_ast(struct token *tokens, int num_tokens, struct linked_list **ll/*
 
         *root = context.root_node;
         *ll = context.node_list;
+		if(context.deferred_bodies)
+			linked_list_destroy(&context.deferred_bodies);
+		if(lazy)
+		{
+			//the nodes of the bodies that get parsed later on end up in the same node list
+			struct ast_context *parser = malloc(sizeof(struct ast_context));
+			*parser = context;
+			context.root_node->program_data.parser = parser;
+		}
         return 0;
     }
 fail:
+	if(context.deferred_bodies)
+		linked_list_destroy(&context.deferred_bodies);
+	destroy_arenas(&context.arenas);
     linked_list_destroy(&context.node_list);
 	return 1;
 }
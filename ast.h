@@ -30,6 +30,7 @@
 #include "ast_node_type.h"
 
 struct ast_node;
+struct ast_context;
 
 #define IDENT_CHARLEN (64)
 
@@ -138,6 +139,15 @@ struct ast_do_while_stmt
     struct ast_node *body;
 };
 
+//how a function may be inlined, in order of precedence
+enum AST_INLINE
+{
+    INLINE_DEFAULT,
+    INLINE_HINT, //inline
+    INLINE_ALWAYS, //__attribute__((always_inline))
+    INLINE_NEVER //__attribute__((noinline))
+};
+
 struct ast_function_decl
 {
     struct ast_node *id;
@@ -146,14 +156,21 @@ struct ast_function_decl
     struct ast_node *body; //no body means just forward declaration, just prototype function
     struct ast_node *return_data_type;
     int variadic;
+    int inlining; //AST_INLINE
+    int regparm; //arguments passed in registers with __attribute__((regparm(n))) or __fastcall, -1 for -mregparm
     //TODO: access same named variables in different scopes
     struct ast_node *declarations[64]; //TODO: increase max amount of local variables, for now this'll do
     int numdeclarations;
+    int lazy_body_start, lazy_body_end; //token range of a body that is parsed on first use, see ast_parse_function_body
 };
 
 struct ast_program
 {
     struct linked_list *body;   
+    struct hash_map *type_definitions; //typedef, struct, union and enum declarations by name
+    struct linked_list *arenas; //node lists of the parser threads, see destroy_ast
+    struct ast_context *parser; //kept around for parsing lazy function bodies
+    struct hash_map *functions; //definitions by name for the call graph, see sema
 };
 
 struct ast_return_stmt
@@ -198,6 +215,12 @@ struct ast_struct_decl
 	char name[IDENT_CHARLEN];
 	struct ast_node* fields[32]; // TODO: increase N
 	int numfields;
+	int packed; //__attribute__((packed)), no padding between fields
+
+	//computed once on first use by struct_layout (sema.c)
+	int laid_out;
+	int size, alignment;
+	int offsets[32];
 };
 
 struct ast_variable_decl
@@ -269,12 +292,32 @@ struct ast_enum_value
     int value;
 };
 
+//filled in by the semantic analysis pass (sema.c)
+struct ast_sema
+{
+    int resolved; //operand_size is valid
+    struct ast_node *data_type; //declared type of identifiers, resolved type of other expressions or NULL for int
+    int operand_size[2]; //data_type_operand_size with ptr 0 and 1
+    int lvalue;
+    struct ast_node *field; //struct member expressions, the field declaration that's accessed
+    int field_offset, field_size;
+    int temporaries; //registers needed to hold intermediate results without spilling, for functions the most any expression needs
+    int address_taken; //local variables that have to live in memory, their address is taken or they're used in a way only memory allows. functions that are used as a value
+    int uses; //local variables, number of uses weighted by loop nesting
+    int calls; //functions, number of calls to it from reachable functions
+    struct ast_node **callees; //functions, the call graph: definitions it calls or uses as a value, once for every call site
+    int numcallees;
+    int reachable; //functions, it's main, it's address is taken or a reachable function calls it
+    int is_unsigned; //the value is an unsigned int, for binary and compound assignment expressions the operation is done unsigned
+};
+
 struct ast_node
 {
     struct ast_node *parent;
 	enum AST_NODE_TYPE type;
     int start, end;
     int rvalue;
+    struct ast_sema sema;
     union
     {
         struct ast_block_stmt block_stmt_data;
@@ -309,6 +352,42 @@ struct ast_node
     };
 };
 
+//function with a body that hasn't been parsed yet
+static bool ast_function_is_lazy(struct ast_node *n)
+{
+    return n->type == AST_FUNCTION_DECL && !n->func_decl_data.body && n->func_decl_data.lazy_body_end > 0;
+}
+
+//operands that can be loaded straight into any register
+static bool ast_is_leaf(struct ast_node *n)
+{
+    return n->type == AST_LITERAL || n->type == AST_IDENTIFIER;
+}
+
+//expressions that are evaluated using only scratch registers, no calls or stores
+static bool ast_is_register_only(struct ast_node *n)
+{
+    if(n->type == AST_BIN_EXPR)
+        return ast_is_register_only(n->bin_expr_data.lhs) && ast_is_register_only(n->bin_expr_data.rhs);
+    return ast_is_leaf(n);
+}
+
+//sethi-ullman order of the operands of a binary expression, the one that needs more registers is evaluated first
+//so the result of the other one isn't held in a register meanwhile. leafs are loaded last since they need none
+//and expressions with calls or stores keep their order
+static bool ast_rhs_first(struct ast_node *n)
+{
+    struct ast_node *lhs = n->bin_expr_data.lhs;
+    struct ast_node *rhs = n->bin_expr_data.rhs;
+    if(ast_is_leaf(rhs))
+        return false;
+    if(ast_is_leaf(lhs))
+        return true;
+    if(!ast_is_register_only(lhs) || !ast_is_register_only(rhs))
+        return false;
+    return rhs->sema.temporaries > lhs->sema.temporaries;
+}
+
 static void ast_print_node_type(const char *key, struct ast_node *n)
 {
     printf("node type: %s -> %s\n", key, AST_NODE_TYPE_to_string(n->type));
@@ -0,0 +1,727 @@
+//compact binary AST format, so the front-end (preprocessing, lexing and parsing) can be skipped
+//the file is a header followed by flat tables, all references are indices instead of pointers
+//
+//	header
+//	nodes    ast_file_node[numnodes]
+//	children i32[numchildren]            child node indices, -1 for NULL
+//	types    ast_file_type[numtypes]     named type definitions (typedef/struct/union/enum)
+//	strings  char[stringsize]            interned NUL terminated strings
+//
+//the loader maps the file and rebuilds the node graph in a single pass without touching the parser
+//NOTE: the format uses the byte order of the host
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "ast.h"
+#include "types.h"
+#include "std.h"
+#include "rhd/heap_string.h"
+#include "rhd/linked_list.h"
+#include "rhd/hash_map.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define AST_FILE_MAGIC "RAST"
+#define AST_FILE_VERSION (4)
+
+#define AST_FILE_MAX_CHILDREN (128)
+#define AST_FILE_MAX_SCALARS (5)
+
+struct ast_file_header
+{
+	char magic[4];
+	u32 version;
+	u32 root;
+	u32 numnodes;
+	u32 nodes_offset;
+	u32 numchildren;
+	u32 children_offset;
+	u32 numtypes;
+	u32 types_offset;
+	u32 stringsize;
+	u32 strings_offset;
+};
+
+struct ast_file_node
+{
+	i32 type;
+	i32 start, end;
+	i32 rvalue;
+	i32 string; //offset into the string table or -1
+	i32 first_child;
+	i32 numchildren;
+	i32 scalars[AST_FILE_MAX_SCALARS];
+};
+
+struct ast_file_type
+{
+	i32 name;
+	i32 node;
+};
+
+//describes where the fields of a node are stored, used for both writing and reading
+struct ast_node_fields
+{
+	struct ast_node **children[AST_FILE_MAX_CHILDREN];
+	int numchildren;
+	struct linked_list **list; //body of a block or program
+	int *scalars[AST_FILE_MAX_SCALARS];
+	int numscalars;
+	char *string;
+	size_t stringsize;
+};
+
+static void field_child(struct ast_node_fields *f, struct ast_node **slot)
+{
+	assert(f->numchildren < AST_FILE_MAX_CHILDREN);
+	f->children[f->numchildren++] = slot;
+}
+
+static void field_scalar(struct ast_node_fields *f, int *scalar)
+{
+	assert(f->numscalars < AST_FILE_MAX_SCALARS);
+	f->scalars[f->numscalars++] = scalar;
+}
+
+#define field_string(f, s) \
+	do { (f)->string = (s); (f)->stringsize = sizeof(s); } while(0)
+
+//NOTE: scalars must come first, array lengths are scalars and are read before the children are
+static int ast_node_fields(struct ast_node *n, struct ast_node_fields *f)
+{
+	memset(f, 0, sizeof(*f));
+	switch(n->type)
+	{
+	case AST_IDENTIFIER:
+		field_string(f, n->identifier_data.name);
+		break;
+	case AST_LITERAL:
+	{
+		//raw bits of the value, the union is at most 8 bytes for non-string literals
+		int *raw = (int*)&n->literal_data.dbl;
+		field_scalar(f, (int*)&n->literal_data.type);
+		if(n->literal_data.type == LITERAL_STRING)
+			field_string(f, n->literal_data.string);
+		else
+		{
+			field_scalar(f, &raw[0]);
+			field_scalar(f, &raw[1]);
+		}
+	} break;
+	case AST_UNARY_EXPR:
+		field_scalar(f, &n->unary_expr_data.operator);
+		field_scalar(f, &n->unary_expr_data.prefix);
+		field_child(f, &n->unary_expr_data.argument);
+		break;
+	case AST_BIN_EXPR:
+	case AST_ASSIGNMENT_EXPR:
+		field_scalar(f, &n->bin_expr_data.operator);
+		field_child(f, &n->bin_expr_data.lhs);
+		field_child(f, &n->bin_expr_data.rhs);
+		break;
+	case AST_TERNARY_EXPR:
+		field_child(f, &n->ternary_expr_data.condition);
+		field_child(f, &n->ternary_expr_data.consequent);
+		field_child(f, &n->ternary_expr_data.alternative);
+		break;
+	case AST_EXPR_STMT:
+		field_child(f, &n->expr_stmt_data.expr);
+		break;
+	case AST_FUNCTION_CALL_EXPR:
+		field_scalar(f, &n->call_expr_data.numargs);
+		field_child(f, &n->call_expr_data.callee);
+		for(int i = 0; i < n->call_expr_data.numargs; ++i)
+			field_child(f, &n->call_expr_data.arguments[i]);
+		break;
+	case AST_IF_STMT:
+		field_child(f, &n->if_stmt_data.test);
+		field_child(f, &n->if_stmt_data.consequent);
+		field_child(f, &n->if_stmt_data.alternative);
+		break;
+	case AST_FOR_STMT:
+		field_child(f, &n->for_stmt_data.init);
+		field_child(f, &n->for_stmt_data.test);
+		field_child(f, &n->for_stmt_data.update);
+		field_child(f, &n->for_stmt_data.body);
+		break;
+	case AST_WHILE_STMT:
+		field_child(f, &n->while_stmt_data.test);
+		field_child(f, &n->while_stmt_data.body);
+		break;
+	case AST_DO_WHILE_STMT:
+		field_child(f, &n->do_while_stmt_data.test);
+		field_child(f, &n->do_while_stmt_data.body);
+		break;
+	case AST_BLOCK_STMT:
+		f->list = &n->block_stmt_data.body;
+		break;
+	case AST_PROGRAM:
+		f->list = &n->program_data.body;
+		break;
+	case AST_FUNCTION_DECL:
+		field_scalar(f, &n->func_decl_data.numparms);
+		field_scalar(f, &n->func_decl_data.variadic);
+		field_scalar(f, &n->func_decl_data.inlining);
+		field_scalar(f, &n->func_decl_data.regparm);
+		field_scalar(f, &n->func_decl_data.numdeclarations);
+		field_child(f, &n->func_decl_data.id);
+		field_child(f, &n->func_decl_data.return_data_type);
+		field_child(f, &n->func_decl_data.body);
+		for(int i = 0; i < n->func_decl_data.numparms; ++i)
+			field_child(f, &n->func_decl_data.parameters[i]);
+		for(int i = 0; i < n->func_decl_data.numdeclarations; ++i)
+			field_child(f, &n->func_decl_data.declarations[i]);
+		break;
+	case AST_RETURN_STMT:
+		field_child(f, &n->return_stmt_data.argument);
+		break;
+	case AST_MEMBER_EXPR:
+	case AST_STRUCT_MEMBER_EXPR:
+		field_scalar(f, &n->member_expr_data.computed);
+		field_scalar(f, &n->member_expr_data.as_pointer);
+		field_child(f, &n->member_expr_data.object);
+		field_child(f, &n->member_expr_data.property);
+		break;
+	case AST_VARIABLE_DECL:
+		field_child(f, &n->variable_decl_data.id);
+		field_child(f, &n->variable_decl_data.data_type);
+		field_child(f, &n->variable_decl_data.initializer_value);
+		break;
+	case AST_PRIMITIVE:
+		field_scalar(f, &n->primitive_data.primitive_type);
+		field_scalar(f, &n->primitive_data.qualifiers);
+		break;
+	case AST_ARRAY_DATA_TYPE:
+	case AST_POINTER_DATA_TYPE:
+	case AST_STRUCT_DATA_TYPE:
+	case AST_DATA_TYPE:
+		field_scalar(f, &n->data_type_data.qualifiers);
+		field_scalar(f, &n->data_type_data.array_size);
+		field_child(f, &n->data_type_data.data_type);
+		break;
+	case AST_STRUCT_DECL:
+	case AST_UNION_DECL:
+		field_scalar(f, &n->struct_decl_data.numfields);
+		field_scalar(f, &n->struct_decl_data.packed);
+		field_string(f, n->struct_decl_data.name);
+		for(int i = 0; i < n->struct_decl_data.numfields; ++i)
+			field_child(f, &n->struct_decl_data.fields[i]);
+		break;
+	case AST_SIZEOF:
+		field_child(f, &n->sizeof_data.subject);
+		break;
+	case AST_EMIT:
+		field_scalar(f, &n->emit_data.opcode);
+		break;
+	case AST_SEQ_EXPR:
+		field_scalar(f, &n->seq_expr_data.numexpr);
+		for(int i = 0; i < n->seq_expr_data.numexpr; ++i)
+			field_child(f, &n->seq_expr_data.expr[i]);
+		break;
+	case AST_CAST:
+		field_child(f, &n->cast_data.type);
+		field_child(f, &n->cast_data.expr);
+		break;
+	case AST_TYPEDEF:
+		field_string(f, n->typedef_data.name);
+		field_child(f, &n->typedef_data.type);
+		break;
+	case AST_ENUM:
+		field_scalar(f, &n->enum_data.numvalues);
+		field_string(f, n->enum_data.name);
+		for(int i = 0; i < n->enum_data.numvalues; ++i)
+			field_child(f, &n->enum_data.values[i]);
+		break;
+	case AST_ENUM_VALUE:
+		field_scalar(f, &n->enum_value_data.value);
+		field_string(f, n->enum_value_data.ident);
+		break;
+	case AST_BREAK_STMT:
+	case AST_EMPTY:
+	case AST_EXIT:
+		break;
+	default:
+		debug_printf("unhandled node type '%s' in ast file\n", AST_NODE_TYPE_to_string(n->type));
+		return 1;
+	}
+	return 0;
+}
+
+#define count_fits(count, array) ((count) >= 0 && (count) <= (int)COUNT_OF(array))
+
+//the array lengths are read from the file, they have to fit the arrays they index and the children table of a record
+static int ast_node_counts_valid(struct ast_node *n)
+{
+	switch(n->type)
+	{
+	case AST_FUNCTION_CALL_EXPR:
+		return count_fits(n->call_expr_data.numargs, n->call_expr_data.arguments) &&
+		       1 + n->call_expr_data.numargs <= AST_FILE_MAX_CHILDREN;
+	case AST_FUNCTION_DECL:
+		return count_fits(n->func_decl_data.numparms, n->func_decl_data.parameters) &&
+		       count_fits(n->func_decl_data.numdeclarations, n->func_decl_data.declarations) &&
+		       3 + n->func_decl_data.numparms + n->func_decl_data.numdeclarations <= AST_FILE_MAX_CHILDREN;
+	case AST_STRUCT_DECL:
+	case AST_UNION_DECL:
+		return count_fits(n->struct_decl_data.numfields, n->struct_decl_data.fields) &&
+		       n->struct_decl_data.numfields <= AST_FILE_MAX_CHILDREN;
+	case AST_SEQ_EXPR:
+		return count_fits(n->seq_expr_data.numexpr, n->seq_expr_data.expr) &&
+		       n->seq_expr_data.numexpr <= AST_FILE_MAX_CHILDREN;
+	case AST_ENUM:
+		return count_fits(n->enum_data.numvalues, n->enum_data.values) &&
+		       n->enum_data.numvalues <= AST_FILE_MAX_CHILDREN;
+	}
+	return 1;
+}
+
+//node pointer -> index, open addressing
+struct node_index_map
+{
+	struct ast_node **keys;
+	int *values;
+	int capacity;
+	int count;
+};
+
+static size_t node_index_hash(struct ast_node *n, int capacity)
+{
+	uintptr_t p = (uintptr_t)n;
+	p ^= p >> 17;
+	p *= 0x9e3779b1;
+	return p & (capacity - 1);
+}
+
+static void node_index_map_grow(struct node_index_map *m);
+
+static int node_index_map_find(struct node_index_map *m, struct ast_node *n)
+{
+	if(!m->capacity)
+		return -1;
+	for(size_t i = node_index_hash(n, m->capacity);; i = (i + 1) & (m->capacity - 1))
+	{
+		if(!m->keys[i])
+			return -1;
+		if(m->keys[i] == n)
+			return m->values[i];
+	}
+}
+
+static void node_index_map_insert(struct node_index_map *m, struct ast_node *n, int value)
+{
+	if((m->count + 1) * 2 > m->capacity)
+		node_index_map_grow(m);
+	size_t i = node_index_hash(n, m->capacity);
+	while(m->keys[i])
+		i = (i + 1) & (m->capacity - 1);
+	m->keys[i] = n;
+	m->values[i] = value;
+	++m->count;
+}
+
+static void node_index_map_grow(struct node_index_map *m)
+{
+	struct node_index_map g = { .capacity = m->capacity ? m->capacity * 2 : 1024, .count = 0 };
+	g.keys = calloc(g.capacity, sizeof(g.keys[0]));
+	g.values = calloc(g.capacity, sizeof(g.values[0]));
+	for(int i = 0; i < m->capacity; ++i)
+	{
+		if(m->keys[i])
+			node_index_map_insert(&g, m->keys[i], m->values[i]);
+	}
+	free(m->keys);
+	free(m->values);
+	*m = g;
+}
+
+struct ast_writer
+{
+	struct node_index_map indices;
+	struct ast_node **nodes; //nodes in index order
+	int numnodes;
+	int maxnodes;
+	heap_string strings;
+	struct hash_map *interned; //string -> offset in the string table
+	int error;
+};
+
+static int writer_intern(struct ast_writer *w, const char *s)
+{
+	int *offset = hash_map_find(w->interned, s);
+	if(offset)
+		return *offset;
+	int o = heap_string_size(&w->strings);
+	heap_string_appendn(&w->strings, s, strlen(s) + 1);
+	hash_map_insert(w->interned, s, o);
+	return o;
+}
+
+//assigns indices depth first, shared nodes (declarations, struct types) are only stored once
+static int writer_visit(struct ast_writer *w, struct ast_node *n)
+{
+	if(!n)
+		return -1;
+	int index = node_index_map_find(&w->indices, n);
+	if(index != -1)
+		return index;
+	index = w->numnodes++;
+	if(w->numnodes > w->maxnodes)
+	{
+		w->maxnodes = w->maxnodes ? w->maxnodes * 2 : 1024;
+		w->nodes = realloc(w->nodes, w->maxnodes * sizeof(w->nodes[0]));
+	}
+	w->nodes[index] = n;
+	node_index_map_insert(&w->indices, n, index);
+
+	struct ast_node_fields f;
+	if(ast_node_fields(n, &f))
+	{
+		w->error = 1;
+		return index;
+	}
+	for(int i = 0; i < f.numchildren; ++i)
+		writer_visit(w, *f.children[i]);
+	if(f.list && *f.list)
+		linked_list_reversed_foreach(*f.list, struct ast_node**, it, { writer_visit(w, *it); });
+	return index;
+}
+
+int serialize_ast(struct ast_node *root, const char *path)
+{
+	assert(root->type == AST_PROGRAM);
+	struct ast_writer w = { .interned = hash_map_create(int) };
+
+	//the tokens are gone once the file is loaded again, so parse the lazy function bodies now
+	int ast_parse_function_body(struct ast_node *program, struct ast_node *decl);
+	linked_list_reversed_foreach(root->program_data.body, struct ast_node**, it,
+	{
+		if(ast_function_is_lazy(*it) && ast_parse_function_body(root, *it))
+			return 1;
+	});
+
+	writer_visit(&w, root);
+
+	//named types are only referenced through data type nodes, store the table so unused types survive aswell
+	struct hash_map *types = root->program_data.type_definitions;
+	int numtypes = 0;
+	struct ast_file_type *typetable = NULL;
+	if(types)
+	{
+		for(size_t i = 0; i < types->bucket_size; ++i)
+		{
+			for(struct hash_bucket_entry *cur = types->buckets[i].head; cur; cur = cur->next)
+				++numtypes;
+		}
+		typetable = malloc(sizeof(typetable[0]) * (numtypes + 1));
+		numtypes = 0;
+		for(size_t i = 0; i < types->bucket_size; ++i)
+		{
+			for(struct hash_bucket_entry *cur = types->buckets[i].head; cur; cur = cur->next)
+			{
+				typetable[numtypes].name = writer_intern(&w, cur->key);
+				typetable[numtypes].node = writer_visit(&w, (struct ast_node*)cur->data);
+				++numtypes;
+			}
+		}
+	}
+
+	if(w.error)
+	{
+		free(typetable);
+		free(w.nodes);
+		free(w.indices.keys);
+		free(w.indices.values);
+		heap_string_free(&w.strings);
+		return 1;
+	}
+
+	heap_string children = NULL;
+	struct ast_file_node *records = calloc(w.numnodes + 1, sizeof(records[0]));
+	int numchildren = 0;
+	for(int i = 0; i < w.numnodes; ++i)
+	{
+		struct ast_node *n = w.nodes[i];
+		struct ast_file_node *r = &records[i];
+		struct ast_node_fields f;
+		ast_node_fields(n, &f);
+
+		r->type = n->type;
+		r->start = n->start;
+		r->end = n->end;
+		r->rvalue = n->rvalue;
+		r->string = f.string ? writer_intern(&w, f.string) : -1;
+		for(int j = 0; j < f.numscalars; ++j)
+			r->scalars[j] = *f.scalars[j];
+		r->first_child = numchildren;
+		for(int j = 0; j < f.numchildren; ++j)
+		{
+			i32 index = node_index_map_find(&w.indices, *f.children[j]);
+			heap_string_appendn(&children, (const char*)&index, sizeof(index));
+			++numchildren;
+		}
+		if(f.list && *f.list)
+		{
+			linked_list_reversed_foreach(*f.list, struct ast_node**, it,
+			{
+				i32 index = node_index_map_find(&w.indices, *it);
+				heap_string_appendn(&children, (const char*)&index, sizeof(index));
+				++numchildren;
+			});
+		}
+		r->numchildren = numchildren - r->first_child;
+	}
+
+	struct ast_file_header hdr = {
+		.magic = AST_FILE_MAGIC,
+		.version = AST_FILE_VERSION,
+		.root = 0,
+		.numnodes = w.numnodes,
+		.numchildren = numchildren,
+		.numtypes = numtypes,
+		.stringsize = heap_string_size(&w.strings)
+	};
+	hdr.nodes_offset = sizeof(hdr);
+	hdr.children_offset = hdr.nodes_offset + hdr.numnodes * sizeof(struct ast_file_node);
+	hdr.types_offset = hdr.children_offset + hdr.numchildren * sizeof(i32);
+	hdr.strings_offset = hdr.types_offset + hdr.numtypes * sizeof(struct ast_file_type);
+
+	int ret = 0;
+	FILE *fp = fopen(path, "wb");
+	if(!fp)
+	{
+		printf("failed to open '%s' for writing\n", path);
+		ret = 1;
+	} else
+	{
+		fwrite(&hdr, sizeof(hdr), 1, fp);
+		fwrite(records, sizeof(records[0]), hdr.numnodes, fp);
+		if(numchildren)
+			fwrite(children, sizeof(i32), numchildren, fp);
+		if(numtypes)
+			fwrite(typetable, sizeof(typetable[0]), numtypes, fp);
+		if(hdr.stringsize)
+			fwrite(w.strings, 1, hdr.stringsize, fp);
+		fclose(fp);
+	}
+
+	free(records);
+	free(typetable);
+	free(w.nodes);
+	free(w.indices.keys);
+	free(w.indices.values);
+	heap_string_free(&children);
+	heap_string_free(&w.strings);
+	return ret;
+}
+
+struct ast_file_mapping
+{
+	const u8 *data;
+	size_t size;
+};
+
+static int map_ast_file(const char *path, struct ast_file_mapping *m)
+{
+#ifdef _WIN32
+	//no mmap, read it into memory instead
+	FILE *fp = fopen(path, "rb");
+	if(!fp)
+		return 1;
+	fseek(fp, 0, SEEK_END);
+	m->size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	u8 *data = malloc(m->size);
+	if(fread(data, 1, m->size, fp) != m->size)
+	{
+		free(data);
+		fclose(fp);
+		return 1;
+	}
+	fclose(fp);
+	m->data = data;
+#else
+	int fd = open(path, O_RDONLY);
+	if(fd == -1)
+		return 1;
+	struct stat st;
+	if(fstat(fd, &st) == -1 || st.st_size == 0)
+	{
+		close(fd);
+		return 1;
+	}
+	m->size = st.st_size;
+	void *data = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED)
+		return 1;
+	m->data = data;
+#endif
+	return 0;
+}
+
+static void unmap_ast_file(struct ast_file_mapping *m)
+{
+#ifdef _WIN32
+	free((void*)m->data);
+#else
+	munmap((void*)m->data, m->size);
+#endif
+}
+
+static int ast_file_table_valid(const struct ast_file_mapping *m, u32 offset, u32 count, size_t elemsize)
+{
+	return offset <= m->size && count <= (m->size - offset) / elemsize;
+}
+
+int deserialize_ast(const char *path, struct linked_list **ll /*for freeing the whole tree*/, struct ast_node **root)
+{
+	struct ast_file_mapping m;
+	if(map_ast_file(path, &m))
+	{
+		printf("failed to read ast file '%s'\n", path);
+		return 1;
+	}
+	const struct ast_file_header *hdr = (const struct ast_file_header*)m.data;
+	if(m.size < sizeof(*hdr) || memcmp(hdr->magic, AST_FILE_MAGIC, 4) || hdr->version != AST_FILE_VERSION)
+	{
+		printf("'%s' is not a valid ast file\n", path);
+		unmap_ast_file(&m);
+		return 1;
+	}
+	if(!ast_file_table_valid(&m, hdr->nodes_offset, hdr->numnodes, sizeof(struct ast_file_node)) ||
+	   !ast_file_table_valid(&m, hdr->children_offset, hdr->numchildren, sizeof(i32)) ||
+	   !ast_file_table_valid(&m, hdr->types_offset, hdr->numtypes, sizeof(struct ast_file_type)) ||
+	   !ast_file_table_valid(&m, hdr->strings_offset, hdr->stringsize, 1) || hdr->root >= hdr->numnodes)
+	{
+		printf("ast file '%s' is truncated\n", path);
+		unmap_ast_file(&m);
+		return 1;
+	}
+	const struct ast_file_node *records = (const struct ast_file_node*)(m.data + hdr->nodes_offset);
+	const i32 *children = (const i32*)(m.data + hdr->children_offset);
+	const struct ast_file_type *typetable = (const struct ast_file_type*)(m.data + hdr->types_offset);
+	const char *strings = (const char*)(m.data + hdr->strings_offset);
+
+	struct linked_list *node_list = linked_list_create(struct ast_node);
+	struct ast_node **nodes = malloc(sizeof(nodes[0]) * (hdr->numnodes + 1));
+	for(u32 i = 0; i < hdr->numnodes; ++i)
+	{
+		struct ast_node t = { .parent = NULL, .type = records[i].type };
+		nodes[i] = linked_list_prepend(node_list, t);
+	}
+
+	int error = 0;
+	for(u32 i = 0; i < hdr->numnodes && !error; ++i)
+	{
+		const struct ast_file_node *r = &records[i];
+		struct ast_node *n = nodes[i];
+		n->start = r->start;
+		n->end = r->end;
+		n->rvalue = r->rvalue;
+
+		//first pass only tells us where the scalars go, they decide the amount of children
+		struct ast_node_fields f;
+		if(ast_node_fields(n, &f))
+		{
+			error = 1;
+			break;
+		}
+		for(int j = 0; j < f.numscalars; ++j)
+			*f.scalars[j] = r->scalars[j];
+		if(!ast_node_counts_valid(n))
+		{
+			error = 1;
+			break;
+		}
+		ast_node_fields(n, &f);
+
+		if(f.string)
+		{
+			if(r->string < 0 || r->string >= hdr->stringsize)
+			{
+				error = 1;
+				break;
+			}
+			snprintf(f.string, f.stringsize, "%s", &strings[r->string]);
+		}
+
+		if(r->first_child < 0 || r->numchildren < 0 || r->first_child > hdr->numchildren ||
+		   r->numchildren > hdr->numchildren - r->first_child)
+		{
+			error = 1;
+			break;
+		}
+		const i32 *c = &children[r->first_child];
+		if(f.list)
+		{
+			*f.list = linked_list_create(void*);
+			for(int j = 0; j < r->numchildren; ++j)
+			{
+				if(c[j] < 0 || c[j] >= hdr->numnodes)
+				{
+					error = 1;
+					break;
+				}
+				linked_list_prepend(*f.list, nodes[c[j]]);
+			}
+		} else
+		{
+			if(r->numchildren != f.numchildren)
+			{
+				error = 1;
+				break;
+			}
+			for(int j = 0; j < f.numchildren; ++j)
+			{
+				if(c[j] >= (i32)hdr->numnodes)
+				{
+					error = 1;
+					break;
+				}
+				*f.children[j] = c[j] < 0 ? NULL : nodes[c[j]];
+			}
+		}
+	}
+
+	struct ast_node *program = nodes[hdr->root];
+	if(!error && program->type != AST_PROGRAM)
+		error = 1;
+	if(!error)
+	{
+		struct hash_map *types = hash_map_create(struct ast_node);
+		for(u32 i = 0; i < hdr->numtypes; ++i)
+		{
+			const struct ast_file_type *t = &typetable[i];
+			if(t->name < 0 || t->name >= hdr->stringsize || t->node < 0 || t->node >= hdr->numnodes)
+			{
+				error = 1;
+				break;
+			}
+			hash_map_insert(types, &strings[t->name], *nodes[t->node]);
+		}
+		program->program_data.type_definitions = types;
+	}
+
+	free(nodes);
+	unmap_ast_file(&m);
+	if(error)
+	{
+		printf("ast file '%s' is corrupt\n", path);
+		linked_list_destroy(&node_list);
+		return 1;
+	}
+	*root = program;
+	*ll = node_list;
+	return 0;
+}
@@ -42,6 +42,8 @@ struct variable
     int offset;
     int is_param;
     struct ast_node *data_type_node;
+    int is_register; //lives in reg instead of on the stack
+    reg_t reg;
 };
 
 struct function
@@ -50,6 +52,20 @@ struct function
     const char *name;
     struct hash_map *variables;
     int localvariablesize;
+    struct ast_node *decl;
+    int pending; //referenced before it was generated, calls to it are patched once it is
+    int framesize; //bytes reserved for local variables
+    //registers saved in the prologue, first the ones local variables are kept in then the ones for temporaries
+    struct ast_node *register_variables[2];
+    int numregistervariables;
+    int numtemporaries;
+    int temporaries; //bitmask of the ones that are in use
+};
+
+struct call_fixup
+{
+    intptr_t from; //location of the rel32 operand
+    struct function *fn;
 };
 
 struct scope
@@ -100,6 +116,9 @@ typedef struct compiler_s
 
     struct linked_list *relocations;
     struct linked_list *functions;
+    struct linked_list *call_fixups;
+
+    struct ast_node *program;
     
 	heap_string instr;
 
@@ -111,5 +130,9 @@ typedef struct compiler_s
 
     void* find_import_fn_userptr;
     find_import_fn_t find_import_fn;
+
+    int optimize; //-O level, at 0 code is generated straight from the ast
+    int optimize_size; //-Os, instruction selection goes for the smallest code instead of the fastest
+    int regparm; //-mregparm=n, the number of arguments functions defined in the program take in registers
 } compiler_t;
 #endif
@@ -0,0 +1,255 @@
+//x86 instruction encoder, see encode.h
+//every mnemonic has its encodings in the table below, shortest first, and an instruction gets the first one its operands fit
+//so immediates that fit in a byte use the sign extended imm8 forms, eax gets the short accumulator forms,
+//add and sub of 1 become inc and dec, shifts by 1 drop the count and memory operands get the shortest displacement
+
+#include "encode.h"
+#include "std.h"
+#include <string.h>
+
+//what an operand of an encoding accepts
+enum X86_FORM_OPERAND
+{
+    F_NONE,
+    F_REG,
+    F_ACC, //eax, ax or al
+    F_CL,
+    F_RM, //register or memory, goes in the modrm
+    F_MEM,
+    F_IMM8, //sign extended from a byte
+    F_IMM, //as wide as the instruction, a byte for byte instructions
+    F_ONE, //implied by the opcode
+    F_MINUS_ONE
+};
+
+struct x86_form
+{
+    int mnemonic;
+    int size; //1 for byte instructions, 4 for the 16 (with an operand size prefix) and 32 bit ones
+    int operands[3];
+    u8 opcode[2];
+    int numopcode;
+    int digit; //opcode extension in the reg field of the modrm, -1 if it's the register operand
+    int plusreg; //the register operand is added to the opcode
+    int srcsize; //size of the source operand of movzx and movsx
+};
+
+//add, or, adc, sbb, and, sub, xor and cmp, the opcode extension is the mnemonic
+#define ALU(m) \
+    { m, 4, { F_RM, F_IMM8 }, { 0x83 }, 1, m }, \
+    { m, 4, { F_ACC, F_IMM }, { 0x05 + m * 8 }, 1, -1 }, \
+    { m, 4, { F_RM, F_IMM }, { 0x81 }, 1, m }, \
+    { m, 4, { F_RM, F_REG }, { 0x01 + m * 8 }, 1, -1 }, \
+    { m, 4, { F_REG, F_MEM }, { 0x03 + m * 8 }, 1, -1 }, \
+    { m, 1, { F_ACC, F_IMM }, { 0x04 + m * 8 }, 1, -1 }, \
+    { m, 1, { F_RM, F_IMM }, { 0x80 }, 1, m }, \
+    { m, 1, { F_RM, F_REG }, { 0x00 + m * 8 }, 1, -1 }, \
+    { m, 1, { F_REG, F_MEM }, { 0x02 + m * 8 }, 1, -1 }
+
+//not, neg, mul, imul, div and idiv of edx:eax
+#define UNARY(m, digit) \
+    { m, 4, { F_RM }, { 0xf7 }, 1, digit }, \
+    { m, 1, { F_RM }, { 0xf6 }, 1, digit }
+
+#define SHIFT(m, digit) \
+    { m, 4, { F_RM, F_ONE }, { 0xd1 }, 1, digit }, \
+    { m, 4, { F_RM, F_IMM8 }, { 0xc1 }, 1, digit }, \
+    { m, 4, { F_RM, F_CL }, { 0xd3 }, 1, digit }, \
+    { m, 1, { F_RM, F_ONE }, { 0xd0 }, 1, digit }, \
+    { m, 1, { F_RM, F_IMM8 }, { 0xc0 }, 1, digit }, \
+    { m, 1, { F_RM, F_CL }, { 0xd2 }, 1, digit }
+
+static const struct x86_form forms[] = {
+    //inc and dec leave the carry alone, nothing we generate reads it after an add or sub
+    { X86_ADD, 4, { F_REG, F_ONE }, { 0x40 }, 1, -1, 1 },
+    { X86_ADD, 4, { F_REG, F_MINUS_ONE }, { 0x48 }, 1, -1, 1 },
+    { X86_SUB, 4, { F_REG, F_ONE }, { 0x48 }, 1, -1, 1 },
+    { X86_SUB, 4, { F_REG, F_MINUS_ONE }, { 0x40 }, 1, -1, 1 },
+    ALU(X86_ADD),
+    ALU(X86_OR),
+    ALU(X86_ADC),
+    ALU(X86_SBB),
+    ALU(X86_AND),
+    ALU(X86_SUB),
+    ALU(X86_XOR),
+    ALU(X86_CMP),
+
+    { X86_MOV, 4, { F_REG, F_IMM }, { 0xb8 }, 1, -1, 1 },
+    { X86_MOV, 4, { F_MEM, F_IMM }, { 0xc7 }, 1, 0 },
+    { X86_MOV, 4, { F_RM, F_REG }, { 0x89 }, 1, -1 },
+    { X86_MOV, 4, { F_REG, F_MEM }, { 0x8b }, 1, -1 },
+    { X86_MOV, 1, { F_REG, F_IMM }, { 0xb0 }, 1, -1, 1 },
+    { X86_MOV, 1, { F_MEM, F_IMM }, { 0xc6 }, 1, 0 },
+    { X86_MOV, 1, { F_RM, F_REG }, { 0x88 }, 1, -1 },
+    { X86_MOV, 1, { F_REG, F_MEM }, { 0x8a }, 1, -1 },
+
+    { X86_MOVZX, 4, { F_REG, F_RM }, { 0x0f, 0xb6 }, 2, -1, 0, 1 },
+    { X86_MOVZX, 4, { F_REG, F_RM }, { 0x0f, 0xb7 }, 2, -1, 0, 2 },
+    { X86_MOVSX, 4, { F_REG, F_RM }, { 0x0f, 0xbe }, 2, -1, 0, 1 },
+    { X86_MOVSX, 4, { F_REG, F_RM }, { 0x0f, 0xbf }, 2, -1, 0, 2 },
+    { X86_LEA, 4, { F_REG, F_MEM }, { 0x8d }, 1, -1 },
+
+    { X86_TEST, 4, { F_ACC, F_IMM }, { 0xa9 }, 1, -1 },
+    { X86_TEST, 4, { F_RM, F_IMM }, { 0xf7 }, 1, 0 },
+    { X86_TEST, 4, { F_RM, F_REG }, { 0x85 }, 1, -1 },
+    { X86_TEST, 1, { F_ACC, F_IMM }, { 0xa8 }, 1, -1 },
+    { X86_TEST, 1, { F_RM, F_IMM }, { 0xf6 }, 1, 0 },
+    { X86_TEST, 1, { F_RM, F_REG }, { 0x84 }, 1, -1 },
+
+    { X86_PUSH, 4, { F_REG }, { 0x50 }, 1, -1, 1 },
+    { X86_PUSH, 4, { F_IMM8 }, { 0x6a }, 1, -1 },
+    { X86_PUSH, 4, { F_IMM }, { 0x68 }, 1, -1 },
+    { X86_PUSH, 4, { F_MEM }, { 0xff }, 1, 6 },
+    { X86_POP, 4, { F_REG }, { 0x58 }, 1, -1, 1 },
+    { X86_POP, 4, { F_MEM }, { 0x8f }, 1, 0 },
+
+    { X86_INC, 4, { F_REG }, { 0x40 }, 1, -1, 1 },
+    { X86_INC, 4, { F_RM }, { 0xff }, 1, 0 },
+    { X86_INC, 1, { F_RM }, { 0xfe }, 1, 0 },
+    { X86_DEC, 4, { F_REG }, { 0x48 }, 1, -1, 1 },
+    { X86_DEC, 4, { F_RM }, { 0xff }, 1, 1 },
+    { X86_DEC, 1, { F_RM }, { 0xfe }, 1, 1 },
+
+    UNARY(X86_NOT, 2),
+    UNARY(X86_NEG, 3),
+    UNARY(X86_MUL, 4),
+    UNARY(X86_IMUL, 5),
+    UNARY(X86_DIV, 6),
+    UNARY(X86_IDIV, 7),
+    { X86_IMUL, 4, { F_REG, F_RM, F_IMM8 }, { 0x6b }, 1, -1 },
+    { X86_IMUL, 4, { F_REG, F_RM, F_IMM }, { 0x69 }, 1, -1 },
+    { X86_IMUL, 4, { F_REG, F_RM }, { 0x0f, 0xaf }, 2, -1 },
+
+    SHIFT(X86_SHL, 4),
+    SHIFT(X86_SHR, 5),
+    SHIFT(X86_SAR, 7),
+
+    { X86_CDQ, 4, { F_NONE }, { 0x99 }, 1, -1 },
+    { X86_RET, 4, { F_NONE }, { 0xc3 }, 1, -1 },
+    { X86_NOP, 4, { F_NONE }, { 0x90 }, 1, -1 }
+};
+
+static const char *mnemonic_names[X86_MNEMONIC_MAX] = {
+    "add", "or", "adc", "sbb", "and", "sub", "xor", "cmp",
+    "mov", "movzx", "movsx", "lea", "test", "push", "pop", "inc", "dec",
+    "not", "neg", "mul", "imul", "div", "idiv", "shl", "shr", "sar", "cdq", "ret", "nop"
+};
+
+const char *x86_mnemonic_name(int mnemonic)
+{
+    return mnemonic >= 0 && mnemonic < X86_MNEMONIC_MAX ? mnemonic_names[mnemonic] : "?";
+}
+
+int x86_encode_memory(u8 *out, int field, reg_t base, reg_t index, int scale, i32 disp)
+{
+    int n = 0;
+    //[ebp] has no encoding without a displacement
+    int mod = disp == 0 && base != EBP ? 0 : disp >= -128 && disp <= 127 ? 1 : 2;
+    if(scale || base == ESP)
+    {
+        static const int scale_bits[] = { [1] = 0, [2] = 1, [4] = 2, [8] = 3 };
+        out[n++] = mod * 0x40 + field * 8 + 4;
+        out[n++] = (scale ? scale_bits[scale] << 6 | index << 3 : ESP << 3) | base;
+    } else
+        out[n++] = mod * 0x40 + field * 8 + base;
+    if(mod == 1)
+        out[n++] = disp & 0xff;
+    else if(mod == 2)
+    {
+        memcpy(out + n, &disp, 4);
+        n += 4;
+    }
+    return n;
+}
+
+static bool operand_matches(int form, const struct x86_operand *o)
+{
+    switch(form)
+    {
+    case F_NONE:
+        return o->kind == X86_NONE;
+    case F_REG:
+        return o->kind == X86_REG;
+    case F_ACC:
+        return o->kind == X86_REG && o->reg == EAX;
+    case F_CL:
+        return o->kind == X86_REG && o->reg == ECX;
+    case F_RM:
+        return o->kind == X86_REG || o->kind == X86_MEM;
+    case F_MEM:
+        return o->kind == X86_MEM && (!o->scale || o->index != ESP);
+    case F_IMM8:
+        return o->kind == X86_IMM && o->value >= -128 && o->value <= 127;
+    case F_IMM:
+        return o->kind == X86_IMM;
+    case F_ONE:
+        return o->kind == X86_IMM && o->value == 1;
+    case F_MINUS_ONE:
+        return o->kind == X86_IMM && o->value == -1;
+    }
+    return false;
+}
+
+static int encode_form(const struct x86_form *f, const struct x86_operand *o, int size, u8 *out)
+{
+    int n = 0;
+    if(size == 2)
+        out[n++] = 0x66;
+    for(int i = 0; i < f->numopcode; ++i)
+        out[n++] = f->opcode[i];
+    if(f->plusreg)
+        out[n - 1] += o[0].reg;
+
+    int rm = -1, reg = -1;
+    for(int i = 0; i < 3; ++i)
+    {
+        if(f->operands[i] == F_RM || f->operands[i] == F_MEM)
+            rm = i;
+        else if(f->operands[i] == F_REG && !f->plusreg)
+            reg = i;
+    }
+    if(rm != -1)
+    {
+        int field = f->digit >= 0 ? f->digit : o[reg].reg;
+        if(o[rm].kind == X86_REG)
+            out[n++] = 0xc0 + field * 8 + o[rm].reg;
+        else
+            n += x86_encode_memory(out + n, field, o[rm].reg, o[rm].index, o[rm].scale, o[rm].value);
+    }
+
+    for(int i = 0; i < 3; ++i)
+    {
+        int bytes = f->operands[i] == F_IMM8 ? 1 : f->operands[i] == F_IMM ? (size == 1 ? 1 : size) : 0;
+        memcpy(out + n, &o[i].value, bytes);
+        n += bytes;
+    }
+    return n;
+}
+
+int x86_encode(const struct x86_instruction *in, u8 *out)
+{
+    const struct x86_operand *o = in->operands;
+    //the first register or memory operand decides the size, movzx and movsx check their source separately
+    int size = 4;
+    for(int i = 0; i < 3; ++i)
+    {
+        if(o[i].kind == X86_REG || o[i].kind == X86_MEM)
+        {
+            size = o[i].size;
+            break;
+        }
+    }
+    for(int i = 0; i < COUNT_OF(forms); ++i)
+    {
+        const struct x86_form *f = &forms[i];
+        if(f->mnemonic != in->mnemonic || (f->size == 1) != (size == 1))
+            continue;
+        if(f->srcsize && o[1].size != f->srcsize)
+            continue;
+        if(!operand_matches(f->operands[0], &o[0]) || !operand_matches(f->operands[1], &o[1]) ||
+           !operand_matches(f->operands[2], &o[2]))
+            continue;
+        return encode_form(f, o, size, out);
+    }
+    return 0;
+}
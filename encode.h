@@ -0,0 +1,99 @@
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include "compile.h"
+#include <stdbool.h>
+
+//x86 instructions as a mnemonic and operands, encoded by encode.c in their shortest form
+//the code generator in x86.c emits through it and the peephole optimizer encodes its replacements with it
+
+enum X86_MNEMONIC
+{
+    //in the order of their opcode extension
+    X86_ADD,
+    X86_OR,
+    X86_ADC,
+    X86_SBB,
+    X86_AND,
+    X86_SUB,
+    X86_XOR,
+    X86_CMP,
+
+    X86_MOV,
+    X86_MOVZX,
+    X86_MOVSX,
+    X86_LEA,
+    X86_TEST,
+    X86_PUSH,
+    X86_POP,
+    X86_INC,
+    X86_DEC,
+    X86_NOT,
+    X86_NEG,
+    X86_MUL,
+    X86_IMUL,
+    X86_DIV,
+    X86_IDIV,
+    X86_SHL,
+    X86_SHR,
+    X86_SAR,
+    X86_CDQ,
+    X86_RET,
+    X86_NOP,
+    X86_MNEMONIC_MAX
+};
+
+enum X86_OPERAND_KIND
+{
+    X86_NONE,
+    X86_REG,
+    X86_IMM,
+    X86_MEM //[reg + index * scale + disp]
+};
+
+struct x86_operand
+{
+    int kind;
+    int size; //bytes, 0 for immediates which take the size of the instruction
+    reg_t reg; //register or base of a memory operand, al, cl, dl and bl are the same numbers as their 32 bit registers
+    reg_t index;
+    int scale; //0 without an index, esp can't be an index
+    i32 value; //immediate or displacement
+};
+
+struct x86_instruction
+{
+    int mnemonic;
+    struct x86_operand operands[3];
+    int offset; //where it was emitted
+    int length;
+};
+
+static struct x86_operand x86_reg(reg_t reg)
+{
+    return (struct x86_operand){ .kind = X86_REG, .size = 4, .reg = reg };
+}
+
+static struct x86_operand x86_imm(i32 value)
+{
+    return (struct x86_operand){ .kind = X86_IMM, .value = value };
+}
+
+static struct x86_operand x86_mem(reg_t base, reg_t index, int scale, i32 disp)
+{
+    return (struct x86_operand){ .kind = X86_MEM, .size = 4, .reg = base, .index = index, .scale = scale, .value = disp };
+}
+
+static struct x86_operand x86_size(struct x86_operand o, int size)
+{
+    o.size = size;
+    return o;
+}
+
+//writes the instruction to out (at least 16 bytes), returns its length or 0 if there's no encoding for the operands
+int x86_encode(const struct x86_instruction *in, u8 *out);
+//modrm, sib and displacement of a memory operand, returns the number of bytes
+int x86_encode_memory(u8 *out, int field, reg_t base, reg_t index, int scale, i32 disp);
+const char *x86_mnemonic_name(int mnemonic);
+
+#endif
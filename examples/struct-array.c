@@ -0,0 +1,30 @@
+#include <stdio.h>
+
+struct point
+{
+    int x;
+    int y;
+    char tag;
+};
+
+int main()
+{
+    point points[4];
+    for(int i = 0; i < 4; ++i)
+    {
+        point *p = &points[i];
+        p->x = i;
+        p->y = i * 10;
+        p->tag = 'a' + i;
+    }
+
+    int sum = 0;
+    for(int i = 0; i < 4; ++i)
+    {
+        point *p = &points[i];
+        printf("x = %d, y = %d, tag = %d\n", p->x, p->y, p->tag);
+        sum = sum + p->y;
+    }
+    printf("sum = %d, sizeof(points) = %d\n", sum, sizeof(points));
+	return 0;
+}
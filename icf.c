@@ -0,0 +1,302 @@
+//identical code folding, runs once every function is generated and before calls are patched
+//functions with the same code, relocations that go to the same place and calls to the same functions are merged:
+//the first one is kept, calls to the others go to it and the code after them moves down to fill the gap
+//every direct call is a call fixup (see call_function in x86.c), so the rel32 of a call isn't compared but where it goes is
+//functions whose address is taken keep their own address, main keeps the entry point
+
+#include "compile.h"
+#include "ast.h"
+#include "std.h"
+#include "rhd/linked_list.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+int instruction_position(compiler_t *ctx);
+
+#define ICF_CALL -1 //a call fixup instead of a relocation
+#define ICF_SELF -2 //a relocation to the code of the function itself, or a call to itself
+
+struct icf_reference
+{
+    int offset; //from the start of the function
+    int kind; //RELOC_TYPE or ICF_CALL
+    intptr_t to; //where a relocation goes, relative to the function with ICF_SELF, or the index of the function called
+};
+
+struct icf_function
+{
+    struct function *fn;
+    int start, end;
+    struct icf_reference *refs;
+    int numrefs;
+    u32 hash;
+    int folded; //index of the function it's the same as or -1
+    bool keep; //can't be folded into another function
+};
+
+struct icf
+{
+    compiler_t *ctx;
+    struct icf_function *functions;
+    int numfunctions;
+};
+
+static int compare_start(const void *a, const void *b)
+{
+    return ((const struct icf_function*)a)->start - ((const struct icf_function*)b)->start;
+}
+
+static int compare_offset(const void *a, const void *b)
+{
+    return ((const struct icf_reference*)a)->offset - ((const struct icf_reference*)b)->offset;
+}
+
+//the function the code at offset is in
+static struct icf_function *function_at(struct icf *I, intptr_t offset)
+{
+    int lo = 0, hi = I->numfunctions - 1;
+    while(lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        struct icf_function *f = &I->functions[mid];
+        if(offset < f->start)
+            hi = mid - 1;
+        else if(offset >= f->end)
+            lo = mid + 1;
+        else
+            return f;
+    }
+    return NULL;
+}
+
+static int function_index(struct icf *I, struct function *fn)
+{
+    for(int i = 0; i < I->numfunctions; ++i)
+        if(I->functions[i].fn == fn)
+            return i;
+    return -1;
+}
+
+static void add_reference(struct icf_function *f, int offset, int kind, intptr_t to)
+{
+    f->refs = realloc(f->refs, (f->numrefs + 1) * sizeof(f->refs[0]));
+    f->refs[f->numrefs++] = (struct icf_reference){ .offset = offset, .kind = kind, .to = to };
+}
+
+//fnv-1a of the code, without the bytes that relocations and calls patch
+static u32 hash_function(compiler_t *ctx, struct icf_function *f)
+{
+    u32 h = 2166136261u;
+    int r = 0;
+    for(int i = f->start; i < f->end; ++i)
+    {
+        if(r < f->numrefs && i == f->start + f->refs[r].offset)
+        {
+            h = (h ^ (u8)f->refs[r].kind) * 16777619u;
+            i += 3;
+            ++r;
+            continue;
+        }
+        h = (h ^ (u8)ctx->instr[i]) * 16777619u;
+    }
+    return h;
+}
+
+static int representative(struct icf *I, int i)
+{
+    while(I->functions[i].folded != -1)
+        i = I->functions[i].folded;
+    return i;
+}
+
+static bool same_target(struct icf *I, int a, struct icf_reference *ra, int b, struct icf_reference *rb)
+{
+    if(ra->kind != ICF_CALL)
+        return ra->to == rb->to;
+    //two functions that call themselves are the same, so are calls to functions that are the same
+    if(ra->to == a && rb->to == b)
+        return true;
+    return representative(I, ra->to) == representative(I, rb->to);
+}
+
+static bool same_function(struct icf *I, int a, int b)
+{
+    struct icf_function *fa = &I->functions[a], *fb = &I->functions[b];
+    if(fa->end - fa->start != fb->end - fb->start || fa->hash != fb->hash || fa->numrefs != fb->numrefs)
+        return false;
+    int prev = 0;
+    for(int r = 0; r < fa->numrefs; ++r)
+    {
+        struct icf_reference *ra = &fa->refs[r], *rb = &fb->refs[r];
+        if(ra->offset != rb->offset || ra->kind != rb->kind || !same_target(I, a, ra, b, rb))
+            return false;
+        if(memcmp(I->ctx->instr + fa->start + prev, I->ctx->instr + fb->start + prev, ra->offset - prev))
+            return false;
+        prev = ra->offset + 4;
+    }
+    return !memcmp(I->ctx->instr + fa->start + prev, I->ctx->instr + fb->start + prev, fa->end - fa->start - prev);
+}
+
+//where code at offset ends up once the folded functions are taken out
+static intptr_t moved(struct icf *I, intptr_t offset)
+{
+    intptr_t removed = 0;
+    for(int i = 0; i < I->numfunctions && I->functions[i].start < offset; ++i)
+        if(I->functions[i].folded != -1)
+            removed += I->functions[i].end - I->functions[i].start;
+    return offset - removed;
+}
+
+static bool removed(struct icf *I, intptr_t offset)
+{
+    struct icf_function *f = function_at(I, offset);
+    return f && f->folded != -1;
+}
+
+void icf_fold_functions(compiler_t *ctx)
+{
+    struct icf I = { .ctx = ctx };
+    linked_list_reversed_foreach(ctx->functions, struct function*, it,
+    {
+        if(it->location != -1 && !it->pending && it->decl)
+        {
+            I.functions = realloc(I.functions, (I.numfunctions + 1) * sizeof(I.functions[0]));
+            struct icf_function *f = &I.functions[I.numfunctions++];
+            memset(f, 0, sizeof(*f));
+            f->fn = it;
+            f->start = it->location;
+            f->folded = -1;
+        }
+    });
+    if(I.numfunctions < 2)
+    {
+        free(I.functions);
+        return;
+    }
+    //functions are generated one after the other, the last one goes to the end of the code
+    qsort(I.functions, I.numfunctions, sizeof(I.functions[0]), compare_start);
+    for(int i = 0; i < I.numfunctions; ++i)
+    {
+        struct icf_function *f = &I.functions[i];
+        f->end = i + 1 < I.numfunctions ? I.functions[i + 1].start : instruction_position(ctx);
+        f->keep = f->fn->decl->sema.address_taken || !strcmp(f->fn->name, "main");
+    }
+
+    linked_list_reversed_foreach(ctx->relocations, struct relocation*, it,
+    {
+        struct icf_function *f = function_at(&I, it->from);
+        if(f)
+        {
+            intptr_t to = it->to;
+            int kind = it->type;
+            if(it->type == RELOC_CODE && to >= f->start && to < f->end)
+            {
+                to -= f->start;
+                kind = ICF_SELF;
+            }
+            add_reference(f, it->from - f->start, kind, to);
+        }
+    });
+    linked_list_reversed_foreach(ctx->call_fixups, struct call_fixup*, it,
+    {
+        struct icf_function *f = function_at(&I, it->from);
+        int callee = function_index(&I, it->fn);
+        if(f && callee == -1)
+            f->keep = true; //a call to something that isn't here
+        else if(f)
+            add_reference(f, it->from - f->start, ICF_CALL, callee);
+    });
+    for(int i = 0; i < I.numfunctions; ++i)
+    {
+        struct icf_function *f = &I.functions[i];
+        qsort(f->refs, f->numrefs, sizeof(f->refs[0]), compare_offset);
+        f->hash = hash_function(ctx, f);
+    }
+
+    //folding callees can make their callers the same, so until nothing changes
+    int numfolded = 0, saved = 0;
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(int i = 0; i < I.numfunctions; ++i)
+        {
+            struct icf_function *f = &I.functions[i];
+            if(f->keep || f->folded != -1)
+                continue;
+            for(int j = 0; j < i; ++j)
+            {
+                if(I.functions[j].folded != -1 || !same_function(&I, j, i))
+                    continue;
+                if(opt_flags & OPT_VERBOSE)
+                    printf("icf: folded '%s' into '%s'\n", f->fn->name, I.functions[j].fn->name);
+                f->folded = j;
+                saved += f->end - f->start;
+                ++numfolded;
+                changed = true;
+                break;
+            }
+        }
+    }
+    if(opt_flags & OPT_VERBOSE)
+        printf("icf: folded %d functions, %d bytes saved\n", numfolded, saved);
+    if(!numfolded)
+    {
+        for(int i = 0; i < I.numfunctions; ++i)
+            free(I.functions[i].refs);
+        free(I.functions);
+        return;
+    }
+
+    //the code without the folded functions, everything that points into it moves with it
+    heap_string instr = NULL;
+    heap_string_appendn(&instr, ctx->instr, I.functions[0].start);
+    for(int i = 0; i < I.numfunctions; ++i)
+        if(I.functions[i].folded == -1)
+            heap_string_appendn(&instr, ctx->instr + I.functions[i].start, I.functions[i].end - I.functions[i].start);
+
+    struct linked_list *relocations = linked_list_create(struct relocation);
+    linked_list_reversed_foreach(ctx->relocations, struct relocation*, it,
+    {
+        if(!removed(&I, it->from))
+        {
+            struct relocation reloc = *it;
+            reloc.from = moved(&I, it->from);
+            if(reloc.type == RELOC_CODE)
+                reloc.to = moved(&I, it->to);
+            linked_list_prepend(relocations, reloc);
+        }
+    });
+    linked_list_destroy(&ctx->relocations);
+    ctx->relocations = relocations;
+
+    struct linked_list *call_fixups = linked_list_create(struct call_fixup);
+    linked_list_reversed_foreach(ctx->call_fixups, struct call_fixup*, it,
+    {
+        if(!removed(&I, it->from))
+        {
+            struct call_fixup fixup = *it;
+            fixup.from = moved(&I, it->from);
+            linked_list_prepend(call_fixups, fixup);
+        }
+    });
+    linked_list_destroy(&ctx->call_fixups);
+    ctx->call_fixups = call_fixups;
+
+    //the kept functions move first, the folded ones take the location of the one they're the same as
+    if(ctx->entry != 0xffffffff)
+        ctx->entry = moved(&I, ctx->entry);
+    for(int i = 0; i < I.numfunctions; ++i)
+        if(I.functions[i].folded == -1)
+            I.functions[i].fn->location = moved(&I, I.functions[i].start);
+    for(int i = 0; i < I.numfunctions; ++i)
+        if(I.functions[i].folded != -1)
+            I.functions[i].fn->location = I.functions[representative(&I, i)].fn->location;
+
+    heap_string_free(&ctx->instr);
+    ctx->instr = instr;
+    for(int i = 0; i < I.numfunctions; ++i)
+        free(I.functions[i].refs);
+    free(I.functions);
+}
@@ -0,0 +1,1920 @@
+//intermediate representation between the ast and machine code, see ir.h
+//lowers a function into three address code in basic blocks, builds the control flow graph, folds constants,
+//computes liveness and assigns the virtual registers to machine registers with linear scan
+//anything the lowering doesn't handle makes it give up on the function and the code generator falls back to the ast
+
+#include "ir.h"
+#include "token.h"
+#include "std.h"
+#include "rhd/linked_list.h"
+#include "rhd/hash_map.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+int sema_type_size(struct ast_node *n);
+
+static const char *ir_op_names[IR_OP_MAX] = {
+    [IR_NOP] = "nop",
+    [IR_MOV] = "mov",
+    [IR_STRING] = "string",
+    [IR_LOAD] = "load",
+    [IR_STORE] = "store",
+    [IR_ADD] = "add",
+    [IR_SUB] = "sub",
+    [IR_MUL] = "mul",
+    [IR_DIV] = "div",
+    [IR_MOD] = "mod",
+    [IR_UDIV] = "udiv",
+    [IR_UMOD] = "umod",
+    [IR_AND] = "and",
+    [IR_OR] = "or",
+    [IR_XOR] = "xor",
+    [IR_SHL] = "shl",
+    [IR_SAR] = "sar",
+    [IR_SHR] = "shr",
+    [IR_EQ] = "eq",
+    [IR_NE] = "ne",
+    [IR_LT] = "lt",
+    [IR_LE] = "le",
+    [IR_GT] = "gt",
+    [IR_GE] = "ge",
+    [IR_NEG] = "neg",
+    [IR_NOT] = "not",
+    [IR_LNOT] = "lnot",
+    [IR_ARG] = "arg",
+    [IR_CALL] = "call",
+    [IR_JMP] = "jmp",
+    [IR_BR] = "br",
+    [IR_RET] = "ret"
+};
+
+struct ir_variable
+{
+    int vreg; //-1 when the variable lives in a slot
+    int slot;
+    struct ast_node *data_type;
+};
+
+//a location that can be assigned to, either a variable kept in a virtual register or size bytes of memory
+struct ir_lvalue
+{
+    int vreg;
+    struct ir_operand addr;
+    struct ast_node *node; //the size is only looked up when the memory is accessed, taking the address doesn't need it
+};
+
+struct ir_lower
+{
+    struct ir_function *fn;
+    struct ir_block *block;
+    struct hash_map *variables;
+    int *order; //blocks in the order they were started, which is the order they're laid out in
+    int numorder;
+    unsigned char *isvariable; //virtual registers that hold a variable instead of a temporary
+    int breaks[16]; //block a break jumps to for every loop we're in
+    int numloops;
+    int error;
+};
+
+static struct ir_operand ir_vreg(int v)
+{
+    struct ir_operand o = { .kind = IR_VREG, .value = v };
+    return o;
+}
+
+static struct ir_operand ir_imm(int v)
+{
+    struct ir_operand o = { .kind = IR_IMM, .value = v };
+    return o;
+}
+
+static struct ir_operand ir_slot(int slot)
+{
+    struct ir_operand o = { .kind = IR_SLOT, .value = slot };
+    return o;
+}
+
+static void unsupported(struct ir_lower *L, struct ast_node *n, const char *what)
+{
+    if(!L->error && (opt_flags & OPT_VERBOSE))
+        printf("ir: %s '%s' in function '%s', using the ast\n", what, AST_NODE_TYPE_to_string(n->type), L->fn->name);
+    L->error = 1;
+}
+
+static struct ir_block *new_block(struct ir_function *fn)
+{
+    if(fn->numblocks == fn->maxblocks)
+    {
+        fn->maxblocks = fn->maxblocks ? fn->maxblocks * 2 : 16;
+        fn->blocks = realloc(fn->blocks, fn->maxblocks * sizeof(fn->blocks[0]));
+    }
+    struct ir_block *b = calloc(1, sizeof(struct ir_block));
+    b->id = fn->numblocks;
+    fn->blocks[fn->numblocks++] = b;
+    return b;
+}
+
+static int new_slot(struct ir_function *fn, int size, int param)
+{
+    if(fn->numslots == fn->maxslots)
+    {
+        fn->maxslots = fn->maxslots ? fn->maxslots * 2 : 16;
+        fn->slots = realloc(fn->slots, fn->maxslots * sizeof(fn->slots[0]));
+    }
+    fn->slots[fn->numslots].size = size;
+    fn->slots[fn->numslots].param = param;
+    return fn->numslots++;
+}
+
+static int new_vreg(struct ir_lower *L, int isvariable)
+{
+    int v = L->fn->numvregs++;
+    L->isvariable = realloc(L->isvariable, L->fn->numvregs);
+    L->isvariable[v] = isvariable;
+    return v;
+}
+
+static bool block_terminated(struct ir_block *b)
+{
+    return b->numinstrs > 0 && ir_is_terminator(b->instrs[b->numinstrs - 1].op);
+}
+
+static struct ir_instr *emit(struct ir_lower *L, int op);
+
+//continue emitting into b, the block we were in falls through to it
+static void place_block(struct ir_lower *L, struct ir_block *b)
+{
+    if(L->block && !block_terminated(L->block))
+        emit(L, IR_JMP)->target[0] = b->id;
+    L->order = realloc(L->order, (L->numorder + 1) * sizeof(L->order[0]));
+    L->order[L->numorder++] = b->id;
+    L->block = b;
+}
+
+static struct ir_instr *append(struct ir_block *b, int op)
+{
+    if(b->numinstrs == b->maxinstrs)
+    {
+        b->maxinstrs = b->maxinstrs ? b->maxinstrs * 2 : 16;
+        b->instrs = realloc(b->instrs, b->maxinstrs * sizeof(b->instrs[0]));
+    }
+    struct ir_instr *in = &b->instrs[b->numinstrs++];
+    memset(in, 0, sizeof(*in));
+    in->op = op;
+    in->dst = -1;
+    return in;
+}
+
+static struct ir_instr *emit(struct ir_lower *L, int op)
+{
+    //code after a return or break is unreachable, it gets a block of it's own that's removed later
+    if(block_terminated(L->block))
+        place_block(L, new_block(L->fn));
+    return append(L->block, op);
+}
+
+static struct ir_operand binary(struct ir_lower *L, int op, struct ir_operand a, struct ir_operand b)
+{
+    struct ir_instr *in = emit(L, op);
+    in->dst = new_vreg(L, 0);
+    in->a = a;
+    in->b = b;
+    return ir_vreg(in->dst);
+}
+
+static struct ir_operand unary(struct ir_lower *L, int op, struct ir_operand a)
+{
+    struct ir_instr *in = emit(L, op);
+    in->dst = new_vreg(L, 0);
+    in->a = a;
+    return ir_vreg(in->dst);
+}
+
+static struct ir_operand load(struct ir_lower *L, struct ir_operand addr, int size)
+{
+    struct ir_instr *in = emit(L, IR_LOAD);
+    in->dst = new_vreg(L, 0);
+    in->a = addr;
+    in->size = size;
+    return ir_vreg(in->dst);
+}
+
+static void store(struct ir_lower *L, struct ir_operand addr, struct ir_operand value, int size)
+{
+    struct ir_instr *in = emit(L, IR_STORE);
+    in->a = addr;
+    in->b = value;
+    in->size = size;
+}
+
+static void jump(struct ir_lower *L, struct ir_block *target)
+{
+    emit(L, IR_JMP)->target[0] = target->id;
+}
+
+static void branch(struct ir_lower *L, struct ir_operand cond, struct ir_block *t, struct ir_block *f)
+{
+    struct ir_instr *in = emit(L, IR_BR);
+    in->a = cond;
+    in->target[0] = t->id;
+    in->target[1] = f->id;
+}
+
+//copy of a variable's current value, for when the variable may change before the value is used
+static struct ir_operand snapshot(struct ir_lower *L, struct ir_operand o)
+{
+    if(o.kind != IR_VREG || !L->isvariable[o.value])
+        return o;
+    return unary(L, IR_MOV, o);
+}
+
+static bool has_side_effects(struct ast_node *n)
+{
+    if(!n)
+        return false;
+    switch(n->type)
+    {
+    case AST_ASSIGNMENT_EXPR:
+        return true;
+    case AST_UNARY_EXPR:
+        if(n->unary_expr_data.operator == TK_PLUS_PLUS || n->unary_expr_data.operator == TK_MINUS_MINUS)
+            return true;
+        return has_side_effects(n->unary_expr_data.argument);
+    case AST_BIN_EXPR:
+        return has_side_effects(n->bin_expr_data.lhs) || has_side_effects(n->bin_expr_data.rhs);
+    case AST_TERNARY_EXPR:
+        return has_side_effects(n->ternary_expr_data.condition) || has_side_effects(n->ternary_expr_data.consequent) ||
+               has_side_effects(n->ternary_expr_data.alternative);
+    case AST_MEMBER_EXPR:
+        return has_side_effects(n->member_expr_data.object) || has_side_effects(n->member_expr_data.property);
+    case AST_CAST:
+        return has_side_effects(n->cast_data.expr);
+    case AST_FUNCTION_CALL_EXPR:
+        //calls can't change variables that live in virtual registers, only their arguments can
+        for(int i = 0; i < n->call_expr_data.numargs; ++i)
+            if(has_side_effects(n->call_expr_data.arguments[i]))
+                return true;
+        return false;
+    case AST_SEQ_EXPR:
+        for(int i = 0; i < n->seq_expr_data.numexpr; ++i)
+            if(has_side_effects(n->seq_expr_data.expr[i]))
+                return true;
+        return false;
+    }
+    return false;
+}
+
+//variables that can be kept in a virtual register
+static bool register_type(struct ast_node *type)
+{
+    if(type->type == AST_POINTER_DATA_TYPE)
+        return true;
+    if(type->type != AST_PRIMITIVE)
+        return false;
+    return type->primitive_data.primitive_type == DT_INT || type->primitive_data.primitive_type == DT_LONG;
+}
+
+static int operand_size(struct ir_lower *L, struct ast_node *n, int ptr)
+{
+    if(!n->sema.resolved)
+    {
+        unsupported(L, n, "unknown operand size of");
+        return 4;
+    }
+    int sz = n->sema.operand_size[ptr ? 1 : 0];
+    if(sz != 1 && sz != 2 && sz != 4)
+    {
+        unsupported(L, n, "unhandled operand size of");
+        return 4;
+    }
+    return sz;
+}
+
+static struct ir_variable *variable(struct ir_lower *L, struct ast_node *id)
+{
+    struct ir_variable *var = hash_map_find(L->variables, id->identifier_data.name);
+    if(!var)
+        unsupported(L, id, "unknown variable");
+    return var;
+}
+
+static void declare_variable(struct ir_lower *L, struct ast_node *decl, int param)
+{
+    struct ast_node *type = decl->variable_decl_data.data_type;
+    struct ir_variable var = { .vreg = -1, .slot = -1, .data_type = type };
+    if(param != -1 && type->type != AST_PRIMITIVE && type->type != AST_POINTER_DATA_TYPE)
+    {
+        unsupported(L, decl, "parameter passed by reference");
+        return;
+    }
+    if(param != -1)
+        var.slot = new_slot(L->fn, 4, param);
+    if(!decl->sema.address_taken && register_type(type))
+    {
+        var.vreg = new_vreg(L, 1);
+        //parameters are copied out of their slot on entry
+        if(param != -1)
+        {
+            struct ir_instr *in = emit(L, IR_LOAD);
+            in->dst = var.vreg;
+            in->a = ir_slot(var.slot);
+            in->size = 4;
+        }
+    } else if(param == -1)
+    {
+        int sz = sema_type_size(type);
+        if(sz <= 0)
+        {
+            unsupported(L, decl, "unknown size of");
+            return;
+        }
+        var.slot = new_slot(L->fn, sz, -1);
+    }
+    hash_map_insert(L->variables, decl->variable_decl_data.id->identifier_data.name, var);
+}
+
+static struct ir_operand lower_rvalue(struct ir_lower *L, struct ast_node *n);
+static void lower_effect(struct ir_lower *L, struct ast_node *n);
+static void lower_statement(struct ir_lower *L, struct ast_node *n);
+
+//address of a[i], the index is scaled by the size of the element like the code generator does
+static struct ir_operand element_address(struct ir_lower *L, struct ast_node *n)
+{
+    struct ast_node *object = n->member_expr_data.object;
+    struct ast_node *property = n->member_expr_data.property;
+    struct ast_node *dn = object->type == AST_IDENTIFIER ? object->sema.data_type : NULL;
+    if(!dn || (dn->type != AST_POINTER_DATA_TYPE && dn->type != AST_ARRAY_DATA_TYPE))
+    {
+        unsupported(L, n, "unhandled object of");
+        return ir_imm(0);
+    }
+    struct ir_operand base = lower_rvalue(L, object);
+    if(has_side_effects(property))
+        base = snapshot(L, base);
+    struct ir_operand index = lower_rvalue(L, property);
+    int os = operand_size(L, object, 0);
+    if(os != 1)
+        index = binary(L, IR_MUL, index, ir_imm(os));
+    return binary(L, IR_ADD, base, index);
+}
+
+static struct ir_operand field_address(struct ir_lower *L, struct ast_node *n)
+{
+    struct ast_node *object = n->member_expr_data.object;
+    struct ast_node *dn = object->type == AST_IDENTIFIER ? object->sema.data_type : NULL;
+    if(!dn || !n->sema.field)
+    {
+        unsupported(L, n, "unresolved");
+        return ir_imm(0);
+    }
+    struct ir_operand base;
+    if(dn->type == AST_POINTER_DATA_TYPE)
+        base = lower_rvalue(L, object);
+    else
+    {
+        struct ir_variable *var = variable(L, object);
+        if(!var || var->slot == -1)
+            return ir_imm(0);
+        base = ir_slot(var->slot);
+    }
+    if(!n->sema.field_offset)
+        return base;
+    return binary(L, IR_ADD, base, ir_imm(n->sema.field_offset));
+}
+
+static int lower_lvalue(struct ir_lower *L, struct ast_node *n, struct ir_lvalue *lv)
+{
+    lv->vreg = -1;
+    lv->node = n;
+    switch(n->type)
+    {
+    case AST_IDENTIFIER:
+    {
+        struct ir_variable *var = variable(L, n);
+        if(!var)
+            return 1;
+        if(var->vreg != -1)
+        {
+            lv->vreg = var->vreg;
+            return 0;
+        }
+        lv->addr = ir_slot(var->slot);
+    } break;
+    case AST_UNARY_EXPR:
+        if(n->unary_expr_data.operator != '*')
+        {
+            unsupported(L, n, "can't assign to");
+            return 1;
+        }
+        lv->addr = lower_rvalue(L, n->unary_expr_data.argument);
+        break;
+    case AST_MEMBER_EXPR:
+        lv->addr = element_address(L, n);
+        break;
+    case AST_STRUCT_MEMBER_EXPR:
+        lv->addr = field_address(L, n);
+        break;
+    case AST_CAST:
+        if(lower_lvalue(L, n->cast_data.expr, lv))
+            return 1;
+        if(lv->vreg != -1)
+        {
+            unsupported(L, n, "register variable as");
+            return 1;
+        }
+        lv->node = n;
+        break;
+    default:
+        unsupported(L, n, "can't assign to");
+        return 1;
+    }
+    return L->error;
+}
+
+static struct ir_operand read_lvalue(struct ir_lower *L, struct ir_lvalue *lv)
+{
+    if(lv->vreg != -1)
+        return ir_vreg(lv->vreg);
+    return load(L, lv->addr, operand_size(L, lv->node, 1));
+}
+
+static struct ir_operand write_lvalue(struct ir_lower *L, struct ir_lvalue *lv, struct ir_operand value)
+{
+    if(lv->vreg == -1)
+    {
+        store(L, lv->addr, value, operand_size(L, lv->node, 1));
+        return value;
+    }
+    //a temporary that was just computed can be computed into the variable instead of copied
+    struct ir_block *b = L->block;
+    struct ir_instr *last = b->numinstrs > 0 ? &b->instrs[b->numinstrs - 1] : NULL;
+    if(value.kind == IR_VREG && !L->isvariable[value.value] && last && last->dst == value.value)
+        last->dst = lv->vreg;
+    else
+    {
+        struct ir_instr *in = emit(L, IR_MOV);
+        in->dst = lv->vreg;
+        in->a = value;
+    }
+    return ir_vreg(lv->vreg);
+}
+
+static int binary_operator(int operator, bool is_unsigned)
+{
+    if(is_unsigned)
+    {
+        switch(operator)
+        {
+        case '/': return IR_UDIV;
+        case '%': return IR_UMOD;
+        case TK_RSHIFT: return IR_SHR;
+        case TK_DIVIDE_ASSIGN: return IR_UDIV;
+        case TK_MOD_ASSIGN: return IR_UMOD;
+        }
+    }
+    switch(operator)
+    {
+    case '+': return IR_ADD;
+    case '-': return IR_SUB;
+    case '*': return IR_MUL;
+    case '/': return IR_DIV;
+    case '%': return IR_MOD;
+    case '&': return IR_AND;
+    case '|': return IR_OR;
+    case '^': return IR_XOR;
+    case TK_LSHIFT: return IR_SHL;
+    case TK_RSHIFT: return IR_SAR;
+    case TK_EQUAL: return IR_EQ;
+    case TK_NOT_EQUAL: return IR_NE;
+    case '<': return IR_LT;
+    case TK_LEQUAL: return IR_LE;
+    case '>': return IR_GT;
+    case TK_GEQUAL: return IR_GE;
+    case TK_PLUS_ASSIGN: return IR_ADD;
+    case TK_MINUS_ASSIGN: return IR_SUB;
+    case TK_MULTIPLY_ASSIGN: return IR_MUL;
+    case TK_DIVIDE_ASSIGN: return IR_DIV;
+    case TK_MOD_ASSIGN: return IR_MOD;
+    case TK_AND_ASSIGN: return IR_AND;
+    case TK_OR_ASSIGN: return IR_OR;
+    case TK_XOR_ASSIGN: return IR_XOR;
+    }
+    return IR_NOP;
+}
+
+//the rhs is evaluated before the address of the lhs, same as the code generator
+static struct ir_operand lower_assignment(struct ir_lower *L, struct ast_node *n)
+{
+    int operator = n->assignment_expr_data.operator;
+    struct ir_operand value = lower_rvalue(L, n->assignment_expr_data.rhs);
+    struct ir_lvalue lv;
+    if(lower_lvalue(L, n->assignment_expr_data.lhs, &lv))
+        return value;
+    if(operator != '=')
+    {
+        int op = binary_operator(operator, n->sema.is_unsigned);
+        if(op == IR_NOP)
+        {
+            unsupported(L, n, "unhandled operator in");
+            return value;
+        }
+        value = binary(L, op, read_lvalue(L, &lv), value);
+    }
+    return write_lvalue(L, &lv, value);
+}
+
+static struct ir_operand lower_increment(struct ir_lower *L, struct ast_node *n, int prefix)
+{
+    struct ir_lvalue lv;
+    if(lower_lvalue(L, n->unary_expr_data.argument, &lv))
+        return ir_imm(0);
+    int op = n->unary_expr_data.operator == TK_PLUS_PLUS ? IR_ADD : IR_SUB;
+    struct ir_operand old = read_lvalue(L, &lv);
+    if(!prefix)
+        old = snapshot(L, old);
+    struct ir_operand value = write_lvalue(L, &lv, binary(L, op, old, ir_imm(1)));
+    return prefix ? value : old;
+}
+
+static struct ir_operand lower_unary(struct ir_lower *L, struct ast_node *n)
+{
+    struct ast_node *arg = n->unary_expr_data.argument;
+    switch(n->unary_expr_data.operator)
+    {
+    case '*':
+        //*p++ loads through the old pointer, the pointer is incremented by one
+        if(arg->type == AST_UNARY_EXPR && arg->unary_expr_data.operator == TK_PLUS_PLUS && !arg->unary_expr_data.prefix)
+        {
+            struct ir_operand ptr = lower_increment(L, arg, 0);
+            return load(L, ptr, operand_size(L, arg->unary_expr_data.argument, 0));
+        }
+        return load(L, lower_rvalue(L, arg), operand_size(L, arg, 0));
+    case TK_PLUS_PLUS:
+    case TK_MINUS_MINUS:
+        return lower_increment(L, n, n->unary_expr_data.prefix);
+    case '&':
+    {
+        struct ir_lvalue lv;
+        if(lower_lvalue(L, arg, &lv))
+            return ir_imm(0);
+        if(lv.vreg != -1)
+        {
+            unsupported(L, n, "address of register variable in");
+            return ir_imm(0);
+        }
+        return lv.addr;
+    }
+    case '-':
+        return unary(L, IR_NEG, lower_rvalue(L, arg));
+    case '~':
+        return unary(L, IR_NOT, lower_rvalue(L, arg));
+    case '!':
+        return unary(L, IR_LNOT, lower_rvalue(L, arg));
+    case '+':
+        return lower_rvalue(L, arg);
+    }
+    unsupported(L, n, "unhandled operator in");
+    return ir_imm(0);
+}
+
+static struct ir_operand lower_call(struct ir_lower *L, struct ast_node *n)
+{
+    struct ast_node *callee = n->call_expr_data.callee;
+    if(callee->type != AST_IDENTIFIER)
+    {
+        unsupported(L, n, "unhandled callee in");
+        return ir_imm(0);
+    }
+    //arguments are pushed last to first
+    for(int i = n->call_expr_data.numargs - 1; i >= 0; --i)
+    {
+        struct ir_operand value = lower_rvalue(L, n->call_expr_data.arguments[i]);
+        emit(L, IR_ARG)->a = value;
+    }
+    struct ir_instr *in = emit(L, IR_CALL);
+    in->dst = new_vreg(L, 0);
+    in->str = callee->identifier_data.name;
+    in->imm = n->call_expr_data.numargs;
+    return ir_vreg(in->dst);
+}
+
+static struct ir_operand lower_ternary(struct ir_lower *L, struct ast_node *n)
+{
+    struct ir_block *t = new_block(L->fn);
+    struct ir_block *f = new_block(L->fn);
+    struct ir_block *join = new_block(L->fn);
+    int result = new_vreg(L, 0);
+    branch(L, lower_rvalue(L, n->ternary_expr_data.condition), t, f);
+    place_block(L, t);
+    struct ir_operand value = lower_rvalue(L, n->ternary_expr_data.consequent);
+    struct ir_instr *in = emit(L, IR_MOV);
+    in->a = value;
+    in->dst = result;
+    jump(L, join);
+    place_block(L, f);
+    value = lower_rvalue(L, n->ternary_expr_data.alternative);
+    in = emit(L, IR_MOV);
+    in->a = value;
+    in->dst = result;
+    jump(L, join);
+    place_block(L, join);
+    return ir_vreg(result);
+}
+
+static struct ir_operand lower_rvalue(struct ir_lower *L, struct ast_node *n)
+{
+    if(L->error)
+        return ir_imm(0);
+    switch(n->type)
+    {
+    case AST_LITERAL:
+        if(n->literal_data.type == LITERAL_INTEGER)
+            return ir_imm(n->literal_data.integer);
+        if(n->literal_data.type == LITERAL_STRING)
+        {
+            struct ir_instr *in = emit(L, IR_STRING);
+            in->dst = new_vreg(L, 0);
+            in->str = n->literal_data.string;
+            return ir_vreg(in->dst);
+        }
+        break;
+
+    case AST_IDENTIFIER:
+    {
+        struct ir_variable *var = variable(L, n);
+        if(!var)
+            return ir_imm(0);
+        if(var->vreg != -1)
+            return ir_vreg(var->vreg);
+        if(var->data_type->type == AST_ARRAY_DATA_TYPE)
+            return ir_slot(var->slot);
+        if(var->data_type->type == AST_STRUCT_DATA_TYPE)
+            break;
+        return load(L, ir_slot(var->slot), operand_size(L, n, 1));
+    }
+
+    case AST_BIN_EXPR:
+    {
+        int op = binary_operator(n->bin_expr_data.operator, n->sema.is_unsigned);
+        if(op == IR_NOP)
+            break;
+        struct ir_operand a = lower_rvalue(L, n->bin_expr_data.lhs);
+        if(has_side_effects(n->bin_expr_data.rhs))
+            a = snapshot(L, a);
+        struct ir_operand b = lower_rvalue(L, n->bin_expr_data.rhs);
+        return binary(L, op, a, b);
+    }
+
+    case AST_TERNARY_EXPR:
+        return lower_ternary(L, n);
+
+    case AST_ASSIGNMENT_EXPR:
+        return lower_assignment(L, n);
+
+    case AST_SIZEOF:
+    {
+        struct ast_node *subject = n->sizeof_data.subject;
+        if(subject->type == AST_IDENTIFIER)
+            subject = subject->sema.data_type;
+        int sz = subject ? sema_type_size(subject) : -1;
+        if(sz <= 0)
+            break;
+        return ir_imm(sz);
+    }
+
+    case AST_STRUCT_MEMBER_EXPR:
+    {
+        struct ir_operand addr = field_address(L, n);
+        if(L->error)
+            return addr;
+        struct ast_node *type = n->sema.field->variable_decl_data.data_type;
+        if(type->type == AST_ARRAY_DATA_TYPE)
+            return addr;
+        if(type->type == AST_STRUCT_DATA_TYPE)
+            break;
+        return load(L, addr, operand_size(L, n, 1));
+    }
+
+    case AST_MEMBER_EXPR:
+    {
+        struct ir_operand addr = element_address(L, n);
+        return load(L, addr, operand_size(L, n, 0));
+    }
+
+    case AST_UNARY_EXPR:
+        return lower_unary(L, n);
+
+    case AST_FUNCTION_CALL_EXPR:
+        return lower_call(L, n);
+
+    case AST_SEQ_EXPR:
+    {
+        //the value of the first expression, va_arg depends on it
+        struct ir_operand first = snapshot(L, lower_rvalue(L, n->seq_expr_data.expr[0]));
+        for(int i = 1; i < n->seq_expr_data.numexpr; ++i)
+            lower_effect(L, n->seq_expr_data.expr[i]);
+        return first;
+    }
+
+    case AST_CAST:
+    {
+        struct ir_operand value = lower_rvalue(L, n->cast_data.expr);
+        struct ast_node *type = n->cast_data.type;
+        if(type->type == AST_DATA_TYPE)
+            type = type->data_type_data.data_type;
+        if(type->type == AST_PRIMITIVE)
+        {
+            int sz = sema_type_size(type);
+            if(sz == 1)
+                return binary(L, IR_AND, value, ir_imm(0xff));
+            if(sz == 2)
+                return binary(L, IR_AND, value, ir_imm(0xffff));
+        }
+        return value;
+    }
+    }
+    unsupported(L, n, "unhandled");
+    return ir_imm(0);
+}
+
+//expression whose value isn't used
+static void lower_effect(struct ir_lower *L, struct ast_node *n)
+{
+    if(n->type == AST_UNARY_EXPR && (n->unary_expr_data.operator == TK_PLUS_PLUS || n->unary_expr_data.operator == TK_MINUS_MINUS))
+        lower_increment(L, n, 1);
+    else if(n->type == AST_SEQ_EXPR)
+    {
+        for(int i = 0; i < n->seq_expr_data.numexpr; ++i)
+            lower_effect(L, n->seq_expr_data.expr[i]);
+    } else
+        lower_rvalue(L, n);
+}
+
+static void enter_loop(struct ir_lower *L, struct ir_block *exit)
+{
+    if(L->numloops == COUNT_OF(L->breaks))
+    {
+        L->error = 1;
+        return;
+    }
+    L->breaks[L->numloops++] = exit->id;
+}
+
+static void lower_statement(struct ir_lower *L, struct ast_node *n)
+{
+    if(!n || L->error)
+        return;
+    switch(n->type)
+    {
+    case AST_BLOCK_STMT:
+        linked_list_reversed_foreach(n->block_stmt_data.body, struct ast_node**, it,
+        {
+            lower_statement(L, *it);
+        });
+        break;
+
+    case AST_VARIABLE_DECL:
+    {
+        //the variable exists while it's initializer is evaluated, same as the code generator
+        declare_variable(L, n, -1);
+        if(n->variable_decl_data.initializer_value && !L->error)
+        {
+            struct ir_operand value = lower_rvalue(L, n->variable_decl_data.initializer_value);
+            struct ir_lvalue lv;
+            if(!lower_lvalue(L, n->variable_decl_data.id, &lv))
+                write_lvalue(L, &lv, value);
+        }
+    } break;
+
+    case AST_IF_STMT:
+    {
+        struct ir_block *t = new_block(L->fn);
+        struct ir_block *f = n->if_stmt_data.alternative ? new_block(L->fn) : NULL;
+        struct ir_block *join = new_block(L->fn);
+        branch(L, lower_rvalue(L, n->if_stmt_data.test), t, f ? f : join);
+        place_block(L, t);
+        lower_statement(L, n->if_stmt_data.consequent);
+        jump(L, join);
+        if(f)
+        {
+            place_block(L, f);
+            lower_statement(L, n->if_stmt_data.alternative);
+            jump(L, join);
+        }
+        place_block(L, join);
+    } break;
+
+    case AST_WHILE_STMT:
+    {
+        struct ir_block *header = new_block(L->fn);
+        struct ir_block *body = new_block(L->fn);
+        struct ir_block *exit = new_block(L->fn);
+        place_block(L, header);
+        branch(L, lower_rvalue(L, n->while_stmt_data.test), body, exit);
+        place_block(L, body);
+        enter_loop(L, exit);
+        lower_statement(L, n->while_stmt_data.body);
+        --L->numloops;
+        jump(L, header);
+        place_block(L, exit);
+    } break;
+
+    case AST_DO_WHILE_STMT:
+    {
+        struct ir_block *body = new_block(L->fn);
+        struct ir_block *exit = new_block(L->fn);
+        place_block(L, body);
+        enter_loop(L, exit);
+        lower_statement(L, n->do_while_stmt_data.body);
+        --L->numloops;
+        branch(L, lower_rvalue(L, n->do_while_stmt_data.test), body, exit);
+        place_block(L, exit);
+    } break;
+
+    case AST_FOR_STMT:
+    {
+        lower_statement(L, n->for_stmt_data.init);
+        struct ir_block *header = new_block(L->fn);
+        struct ir_block *body = new_block(L->fn);
+        struct ir_block *exit = new_block(L->fn);
+        place_block(L, header);
+        if(n->for_stmt_data.test)
+            branch(L, lower_rvalue(L, n->for_stmt_data.test), body, exit);
+        place_block(L, body);
+        enter_loop(L, exit);
+        lower_statement(L, n->for_stmt_data.body);
+        --L->numloops;
+        if(n->for_stmt_data.update)
+            lower_effect(L, n->for_stmt_data.update);
+        jump(L, header);
+        place_block(L, exit);
+    } break;
+
+    case AST_RETURN_STMT:
+    {
+        struct ir_operand value = { .kind = IR_NONE };
+        if(n->return_stmt_data.argument)
+            value = lower_rvalue(L, n->return_stmt_data.argument);
+        emit(L, IR_RET)->a = value;
+    } break;
+
+    case AST_BREAK_STMT:
+        if(!L->numloops)
+        {
+            unsupported(L, n, "break outside of a loop");
+            break;
+        }
+        emit(L, IR_JMP)->target[0] = L->breaks[L->numloops - 1];
+        break;
+
+    case AST_EXPR_STMT:
+        lower_effect(L, n->expr_stmt_data.expr);
+        break;
+
+    case AST_SEQ_EXPR:
+        //int a, b; is a sequence of declarations
+        for(int i = 0; i < n->seq_expr_data.numexpr; ++i)
+            lower_statement(L, n->seq_expr_data.expr[i]);
+        break;
+
+    case AST_EMPTY:
+    case AST_EXIT:
+        break;
+
+    case AST_EMIT:
+    case AST_STRUCT_DECL:
+        unsupported(L, n, "unhandled");
+        break;
+
+    default:
+        lower_effect(L, n);
+        break;
+    }
+}
+
+static void free_block(struct ir_block *b)
+{
+    free(b->instrs);
+    free(b->preds);
+    free(b);
+}
+
+//puts the blocks in the order given, the rest is removed and jumps are renumbered
+static void reorder_blocks(struct ir_function *fn, int *order, int numorder)
+{
+    int *remap = malloc(fn->numblocks * sizeof(int));
+    for(int i = 0; i < fn->numblocks; ++i)
+        remap[i] = -1;
+    for(int i = 0; i < numorder; ++i)
+        remap[order[i]] = i;
+    struct ir_block **blocks = malloc((numorder ? numorder : 1) * sizeof(blocks[0]));
+    for(int i = 0; i < fn->numblocks; ++i)
+    {
+        if(remap[i] == -1)
+            free_block(fn->blocks[i]);
+        else
+            blocks[remap[i]] = fn->blocks[i];
+    }
+    for(int i = 0; i < numorder; ++i)
+    {
+        struct ir_block *b = blocks[i];
+        b->id = i;
+        for(int j = 0; j < b->numinstrs; ++j)
+        {
+            struct ir_instr *in = &b->instrs[j];
+            if(in->op == IR_JMP || in->op == IR_BR)
+                in->target[0] = remap[in->target[0]];
+            if(in->op == IR_BR)
+                in->target[1] = remap[in->target[1]];
+        }
+    }
+    free(fn->blocks);
+    free(remap);
+    fn->blocks = blocks;
+    fn->numblocks = fn->maxblocks = numorder;
+}
+
+static void add_edge(struct ir_function *fn, struct ir_block *from, int to)
+{
+    from->succ[from->numsucc++] = to;
+    struct ir_block *b = fn->blocks[to];
+    b->preds = realloc(b->preds, (b->numpreds + 1) * sizeof(int));
+    b->preds[b->numpreds++] = from->id;
+}
+
+//fills in the successors and predecessors of every block and removes the ones that can't be reached
+void ir_build_cfg(struct ir_function *fn)
+{
+    char *reachable = calloc(fn->numblocks, 1);
+    int *stack = malloc(fn->numblocks * sizeof(int));
+    int *order = malloc(fn->numblocks * sizeof(int));
+    int sp = 0, numorder = 0;
+    if(fn->numblocks > 0)
+    {
+        reachable[0] = 1;
+        stack[sp++] = 0;
+    }
+    while(sp > 0)
+    {
+        struct ir_block *b = fn->blocks[stack[--sp]];
+        struct ir_instr *last = &b->instrs[b->numinstrs - 1];
+        int n = last->op == IR_BR ? 2 : last->op == IR_JMP ? 1 : 0;
+        for(int i = 0; i < n; ++i)
+        {
+            if(!reachable[last->target[i]])
+            {
+                reachable[last->target[i]] = 1;
+                stack[sp++] = last->target[i];
+            }
+        }
+    }
+    //keep the layout, just leave out what's unreachable
+    for(int i = 0; i < fn->numblocks; ++i)
+        if(reachable[i])
+            order[numorder++] = i;
+    reorder_blocks(fn, order, numorder);
+    free(reachable);
+    free(stack);
+    free(order);
+
+    for(int i = 0; i < fn->numblocks; ++i)
+    {
+        fn->blocks[i]->numsucc = 0;
+        fn->blocks[i]->numpreds = 0;
+    }
+    for(int i = 0; i < fn->numblocks; ++i)
+    {
+        struct ir_block *b = fn->blocks[i];
+        struct ir_instr *last = &b->instrs[b->numinstrs - 1];
+        if(last->op == IR_JMP)
+            add_edge(fn, b, last->target[0]);
+        else if(last->op == IR_BR)
+        {
+            add_edge(fn, b, last->target[0]);
+            if(last->target[1] != last->target[0])
+                add_edge(fn, b, last->target[1]);
+        }
+    }
+}
+
+struct ir_function *ir_lower_function(struct ast_node *decl)
+{
+    struct ir_function *fn = calloc(1, sizeof(struct ir_function));
+    fn->name = decl->func_decl_data.id->identifier_data.name;
+    fn->decl = decl;
+    struct ir_lower L = {
+        .fn = fn,
+        .variables = hash_map_create(struct ir_variable)
+    };
+    place_block(&L, new_block(fn));
+    for(int i = 0; i < decl->func_decl_data.numparms && !L.error; ++i)
+        declare_variable(&L, decl->func_decl_data.parameters[i], i);
+    lower_statement(&L, decl->func_decl_data.body);
+    emit(&L, IR_RET);
+
+    reorder_blocks(fn, L.order, L.numorder);
+    free(L.order);
+    free(L.isvariable);
+    if(L.error)
+    {
+        ir_free_function(fn);
+        return NULL;
+    }
+    ir_build_cfg(fn);
+    return fn;
+}
+
+void ir_free_function(struct ir_function *fn)
+{
+    for(int i = 0; i < fn->numblocks; ++i)
+        free_block(fn->blocks[i]);
+    free(fn->blocks);
+    free(fn->slots);
+    free(fn);
+}
+
+static void print_operand(struct ir_operand o)
+{
+    switch(o.kind)
+    {
+    case IR_VREG:
+        printf("v%d", o.value);
+        break;
+    case IR_IMM:
+        printf("%d", o.value);
+        break;
+    case IR_SLOT:
+        printf("&s%d", o.value);
+        break;
+    }
+}
+
+void ir_print_function(struct ir_function *fn)
+{
+    printf("function %s (%d virtual registers)\n", fn->name, fn->numvregs);
+    for(int i = 0; i < fn->numslots; ++i)
+    {
+        if(fn->slots[i].param != -1)
+            printf("  s%d: parameter %d\n", i, fn->slots[i].param);
+        else
+            printf("  s%d: %d bytes\n", i, fn->slots[i].size);
+    }
+    for(int i = 0; i < fn->numblocks; ++i)
+    {
+        struct ir_block *b = fn->blocks[i];
+        printf("bb%d:", b->id);
+        if(b->numpreds)
+        {
+            printf(" ; preds");
+            for(int j = 0; j < b->numpreds; ++j)
+                printf(" bb%d", b->preds[j]);
+        }
+        printf("\n");
+        for(int j = 0; j < b->numinstrs; ++j)
+        {
+            struct ir_instr *in = &b->instrs[j];
+            printf("    ");
+            if(in->dst != -1)
+                printf("v%d = ", in->dst);
+            printf("%s", ir_op_names[in->op]);
+            if(in->op == IR_LOAD || in->op == IR_STORE)
+                printf(".%d", in->size);
+            if(in->op == IR_CALL)
+                printf(" %s, %d", in->str, in->imm);
+            if(in->op == IR_STRING)
+                printf(" \"%s\"", in->str);
+            if(in->a.kind != IR_NONE)
+            {
+                printf(" ");
+                print_operand(in->a);
+            }
+            if(in->b.kind != IR_NONE)
+            {
+                printf(", ");
+                print_operand(in->b);
+            }
+            if(in->op == IR_JMP)
+                printf(" bb%d", in->target[0]);
+            if(in->op == IR_BR)
+                printf(", bb%d, bb%d", in->target[0], in->target[1]);
+            printf("\n");
+        }
+    }
+}
+
+#define BITS_WORDS(n) (((n) + 31) / 32)
+#define BIT_TEST(s, i) ((s)[(i) / 32] & (1u << ((i) % 32)))
+#define BIT_SET(s, i) ((s)[(i) / 32] |= (1u << ((i) % 32)))
+
+//virtual registers an instruction reads
+static int instr_uses(struct ir_instr *in, int *uses)
+{
+    int n = 0;
+    if(in->a.kind == IR_VREG)
+        uses[n++] = in->a.value;
+    if(in->b.kind == IR_VREG)
+        uses[n++] = in->b.value;
+    return n;
+}
+
+//result of op on constants with the wraparound of 32 bit ints, false if it's undefined or traps at runtime
+static bool evaluate(int op, int a, int b, int *result)
+{
+    unsigned int ua = a, ub = b;
+    switch(op)
+    {
+    case IR_MOV: *result = a; break;
+    case IR_ADD: *result = ua + ub; break;
+    case IR_SUB: *result = ua - ub; break;
+    case IR_MUL: *result = ua * ub; break;
+    case IR_DIV:
+    case IR_MOD:
+        if(b == 0 || (a == INT_MIN && b == -1))
+            return false;
+        *result = op == IR_DIV ? a / b : a % b;
+        break;
+    case IR_UDIV:
+    case IR_UMOD:
+        if(b == 0)
+            return false;
+        *result = op == IR_UDIV ? ua / ub : ua % ub;
+        break;
+    case IR_AND: *result = a & b; break;
+    case IR_OR: *result = a | b; break;
+    case IR_XOR: *result = a ^ b; break;
+    case IR_SHL: *result = ua << (b & 31); break;
+    case IR_SAR: *result = a >> (b & 31); break;
+    case IR_SHR: *result = ua >> (b & 31); break;
+    case IR_EQ: *result = a == b; break;
+    case IR_NE: *result = a != b; break;
+    case IR_LT: *result = a < b; break;
+    case IR_LE: *result = a <= b; break;
+    case IR_GT: *result = a > b; break;
+    case IR_GE: *result = a >= b; break;
+    case IR_NEG: *result = -ua; break;
+    case IR_NOT: *result = ~a; break;
+    case IR_LNOT: *result = !a; break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+//instructions that can be removed when nothing reads their result
+static bool is_pure(int op)
+{
+    return op != IR_NOP && op != IR_STORE && op != IR_ARG && op != IR_CALL && !ir_is_terminator(op);
+}
+
+static bool substitute_constant(struct ir_operand *o, struct ir_operand *constants)
+{
+    if(o->kind != IR_VREG || constants[o->value].kind != IR_IMM)
+        return false;
+    *o = constants[o->value];
+    return true;
+}
+
+//virtual registers that are only assigned once with a constant are replaced by it everywhere,
+//instructions on constants are evaluated and branches on a constant become jumps
+//what's left without a use is removed and the cfg is rebuilt, which drops the blocks that became unreachable
+void ir_fold_constants(struct ir_function *fn)
+{
+    int *defs = calloc(fn->numvregs ? fn->numvregs : 1, sizeof(int));
+    struct ir_operand *constants = calloc(fn->numvregs ? fn->numvregs : 1, sizeof(struct ir_operand));
+    for(int i = 0; i < fn->numblocks; ++i)
+        for(int j = 0; j < fn->blocks[i]->numinstrs; ++j)
+            if(fn->blocks[i]->instrs[j].dst != -1)
+                ++defs[fn->blocks[i]->instrs[j].dst];
+
+    //a use that comes before the definition only happens when the variable is read uninitialized
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(int i = 0; i < fn->numblocks; ++i)
+        {
+            struct ir_block *b = fn->blocks[i];
+            for(int j = 0; j < b->numinstrs; ++j)
+            {
+                struct ir_instr *in = &b->instrs[j];
+                int value;
+                changed |= substitute_constant(&in->a, constants);
+                changed |= substitute_constant(&in->b, constants);
+                if(in->op == IR_BR && (in->a.kind == IR_IMM || in->a.kind == IR_SLOT || in->target[0] == in->target[1]))
+                {
+                    //the address of a slot is never null
+                    if(in->a.kind != IR_VREG && !(in->a.kind == IR_SLOT || in->a.value))
+                        in->target[0] = in->target[1];
+                    in->op = IR_JMP;
+                    in->a.kind = IR_NONE;
+                    changed = true;
+                } else if(in->dst != -1 && in->a.kind == IR_IMM && (in->b.kind == IR_IMM || in->b.kind == IR_NONE) &&
+                          evaluate(in->op, in->a.value, in->b.value, &value))
+                {
+                    if(in->op != IR_MOV)
+                    {
+                        in->op = IR_MOV;
+                        in->a.value = value;
+                        in->b.kind = IR_NONE;
+                        changed = true;
+                    }
+                    if(defs[in->dst] == 1 && constants[in->dst].kind == IR_NONE)
+                    {
+                        constants[in->dst] = in->a;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+
+    int *uses = malloc((fn->numvregs ? fn->numvregs : 1) * sizeof(int));
+    changed = true;
+    while(changed)
+    {
+        changed = false;
+        memset(uses, 0, (fn->numvregs ? fn->numvregs : 1) * sizeof(int));
+        for(int i = 0; i < fn->numblocks; ++i)
+        {
+            for(int j = 0; j < fn->blocks[i]->numinstrs; ++j)
+            {
+                int u[2];
+                int n = instr_uses(&fn->blocks[i]->instrs[j], u);
+                for(int k = 0; k < n; ++k)
+                    ++uses[u[k]];
+            }
+        }
+        for(int i = 0; i < fn->numblocks; ++i)
+        {
+            struct ir_block *b = fn->blocks[i];
+            int n = 0;
+            for(int j = 0; j < b->numinstrs; ++j)
+            {
+                struct ir_instr *in = &b->instrs[j];
+                if(in->op == IR_NOP || (is_pure(in->op) && in->dst != -1 && !uses[in->dst]))
+                {
+                    changed = true;
+                    continue;
+                }
+                b->instrs[n++] = *in;
+            }
+            b->numinstrs = n;
+        }
+    }
+    free(uses);
+    free(defs);
+    free(constants);
+    ir_build_cfg(fn);
+}
+
+#define INLINE_MAX_DEPTH 4 //calls in inlined code are inlined too, up to this deep
+#define INLINE_CALL_COST 6 //call, add esp and the prologue and epilogue of the callee, on top of the arguments
+#define INLINE_MAX_ONCE 64 //functions that are called from one place
+#define INLINE_MAX_GROWTH 1024 //instructions a function can grow to by inlining
+
+static int function_size(struct ir_function *fn)
+{
+    int n = 0;
+    for(int i = 0; i < fn->numblocks; ++i)
+        for(int j = 0; j < fn->blocks[i]->numinstrs; ++j)
+            if(fn->blocks[i]->instrs[j].op != IR_NOP)
+                ++n;
+    return n;
+}
+
+static bool calls_function(struct ir_function *fn, const char *name)
+{
+    for(int i = 0; i < fn->numblocks; ++i)
+        for(int j = 0; j < fn->blocks[i]->numinstrs; ++j)
+            if(fn->blocks[i]->instrs[j].op == IR_CALL && !strcmp(fn->blocks[i]->instrs[j].str, name))
+                return true;
+    return false;
+}
+
+static bool worth_inlining(struct ir_function *caller, struct ir_function *callee, int numargs, int max_size)
+{
+    struct ast_node *decl = callee->decl;
+    if(decl->func_decl_data.inlining == INLINE_NEVER || decl->func_decl_data.variadic || decl->func_decl_data.numparms != numargs)
+        return false;
+    //recursion is left alone, the copy would have the same call in it again
+    if(!strcmp(caller->name, callee->name) || calls_function(callee, callee->name))
+        return false;
+    if(decl->func_decl_data.inlining == INLINE_ALWAYS)
+        return true;
+    int size = function_size(callee);
+    if(function_size(caller) + size > INLINE_MAX_GROWTH)
+        return false;
+    //no bigger than the call it replaces
+    if(size <= numargs + INLINE_CALL_COST)
+        return true;
+    //the function itself isn't generated when it's call is inlined, see the call graph in sema.c
+    if(decl->sema.calls == 1 && size <= INLINE_MAX_ONCE)
+        return true;
+    return size <= (decl->func_decl_data.inlining == INLINE_HINT ? max_size * 2 : max_size);
+}
+
+//the arguments of the call at index call of b, the first argument is pushed last. calls in the arguments have their
+//own arguments in between, false if they aren't all in this block
+static bool call_arguments(struct ir_block *b, int call, int numargs, int *args)
+{
+    int found = 0, pending = 0;
+    for(int i = call - 1; i >= 0 && found < numargs; --i)
+    {
+        struct ir_instr *in = &b->instrs[i];
+        if(in->op == IR_CALL)
+            pending += in->imm;
+        else if(in->op == IR_ARG)
+        {
+            if(pending > 0)
+                --pending;
+            else
+                args[found++] = i;
+        }
+    }
+    return found == numargs;
+}
+
+struct ir_inliner
+{
+    struct ir_function *fn;
+    int *next; //block that's laid out after it, -1 for the last one
+    int *depth; //how many calls deep the code in the block was inlined
+    const char **origin; //function the code in the block was inlined from, NULL for the caller's own code
+    int *site; //block of the call it was inlined for
+    unsigned char *visited; //blocks with the rest of a block whose calls were looked at already
+};
+
+static void inline_operand(struct ir_operand *o, int voff, int *slots)
+{
+    if(o->kind == IR_VREG)
+        o->value += voff;
+    else if(o->kind == IR_SLOT)
+        o->value = slots[o->value];
+}
+
+//replaces the call at index call of the block with a copy of the callee's blocks, the arguments are assigned to the
+//parameters and returns jump to a new block with the rest of the caller's block
+static void inline_call(struct ir_inliner *I, int block, int call, int *args, struct ir_function *callee)
+{
+    struct ir_function *fn = I->fn;
+    struct ir_block *b = fn->blocks[block];
+    int dst = b->instrs[call].dst;
+    int numargs = b->instrs[call].imm;
+
+    //the value of an argument that's a variable is copied, the variable could change before the parameter is read
+    int *defs = calloc(fn->numvregs + 1, sizeof(int));
+    for(int i = 0; i < fn->numblocks; ++i)
+        for(int j = 0; j < fn->blocks[i]->numinstrs; ++j)
+            if(fn->blocks[i]->instrs[j].dst != -1)
+                ++defs[fn->blocks[i]->instrs[j].dst];
+    struct ir_operand values[COUNT_OF(callee->decl->func_decl_data.parameters)];
+    for(int i = 0; i < numargs; ++i)
+    {
+        struct ir_instr *arg = &b->instrs[args[i]];
+        values[i] = arg->a;
+        arg->op = IR_NOP;
+        if(values[i].kind == IR_VREG && defs[values[i].value] != 1)
+        {
+            arg->op = IR_MOV;
+            arg->dst = fn->numvregs++;
+            values[i] = ir_vreg(arg->dst);
+        }
+    }
+    free(defs);
+
+    int boff = fn->numblocks;
+    for(int i = 0; i < callee->numblocks; ++i)
+        new_block(fn);
+    struct ir_block *rest = new_block(fn);
+    for(int j = call + 1; j < b->numinstrs; ++j)
+        *append(rest, IR_NOP) = b->instrs[j];
+    b->numinstrs = call;
+
+    //a parameter that's only copied into a variable on entry is assigned the argument instead,
+    //the others become locals the argument is stored to
+    int *uses = calloc(callee->numslots + 1, sizeof(int));
+    int *slots = malloc((callee->numslots + 1) * sizeof(int));
+    for(int i = 0; i < callee->numblocks; ++i)
+    {
+        for(int j = 0; j < callee->blocks[i]->numinstrs; ++j)
+        {
+            struct ir_instr *in = &callee->blocks[i]->instrs[j];
+            if(in->a.kind == IR_SLOT)
+                ++uses[in->a.value];
+            if(in->b.kind == IR_SLOT)
+                ++uses[in->b.value];
+        }
+    }
+    //the loads on entry, see declare_variable
+    struct ir_block *entry = callee->blocks[0];
+    for(int j = 0; j < entry->numinstrs; ++j)
+    {
+        struct ir_instr *in = &entry->instrs[j];
+        if(in->op == IR_LOAD && in->a.kind == IR_SLOT && callee->slots[in->a.value].param != -1 && in->size == 4 &&
+           uses[in->a.value] == 1)
+            uses[in->a.value] = 0;
+    }
+    for(int i = 0; i < callee->numslots; ++i)
+    {
+        slots[i] = -1;
+        if(!uses[i])
+            continue;
+        slots[i] = new_slot(fn, callee->slots[i].size, -1);
+        if(callee->slots[i].param != -1)
+        {
+            struct ir_instr *in = append(b, IR_STORE);
+            in->a = ir_slot(slots[i]);
+            in->b = values[callee->slots[i].param];
+            in->size = 4;
+        }
+    }
+    free(uses);
+    append(b, IR_JMP)->target[0] = boff;
+
+    int voff = fn->numvregs;
+    fn->numvregs += callee->numvregs;
+    for(int i = 0; i < callee->numblocks; ++i)
+    {
+        struct ir_block *to = fn->blocks[boff + i];
+        for(int j = 0; j < callee->blocks[i]->numinstrs; ++j)
+        {
+            struct ir_instr in = callee->blocks[i]->instrs[j];
+            if(in.op == IR_LOAD && in.a.kind == IR_SLOT && slots[in.a.value] == -1)
+            {
+                in.op = IR_MOV;
+                in.a = values[callee->slots[in.a.value].param];
+                in.dst += voff;
+                *append(to, IR_NOP) = in;
+                continue;
+            }
+            if(in.dst != -1)
+                in.dst += voff;
+            inline_operand(&in.a, voff, slots);
+            inline_operand(&in.b, voff, slots);
+            if(in.op == IR_JMP || in.op == IR_BR)
+            {
+                in.target[0] += boff;
+                in.target[1] += boff;
+            }
+            if(in.op != IR_RET)
+            {
+                *append(to, IR_NOP) = in;
+                continue;
+            }
+            if(dst != -1)
+            {
+                struct ir_instr *mov = append(to, IR_MOV);
+                mov->dst = dst;
+                mov->a = in.a.kind != IR_NONE ? in.a : ir_imm(0);
+            }
+            append(to, IR_JMP)->target[0] = rest->id;
+        }
+    }
+    free(slots);
+
+    //the copy is laid out between the block and the rest of it
+    I->next = realloc(I->next, fn->numblocks * sizeof(int));
+    I->depth = realloc(I->depth, fn->numblocks * sizeof(int));
+    I->visited = realloc(I->visited, fn->numblocks);
+    I->origin = realloc(I->origin, fn->numblocks * sizeof(I->origin[0]));
+    I->site = realloc(I->site, fn->numblocks * sizeof(int));
+    I->next[rest->id] = I->next[block];
+    I->depth[rest->id] = I->depth[block];
+    I->visited[rest->id] = 1;
+    I->origin[rest->id] = I->origin[block];
+    I->site[rest->id] = I->site[block];
+    I->next[block] = boff;
+    for(int i = 0; i < callee->numblocks; ++i)
+    {
+        I->next[boff + i] = i + 1 < callee->numblocks ? boff + i + 1 : rest->id;
+        I->depth[boff + i] = I->depth[block] + 1;
+        I->visited[boff + i] = 0;
+        I->origin[boff + i] = callee->name;
+        I->site[boff + i] = block;
+    }
+}
+
+//mutual recursion, whether the code in the block came from inlining the function into itself
+static bool inlined_from(struct ir_inliner *I, int block, const char *name)
+{
+    for(int b = block; b != -1 && I->origin[b]; b = I->site[b])
+        if(!strcmp(I->origin[b], name))
+            return true;
+    return false;
+}
+
+//calls to functions that are small, called from one place or marked always_inline are replaced by the body of the
+//function, max_size is how many instructions other functions can have. callee returns the ir of a function
+void ir_inline_calls(struct ir_function *fn, int max_size, ir_callee_fn_t callee, void *userptr)
+{
+    struct ir_inliner I = {
+        .fn = fn,
+        .next = malloc(fn->numblocks * sizeof(int)),
+        .depth = calloc(fn->numblocks, sizeof(int)),
+        .visited = calloc(fn->numblocks, 1),
+        .origin = calloc(fn->numblocks, sizeof(const char*)),
+        .site = malloc(fn->numblocks * sizeof(int))
+    };
+    for(int i = 0; i < fn->numblocks; ++i)
+    {
+        I.next[i] = i + 1 < fn->numblocks ? i + 1 : -1;
+        I.site[i] = -1;
+    }
+    bool inlined = false;
+    //the blocks of the copies are added to the end and looked at too
+    for(int i = 0; i < fn->numblocks; ++i)
+    {
+        if(I.visited[i] || I.depth[i] >= INLINE_MAX_DEPTH)
+            continue;
+        //the last call first, the calls in it's arguments stay in this block
+        for(int j = fn->blocks[i]->numinstrs - 1; j >= 0; --j)
+        {
+            struct ir_instr *in = &fn->blocks[i]->instrs[j];
+            int args[COUNT_OF(fn->decl->func_decl_data.parameters)];
+            if(in->op != IR_CALL || in->imm > COUNT_OF(args) || inlined_from(&I, i, in->str) ||
+               !call_arguments(fn->blocks[i], j, in->imm, args))
+                continue;
+            struct ir_function *g = callee(userptr, in->str);
+            if(!g)
+                continue;
+            if(worth_inlining(fn, g, in->imm, max_size))
+            {
+                if(opt_flags & OPT_VERBOSE)
+                    printf("ir: inlined '%s' into '%s'\n", g->name, fn->name);
+                inline_call(&I, i, j, args, g);
+                inlined = true;
+            }
+            ir_free_function(g);
+        }
+    }
+    if(inlined)
+    {
+        int *order = malloc(fn->numblocks * sizeof(int));
+        int numorder = 0;
+        for(int i = 0; i != -1; i = I.next[i])
+            order[numorder++] = i;
+        reorder_blocks(fn, order, numorder);
+        free(order);
+        ir_build_cfg(fn);
+    }
+    free(I.next);
+    free(I.depth);
+    free(I.visited);
+    free(I.origin);
+    free(I.site);
+}
+
+//the call at index call of b is returned right away, either it's result or nothing. the result can be copied and
+//the return be in another block, as it is after inlining
+bool ir_returns_call(struct ir_function *fn, struct ir_block *b, int call)
+{
+    int value = b->instrs[call].dst;
+    int jumps = 0;
+    for(int j = call + 1; j < b->numinstrs; ++j)
+    {
+        struct ir_instr *in = &b->instrs[j];
+        switch(in->op)
+        {
+        case IR_NOP:
+            break;
+        case IR_MOV:
+            if(in->a.kind != IR_VREG || in->a.value != value)
+                return false;
+            value = in->dst;
+            break;
+        case IR_JMP:
+            //an endless loop never gets to a return
+            if(++jumps > 4)
+                return false;
+            b = fn->blocks[in->target[0]];
+            j = -1;
+            break;
+        case IR_RET:
+            return in->a.kind == IR_NONE || (in->a.kind == IR_VREG && in->a.value == value);
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+//the address of a stack slot is used for something else than a load or store, it could end up anywhere
+bool ir_slot_address_taken(struct ir_function *fn)
+{
+    for(int i = 0; i < fn->numblocks; ++i)
+    {
+        for(int j = 0; j < fn->blocks[i]->numinstrs; ++j)
+        {
+            struct ir_instr *in = &fn->blocks[i]->instrs[j];
+            if(in->b.kind == IR_SLOT || (in->a.kind == IR_SLOT && in->op != IR_LOAD && in->op != IR_STORE))
+                return true;
+        }
+    }
+    return false;
+}
+
+static bool self_tail_call(struct ir_function *fn, struct ir_block *b, int call, int *args)
+{
+    struct ir_instr *in = &b->instrs[call];
+    return in->op == IR_CALL && !strcmp(in->str, fn->name) && in->imm == fn->decl->func_decl_data.numparms &&
+           ir_returns_call(fn, b, call) && call_arguments(b, call, in->imm, args);
+}
+
+//a function that returns what it returns for other arguments assigns them to it's parameters and jumps back to
+//after they're loaded, instead of calling itself. the locals are reused, so not when their address can be taken
+void ir_eliminate_tail_recursion(struct ir_function *fn)
+{
+    struct ast_node *decl = fn->decl;
+    int numparms = decl->func_decl_data.numparms;
+    int params[COUNT_OF(decl->func_decl_data.parameters)];
+    int args[COUNT_OF(decl->func_decl_data.parameters)];
+    if(fn->numblocks == 0 || decl->func_decl_data.variadic || ir_slot_address_taken(fn))
+        return;
+    int found = 0;
+    for(int i = 0; i < fn->numblocks && !found; ++i)
+        for(int j = 0; j < fn->blocks[i]->numinstrs && !found; ++j)
+            found = self_tail_call(fn, fn->blocks[i], j, args);
+    if(!found)
+        return;
+
+    //every parameter is loaded into it's variable at the start of the first block
+    struct ir_block *entry = fn->blocks[0];
+    int prologue = 0;
+    for(int i = 0; i < numparms; ++i)
+        params[i] = -1;
+    for(; prologue < entry->numinstrs; ++prologue)
+    {
+        struct ir_instr *in = &entry->instrs[prologue];
+        if(in->op != IR_LOAD || in->a.kind != IR_SLOT || fn->slots[in->a.value].param == -1)
+            break;
+        params[fn->slots[in->a.value].param] = in->dst;
+    }
+    for(int i = 0; i < numparms; ++i)
+        if(params[i] == -1)
+            return;
+
+    //the rest of the first block is the start of the loop
+    struct ir_block *loop = new_block(fn);
+    for(int j = prologue; j < entry->numinstrs; ++j)
+        *append(loop, IR_NOP) = entry->instrs[j];
+    entry->numinstrs = prologue;
+    append(entry, IR_JMP)->target[0] = loop->id;
+
+    int *defs = calloc(fn->numvregs + 1, sizeof(int));
+    for(int i = 0; i < fn->numblocks; ++i)
+        for(int j = 0; j < fn->blocks[i]->numinstrs; ++j)
+            if(fn->blocks[i]->instrs[j].dst != -1)
+                ++defs[fn->blocks[i]->instrs[j].dst];
+    for(int i = 1; i < fn->numblocks; ++i)
+    {
+        struct ir_block *b = fn->blocks[i];
+        for(int j = 0; j < b->numinstrs; ++j)
+        {
+            if(!self_tail_call(fn, b, j, args))
+                continue;
+            //arguments are copied when they're a variable that can change before the parameters are assigned,
+            //a parameter that's passed on and never changes stays as it is
+            struct ir_operand values[COUNT_OF(decl->func_decl_data.parameters)];
+            for(int k = 0; k < numparms; ++k)
+            {
+                struct ir_instr *arg = &b->instrs[args[k]];
+                values[k] = arg->a;
+                arg->op = IR_NOP;
+                if(values[k].kind != IR_VREG)
+                    continue;
+                if(values[k].value == params[k] && defs[params[k]] == 1)
+                {
+                    values[k].kind = IR_NONE;
+                    continue;
+                }
+                bool param = false;
+                for(int m = 0; m < numparms; ++m)
+                    param = param || params[m] == values[k].value;
+                if(param || defs[values[k].value] != 1)
+                {
+                    arg->op = IR_MOV;
+                    arg->dst = fn->numvregs++;
+                    values[k] = ir_vreg(arg->dst);
+                }
+            }
+            b->numinstrs = j;
+            for(int k = 0; k < numparms; ++k)
+            {
+                if(values[k].kind == IR_NONE)
+                    continue;
+                struct ir_instr *in = append(b, IR_MOV);
+                in->dst = params[k];
+                in->a = values[k];
+            }
+            append(b, IR_JMP)->target[0] = loop->id;
+            break;
+        }
+    }
+    free(defs);
+    if(opt_flags & OPT_VERBOSE)
+        printf("ir: turned the tail recursion in '%s' into a loop\n", fn->name);
+
+    //the loop goes right after the parameters are loaded
+    int *order = malloc(fn->numblocks * sizeof(int));
+    int numorder = 0;
+    order[numorder++] = 0;
+    order[numorder++] = loop->id;
+    for(int i = 1; i < loop->id; ++i)
+        order[numorder++] = i;
+    reorder_blocks(fn, order, numorder);
+    free(order);
+    ir_build_cfg(fn);
+}
+
+struct ir_interval
+{
+    int vreg;
+    int start, end;
+    int weight; //reads and writes, weighted by loop depth
+};
+
+static int compare_intervals(const void *a, const void *b)
+{
+    const struct ir_interval *x = a, *y = b;
+    if(x->start != y->start)
+        return x->start - y->start;
+    return x->vreg - y->vreg;
+}
+
+//linear scan over live ranges that cover every position a virtual register is live at
+//location[v] is the register v is assigned to or -1 - n for the n'th spill slot, returns the number of spill slots
+int ir_allocate_registers(struct ir_function *fn, int numregisters, int *location)
+{
+    int nv = fn->numvregs;
+    int words = BITS_WORDS(nv);
+    int nb = fn->numblocks;
+    unsigned *sets = calloc((size_t)nb * 4 * (words ? words : 1), sizeof(unsigned));
+#define SET(b, k) (sets + ((size_t)(b) * 4 + (k)) * words)
+#define USE(b) SET(b, 0)
+#define DEF(b) SET(b, 1)
+#define IN(b) SET(b, 2)
+#define OUT(b) SET(b, 3)
+
+    //uses before definitions and definitions of every block
+    for(int i = 0; i < nb; ++i)
+    {
+        struct ir_block *b = fn->blocks[i];
+        for(int j = 0; j < b->numinstrs; ++j)
+        {
+            int uses[2];
+            int n = instr_uses(&b->instrs[j], uses);
+            for(int k = 0; k < n; ++k)
+                if(!BIT_TEST(DEF(i), uses[k]))
+                    BIT_SET(USE(i), uses[k]);
+            if(b->instrs[j].dst != -1)
+                BIT_SET(DEF(i), b->instrs[j].dst);
+        }
+    }
+
+    //live in = use | (live out - def), live out = union of the successors live in
+    int changed = 1;
+    while(changed)
+    {
+        changed = 0;
+        for(int i = nb - 1; i >= 0; --i)
+        {
+            struct ir_block *b = fn->blocks[i];
+            for(int w = 0; w < words; ++w)
+            {
+                unsigned out = 0;
+                for(int s = 0; s < b->numsucc; ++s)
+                    out |= IN(b->succ[s])[w];
+                unsigned in = USE(i)[w] | (out & ~DEF(i)[w]);
+                if(out != OUT(i)[w] || in != IN(i)[w])
+                    changed = 1;
+                OUT(i)[w] = out;
+                IN(i)[w] = in;
+            }
+        }
+    }
+
+    //blocks between the target of a backward jump and the jump are in a loop, that's how the lowering lays them out
+    int *depth = calloc(nb ? nb : 1, sizeof(int));
+    for(int i = 0; i < nb; ++i)
+        for(int s = 0; s < fn->blocks[i]->numsucc; ++s)
+            for(int k = fn->blocks[i]->succ[s]; k <= i; ++k)
+                ++depth[k];
+
+    //uses are at even positions and definitions at odd ones, so a register can be reused by the result of the instruction that last reads it
+    struct ir_interval *intervals = malloc((nv ? nv : 1) * sizeof(struct ir_interval));
+    for(int v = 0; v < nv; ++v)
+    {
+        intervals[v].vreg = v;
+        intervals[v].start = INT_MAX;
+        intervals[v].end = -1;
+        intervals[v].weight = 0;
+    }
+#define EXTEND(v, p) do { if((p) < intervals[v].start) intervals[v].start = (p); if((p) > intervals[v].end) intervals[v].end = (p); } while(0)
+    int pos = 0;
+    for(int i = 0; i < nb; ++i)
+    {
+        struct ir_block *b = fn->blocks[i];
+        int first = pos;
+        int weight = 1 << (3 * (depth[i] < 5 ? depth[i] : 5));
+        for(int j = 0; j < b->numinstrs; ++j, pos += 2)
+        {
+            int uses[2];
+            int n = instr_uses(&b->instrs[j], uses);
+            for(int k = 0; k < n; ++k)
+            {
+                EXTEND(uses[k], pos);
+                intervals[uses[k]].weight += weight;
+            }
+            if(b->instrs[j].dst != -1)
+            {
+                EXTEND(b->instrs[j].dst, pos + 1);
+                intervals[b->instrs[j].dst].weight += weight;
+            }
+        }
+        for(int v = 0; v < nv; ++v)
+        {
+            if(BIT_TEST(IN(i), v))
+                EXTEND(v, first);
+            if(BIT_TEST(OUT(i), v))
+                EXTEND(v, pos - 1);
+        }
+    }
+#undef EXTEND
+    free(sets);
+    free(depth);
+#undef SET
+#undef USE
+#undef DEF
+#undef IN
+#undef OUT
+
+    int numintervals = 0;
+    for(int v = 0; v < nv; ++v)
+    {
+        location[v] = 0; //never used
+        if(intervals[v].end != -1)
+            intervals[numintervals++] = intervals[v];
+    }
+    qsort(intervals, numintervals, sizeof(intervals[0]), compare_intervals);
+
+    //active intervals sorted by end
+    struct ir_interval **active = malloc((numregisters + 1) * sizeof(active[0]));
+    int numactive = 0, numspills = 0;
+    unsigned freeregisters = (1u << numregisters) - 1;
+    for(int i = 0; i < numintervals; ++i)
+    {
+        struct ir_interval *it = &intervals[i];
+        int k = 0;
+        for(int j = 0; j < numactive; ++j)
+        {
+            if(active[j]->end < it->start)
+                freeregisters |= 1u << location[active[j]->vreg];
+            else
+                active[k++] = active[j];
+        }
+        numactive = k;
+
+        if(!freeregisters)
+        {
+            //spill whichever is used the least, of those the one that lives the longest
+            int spill = -1;
+            for(int j = 0; j < numactive; ++j)
+            {
+                if(active[j]->weight < it->weight || (active[j]->weight == it->weight && active[j]->end > it->end))
+                {
+                    if(spill == -1 || active[j]->weight < active[spill]->weight ||
+                       (active[j]->weight == active[spill]->weight && active[j]->end > active[spill]->end))
+                        spill = j;
+                }
+            }
+            if(spill == -1)
+            {
+                location[it->vreg] = -1 - numspills++;
+                continue;
+            }
+            location[it->vreg] = location[active[spill]->vreg];
+            location[active[spill]->vreg] = -1 - numspills++;
+            for(int j = spill; j + 1 < numactive; ++j)
+                active[j] = active[j + 1];
+            --numactive;
+        } else
+        {
+            int r = 0;
+            while(!(freeregisters & (1u << r)))
+                ++r;
+            freeregisters &= ~(1u << r);
+            location[it->vreg] = r;
+        }
+        k = numactive++;
+        while(k > 0 && active[k - 1]->end > it->end)
+        {
+            active[k] = active[k - 1];
+            --k;
+        }
+        active[k] = it;
+    }
+    free(active);
+    free(intervals);
+    return numspills;
+}
@@ -0,0 +1,139 @@
+#ifndef IR_H
+#define IR_H
+
+#include "ast.h"
+
+//linear three address code with virtual registers, grouped in basic blocks
+//functions are lowered from the ast in ir.c and turned into machine code by the backend in x86.c
+
+enum IR_OP
+{
+    IR_NOP,
+    IR_MOV, //dst = a
+    IR_STRING, //dst = address of string literal str
+    IR_LOAD, //dst = size bytes at address a, zero extended
+    IR_STORE, //size bytes at address a = b
+
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_MOD,
+    IR_UDIV,
+    IR_UMOD,
+    IR_AND,
+    IR_OR,
+    IR_XOR,
+    IR_SHL,
+    IR_SAR,
+    IR_SHR,
+    IR_EQ,
+    IR_NE,
+    IR_LT,
+    IR_LE,
+    IR_GT,
+    IR_GE,
+
+    IR_NEG,
+    IR_NOT,
+    IR_LNOT,
+
+    IR_ARG, //push a as argument for the next call, last argument first
+    IR_CALL, //dst = call str with imm arguments
+
+    //terminators, always the last instruction of a block
+    IR_JMP, //goto target[0]
+    IR_BR, //if a goto target[0] else goto target[1]
+    IR_RET, //return a, if there is one
+    IR_OP_MAX
+};
+
+enum IR_OPERAND_KIND
+{
+    IR_NONE,
+    IR_VREG,
+    IR_IMM,
+    IR_SLOT //address of a stack slot
+};
+
+struct ir_operand
+{
+    int kind;
+    int value;
+};
+
+struct ir_instr
+{
+    int op;
+    int dst; //virtual register or -1
+    struct ir_operand a, b;
+    int size; //bytes loaded or stored
+    int imm; //number of arguments of a call
+    const char *str;
+    int target[2];
+};
+
+struct ir_block
+{
+    int id;
+    struct ir_instr *instrs;
+    int numinstrs, maxinstrs;
+    int succ[2];
+    int numsucc;
+    int *preds;
+    int numpreds;
+};
+
+//memory for variables that can't live in a virtual register
+struct ir_slot
+{
+    int size;
+    int param; //index of the parameter or -1 for locals
+};
+
+struct ir_function
+{
+    const char *name;
+    struct ast_node *decl;
+    struct ir_block **blocks;
+    int numblocks, maxblocks;
+    int numvregs;
+    struct ir_slot *slots;
+    int numslots, maxslots;
+};
+
+static bool ir_is_terminator(int op)
+{
+    return op == IR_JMP || op == IR_BR || op == IR_RET;
+}
+
+static bool ir_is_commutative(int op)
+{
+    switch(op)
+    {
+    case IR_ADD:
+    case IR_MUL:
+    case IR_AND:
+    case IR_OR:
+    case IR_XOR:
+    case IR_EQ:
+    case IR_NE:
+        return true;
+    }
+    return false;
+}
+
+struct ir_function *ir_lower_function(struct ast_node *decl); //NULL if the function uses something that can't be lowered
+void ir_build_cfg(struct ir_function *fn);
+void ir_fold_constants(struct ir_function *fn);
+//returns the ir of the function called name if it's defined in the program or NULL, the inliner frees it
+typedef struct ir_function *(*ir_callee_fn_t)(void *userptr, const char *name);
+void ir_inline_calls(struct ir_function *fn, int max_size, ir_callee_fn_t callee, void *userptr);
+void ir_eliminate_tail_recursion(struct ir_function *fn);
+bool ir_returns_call(struct ir_function *fn, struct ir_block *b, int call);
+bool ir_slot_address_taken(struct ir_function *fn);
+int ir_allocate_registers(struct ir_function *fn, int numregisters, int *location);
+void ir_print_function(struct ir_function *fn);
+void ir_free_function(struct ir_function *fn);
+
+#endif
@@ -15,10 +15,23 @@
 
 #include "rhd/hash_string.h"
 
-int generate_ast(struct token *tokens, int num_tokens, struct linked_list **ll/*for freeing the whole tree*/, struct ast_node **root, bool);
+int generate_ast(struct token *tokens, int num_tokens, struct linked_list **ll/*for freeing the whole tree*/, struct ast_node **root, bool, int numthreads, bool lazy);
+void destroy_ast(struct linked_list **ll, struct ast_node *root);
+int serialize_ast(struct ast_node *root, const char *path);
 int main(int argc, char **argv)
 {
 	assert(argc > 1);
+
+	//ast <file.c> [-o file.ast] [-j<threads>]
+	const char *output_path = NULL;
+	int numthreads = 1;
+	for(int i = 2; i < argc; ++i)
+	{
+		if(!strcmp(argv[i], "-o") && i + 1 < argc)
+			output_path = argv[++i];
+		else if(!strncmp(argv[i], "-j", 2))
+			numthreads = atoi(&argv[i][2]);
+	}
 	
 	//Step 1. Preprocess file first.
 	/* pre.c */
@@ -56,14 +69,19 @@ int main(int argc, char **argv)
     struct ast_node *root = NULL;
 
 	//Step 3. Generate AST from tokens.
-	int ast = generate_ast(tokens, num_tokens, &ast_list, &root, 1);
+	int ast = generate_ast(tokens, num_tokens, &ast_list, &root, output_path == NULL, numthreads, false);
 	if(ast)
 	{
 		printf("Failed to generate AST\n");
 		return 0;
 	}
+	if(output_path && serialize_ast(root, output_path))
+	{
+		printf("Failed to write AST to '%s'\n", output_path);
+		return 1;
+	}
+	destroy_ast(&ast_list, root);
 	root = NULL;
-	linked_list_destroy(&ast_list);
     free(tokens);
 	return 0;
 }
\ No newline at end of file
@@ -25,7 +25,9 @@
 #endif
 
 // imported functions from other files
-int generate_ast(struct token *tokens, int num_tokens, struct linked_list **ll/*for freeing the whole tree*/, struct ast_node **root, bool);
+int generate_ast(struct token *tokens, int num_tokens, struct linked_list **ll/*for freeing the whole tree*/, struct ast_node **root, bool, int numthreads, bool lazy);
+void destroy_ast(struct linked_list **ll, struct ast_node *root);
+int sema(struct ast_node *program);
 int x86(struct ast_node *head, compiler_t *ctx);
 
 int opt_flags = 0;
@@ -86,6 +88,12 @@ int main( int argc, char** argv )
     int numfiles = 0;
 	//use build target memory as default
 	int build_target = BT_OPCODES;
+	//threads used for parsing function bodies
+	int numthreads = 1;
+	bool lazy_parse = false;
+	int optimize = 0;
+	int optimize_size = 0;
+	int regparm = 0;
 	struct linked_list* symbols = linked_list_create(struct dynlib_sym);
 	size_t nsymbols = 0;
 	
@@ -118,6 +126,40 @@ int main( int argc, char** argv )
 			case 'v':
 				opt_flags |= OPT_VERBOSE;
 				break;
+			case 'j':
+				numthreads = atoi(&argv[i][2]);
+				break;
+			case 'O':
+				//-O1 and up generate code from the ir instead of straight from the ast
+				//-O2 selects instructions for speed, -Os is -O1 that selects them for size
+				if(argv[i][2] == 's')
+				{
+					optimize = 1;
+					optimize_size = 1;
+				} else
+					optimize = atoi(&argv[i][2]);
+				break;
+			case 'e':
+				//print the ir of every function that could be lowered
+				if(!strcmp(&argv[i][2], "mit-ir"))
+					opt_flags |= OPT_EMIT_IR;
+				break;
+			case 'f':
+				//only parse the bodies of functions that are used
+				if(!strcmp(&argv[i][2], "lazy-parse"))
+					lazy_parse = true;
+				//clean up the generated machine code, on from -O1
+				else if(!strcmp(&argv[i][2], "peephole"))
+					opt_flags |= OPT_PEEPHOLE;
+				//address the frame of functions generated from the ir off esp and use ebp for values
+				else if(!strcmp(&argv[i][2], "omit-frame-pointer"))
+					opt_flags |= OPT_OMIT_FRAME_POINTER;
+				break;
+			case 'm':
+				//pass the first arguments of calls between our own functions in eax, edx and ecx
+				if(!strncmp(&argv[i][2], "regparm=", 8))
+					regparm = atoi(&argv[i][10]);
+				break;
 			case 'b':
 			{
 				const char* build_target_str = (const char*)&argv[i][2];
@@ -166,45 +208,56 @@ int main( int argc, char** argv )
 	if (opt_flags & OPT_VERBOSE)
     printf("src: %s, dst: %s\n", src, dst);
     
-    /* pre.c */
-	heap_string preprocess_file( const char* filename, const char** includepaths, int verbose, struct hash_map *defines, struct hash_map **defines_out);
-	const char* includepaths[] = { "examples/include/", NULL };
-	heap_string data = preprocess_file( src, includepaths, 0, NULL, NULL );
-
-	if ( !data )
-    {
-	    printf( "failed to read file '%s'\n", src );
-	    return 1;
-    }
-
-	struct token *tokens = NULL;
+    struct token *tokens = NULL;
     int num_tokens = 0;
-    
-	// printf("data = %s\n", data);
-	parse( data , &tokens, &num_tokens, LEX_FL_NONE);
-	heap_string_free( &data );
-    
-    //printf("num_tokens = %d\n", num_tokens);
-    char str[256]={0};
-    for(int i = 0; i < num_tokens; ++i)
-    {
-        struct token *tk = &tokens[i];
-        token_to_string(tk, str, sizeof(str));
-		//printf("token %s\n", str);
-    }
-
     struct linked_list *ast_list = NULL;
     struct ast_node *root = NULL;
 	compiler_t ctx = { 0 };
     ctx.build_target = build_target;
+	ctx.optimize = optimize;
+	ctx.optimize_size = optimize_size;
+	ctx.regparm = regparm < 0 ? 0 : regparm > 3 ? 3 : regparm;
+	if(optimize >= 1)
+		opt_flags |= OPT_PEEPHOLE;
 	ctx.find_import_fn = find_lib_symbol;
 	ctx.find_import_fn_userptr = symbols;
-	int ast = generate_ast(tokens, num_tokens, &ast_list, &root, opt_flags & OPT_AST);
+	int ast;
+
+	size_t srclen = strlen(src);
+	if(srclen > 4 && !strcmp(src + srclen - 4, ".ast"))
+	{
+		//already preprocessed and parsed, see ast_serialize.c
+		int deserialize_ast(const char *path, struct linked_list **ll, struct ast_node **root);
+		ast = deserialize_ast(src, &ast_list, &root);
+	} else
+	{
+		/* pre.c */
+		heap_string preprocess_file( const char* filename, const char** includepaths, int verbose, struct hash_map *defines, struct hash_map **defines_out);
+		const char* includepaths[] = { "examples/include/", NULL };
+		heap_string data = preprocess_file( src, includepaths, 0, NULL, NULL );
+
+		if ( !data )
+		{
+			printf( "failed to read file '%s'\n", src );
+			return 1;
+		}
+
+		// printf("data = %s\n", data);
+		parse( data , &tokens, &num_tokens, LEX_FL_NONE);
+		heap_string_free( &data );
+
+		ast = generate_ast(tokens, num_tokens, &ast_list, &root, opt_flags & OPT_AST, numthreads, lazy_parse);
+	}
+    int status = ast;
     if(!ast && (opt_flags & OPT_AST) != OPT_AST)
     {
 		// generate native code
 		heap_string data_buf = NULL;
-		int compile_status = x86( root, &ctx );
+		// annotate expressions with their types before generating code, see sema.c
+		int compile_status = sema( root );
+		if ( !compile_status )
+			compile_status = x86( root, &ctx );
+		status = compile_status;
 		if ( !compile_status )
 		{
             if ( (opt_flags & OPT_INSTR) != OPT_INSTR )
@@ -271,10 +324,10 @@ int main( int argc, char** argv )
 		}
 		heap_string_free( &data_buf );
         
+    	destroy_ast(&ast_list, root);
 		root = NULL;
-    	linked_list_destroy(&ast_list);
     }
     free(tokens);
 	//getchar();
-    return 0;
+    return status ? 1 : 0;
 }
@@ -0,0 +1,1060 @@
+//peephole optimizer over the machine code of a function, runs once the function is generated
+//decodes the instructions the code generator emits into a list, applies the rules below until none of them match,
+//gives jumps that are close enough to their target the short encoding
+//and encodes the function again with jumps, calls, relocations and call fixups moved to where their instructions ended up
+//the rules only run with -fpeephole (or -O1), jumps are always relaxed
+//functions with an instruction the decoder doesn't know or a jump into the middle of an instruction are left alone
+
+#include "compile.h"
+#include "encode.h"
+#include "std.h"
+#include "rhd/linked_list.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+int instruction_position(compiler_t *ctx);
+int function_register_parameters(compiler_t *ctx, struct function *fn);
+extern const reg_t parameter_registers[];
+
+//bits of the read and write masks besides the registers
+#define PH_FLAGS (1 << 8)
+#define PH_MEMORY (1 << 9)
+#define PH_REG(r) (1 << (r))
+
+enum PH_KIND
+{
+    PH_NORMAL,
+    PH_JUMP,
+    PH_BRANCH,
+    PH_CALL,
+    PH_IMPORT, //call through the pointer that follows it, see call_import in x86.c
+    PH_RETURN,
+    PH_INTERRUPT,
+    PH_INDIRECT, //jump to a register or memory operand
+    PH_TAIL_CALL //jmp rel32 to another function, see ir_tail_call in x86.c
+};
+
+struct ph_instr
+{
+    int offset; //in the code as it was generated
+    int length;
+    u8 bytes[16];
+    int kind;
+    int target; //offset of the destination of a jump or call as generated
+    int targetindex; //instruction a jump goes to
+    int prefix; //operand size prefix
+    int reads, writes;
+    int setsflags; //every flag is written without being read
+    int label; //a jump goes here
+    int fixed; //a relocation or call fixup points into it, the bytes can't change
+    int removed;
+};
+
+struct ph_modrm
+{
+    int mod, reg, rm;
+    int length; //modrm, sib and displacement bytes
+    int address; //registers the address of a memory operand is computed from
+};
+
+struct peephole
+{
+    compiler_t *ctx;
+    int start;
+    struct ph_instr *instrs;
+    int numinstrs;
+    int rule; //rule that's being applied, for the statistics
+};
+
+struct ph_rule
+{
+    const char *name;
+    bool (*apply)(struct peephole *P, int i);
+};
+
+static int removed_instructions[16];
+static int removed_bytes[16];
+static int relaxed_jumps;
+static int relaxed_bytes;
+
+static bool decode_modrm(const u8 *p, int avail, struct ph_modrm *m)
+{
+    if(avail < 1)
+        return false;
+    m->mod = p[0] >> 6;
+    m->reg = (p[0] >> 3) & 7;
+    m->rm = p[0] & 7;
+    m->length = 1;
+    m->address = 0;
+    if(m->mod == 3)
+        return true;
+    int base = m->rm;
+    if(m->rm == 4)
+    {
+        if(avail < 2)
+            return false;
+        int index = (p[1] >> 3) & 7;
+        base = p[1] & 7;
+        m->length = 2;
+        if(index != 4)
+            m->address |= PH_REG(index);
+        if(base == 5 && m->mod == 0)
+        {
+            m->length += 4;
+            base = -1;
+        }
+    } else if(m->rm == 5 && m->mod == 0)
+    {
+        m->length += 4;
+        base = -1;
+    }
+    if(base != -1)
+        m->address |= PH_REG(base);
+    if(m->mod == 1)
+        m->length += 1;
+    else if(m->mod == 2)
+        m->length += 4;
+    return m->length <= avail;
+}
+
+//al, cl, dl and bl are 0 to 3, ah, ch, dh and bh 4 to 7
+static int register_bit(int reg, int byte)
+{
+    return PH_REG(byte ? reg & 3 : reg);
+}
+
+static void read_rm(struct ph_instr *in, struct ph_modrm *m, int byte)
+{
+    if(m->mod == 3)
+        in->reads |= register_bit(m->rm, byte);
+    else
+        in->reads |= m->address | PH_MEMORY;
+}
+
+//writing part of a register keeps the rest, which counts as reading it
+static void write_rm(struct ph_instr *in, struct ph_modrm *m, int partial)
+{
+    if(m->mod == 3)
+    {
+        int bit = register_bit(m->rm, partial == 1);
+        in->writes |= bit;
+        if(partial)
+            in->reads |= bit;
+    } else
+    {
+        in->reads |= m->address;
+        in->writes |= PH_MEMORY;
+    }
+}
+
+static void write_reg(struct ph_instr *in, int reg, int partial)
+{
+    int bit = register_bit(reg, partial == 1);
+    in->writes |= bit;
+    if(partial)
+        in->reads |= bit;
+}
+
+static void alu_flags(struct ph_instr *in, int op)
+{
+    in->writes |= PH_FLAGS;
+    //adc and sbb use the carry
+    if(op == 2 || op == 3)
+        in->reads |= PH_FLAGS;
+    else
+        in->setsflags = 1;
+}
+
+//decodes one instruction of the subset the code generator emits, false if it's something else
+static bool decode(const u8 *code, int avail, struct ph_instr *in)
+{
+    struct ph_modrm m;
+    int p = 0;
+    if(avail > 0 && code[0] == 0x66)
+    {
+        in->prefix = 1;
+        p = 1;
+    }
+    if(p >= avail)
+        return false;
+    int wide = in->prefix ? 2 : 4; //size of a full immediate
+    int partial = in->prefix ? 2 : 0; //writes to 16 bit registers keep the upper half
+    u8 op = code[p++];
+
+#define MODRM() do { if(!decode_modrm(code + p, avail - p, &m)) return false; p += m.length; } while(0)
+
+    if(op < 0x40 && (op & 7) < 6)
+    {
+        //add, or, adc, sbb, and, sub, xor and cmp
+        int alu = op >> 3;
+        int form = op & 7;
+        int byte = !(form & 1);
+        if(form < 4)
+        {
+            MODRM();
+            bool zeroing = (alu == 5 || alu == 6) && m.mod == 3 && m.rm == m.reg;
+            if(form < 2)
+            {
+                //op r/m,r
+                if(!zeroing)
+                {
+                    in->reads |= register_bit(m.reg, byte);
+                    read_rm(in, &m, byte);
+                }
+                if(alu != 7)
+                    write_rm(in, &m, byte ? 1 : zeroing ? 0 : partial);
+            } else
+            {
+                //op r,r/m
+                if(!zeroing)
+                {
+                    in->reads |= register_bit(m.reg, byte);
+                    read_rm(in, &m, byte);
+                }
+                if(alu != 7)
+                    write_reg(in, m.reg, byte ? 1 : zeroing ? 0 : partial);
+            }
+        } else
+        {
+            //op al/eax,imm
+            in->reads |= PH_REG(EAX);
+            if(alu != 7)
+                write_reg(in, EAX, byte ? 1 : partial);
+            p += byte ? 1 : wide;
+        }
+        alu_flags(in, alu);
+    } else if(op >= 0x40 && op <= 0x4f)
+    {
+        //inc/dec r32
+        in->reads |= PH_REG(op & 7);
+        in->writes |= PH_REG(op & 7) | PH_FLAGS;
+    } else if(op >= 0x50 && op <= 0x57)
+    {
+        //push r32
+        in->reads |= PH_REG(op & 7) | PH_REG(ESP);
+        in->writes |= PH_REG(ESP) | PH_MEMORY;
+    } else if(op >= 0x58 && op <= 0x5f)
+    {
+        //pop r32
+        in->reads |= PH_REG(ESP) | PH_MEMORY;
+        in->writes |= PH_REG(op & 7) | PH_REG(ESP);
+    } else if(op >= 0x70 && op <= 0x7f)
+    {
+        //jcc rel8
+        if(p + 1 > avail)
+            return false;
+        in->kind = PH_BRANCH;
+        in->reads |= PH_FLAGS;
+        in->target = in->offset + p + 1 + (signed char)code[p];
+        p += 1;
+    } else if(op >= 0xb0 && op <= 0xb7)
+    {
+        //mov r8,imm8
+        write_reg(in, op & 7, 1);
+        p += 1;
+    } else if(op >= 0xb8 && op <= 0xbf)
+    {
+        //mov r32,imm32
+        write_reg(in, op & 7, partial);
+        p += wide;
+    } else switch(op)
+    {
+    case 0x68:
+    case 0x6a:
+        //push imm
+        in->reads |= PH_REG(ESP);
+        in->writes |= PH_REG(ESP) | PH_MEMORY;
+        p += op == 0x6a ? 1 : wide;
+        break;
+    case 0x69:
+    case 0x6b:
+        //imul r32,r/m32,imm
+        MODRM();
+        read_rm(in, &m, 0);
+        write_reg(in, m.reg, partial);
+        in->writes |= PH_FLAGS;
+        p += op == 0x6b ? 1 : wide;
+        break;
+    case 0x80:
+    case 0x81:
+    case 0x83:
+        //op r/m,imm
+        MODRM();
+        read_rm(in, &m, op == 0x80);
+        if(m.reg != 7)
+            write_rm(in, &m, op == 0x80 ? 1 : partial);
+        alu_flags(in, m.reg);
+        p += op == 0x81 ? wide : 1;
+        break;
+    case 0x84:
+    case 0x85:
+        //test r/m,r
+        MODRM();
+        in->reads |= register_bit(m.reg, op == 0x84);
+        read_rm(in, &m, op == 0x84);
+        in->writes |= PH_FLAGS;
+        in->setsflags = 1;
+        break;
+    case 0x88:
+    case 0x89:
+        //mov r/m,r
+        MODRM();
+        in->reads |= register_bit(m.reg, op == 0x88);
+        write_rm(in, &m, op == 0x88 ? 1 : partial);
+        break;
+    case 0x8a:
+    case 0x8b:
+        //mov r,r/m
+        MODRM();
+        read_rm(in, &m, op == 0x8a);
+        write_reg(in, m.reg, op == 0x8a ? 1 : partial);
+        break;
+    case 0x8d:
+        //lea r32,m
+        MODRM();
+        if(m.mod == 3)
+            return false;
+        in->reads |= m.address;
+        write_reg(in, m.reg, partial);
+        break;
+    case 0x90:
+        //nop
+        break;
+    case 0x99:
+        //cdq
+        in->reads |= PH_REG(EAX);
+        write_reg(in, EDX, partial);
+        break;
+    case 0xa8:
+    case 0xa9:
+        //test al/eax,imm
+        in->reads |= PH_REG(EAX);
+        in->writes |= PH_FLAGS;
+        in->setsflags = 1;
+        p += op == 0xa8 ? 1 : wide;
+        break;
+    case 0xc0:
+    case 0xc1:
+    case 0xd0:
+    case 0xd1:
+    case 0xd2:
+    case 0xd3:
+        //rol, ror, rcl, rcr, shl, shr and sar by imm8, 1 or cl, /6 is the same as shl
+        MODRM();
+        read_rm(in, &m, !(op & 1));
+        write_rm(in, &m, !(op & 1) ? 1 : partial);
+        in->writes |= PH_FLAGS;
+        if(m.reg == 2 || m.reg == 3)
+            in->reads |= PH_FLAGS;
+        if(op == 0xd2 || op == 0xd3)
+            in->reads |= PH_REG(ECX);
+        if(op == 0xc0 || op == 0xc1)
+            p += 1;
+        break;
+    case 0xc2:
+    case 0xc3:
+        //ret
+        in->kind = PH_RETURN;
+        in->reads |= PH_REG(ESP) | PH_MEMORY;
+        in->writes |= PH_REG(ESP);
+        if(op == 0xc2)
+            p += 2;
+        break;
+    case 0xc6:
+    case 0xc7:
+        //mov r/m,imm
+        MODRM();
+        if(m.reg != 0)
+            return false;
+        write_rm(in, &m, op == 0xc6 ? 1 : partial);
+        p += op == 0xc6 ? 1 : wide;
+        break;
+    case 0xc9:
+        //leave
+        in->reads |= PH_REG(EBP) | PH_MEMORY;
+        in->writes |= PH_REG(ESP) | PH_REG(EBP);
+        break;
+    case 0xcc:
+    case 0xcd:
+        //int3, int imm8
+        in->kind = PH_INTERRUPT;
+        in->reads = 0xff | PH_FLAGS | PH_MEMORY;
+        in->writes = PH_REG(EAX) | PH_MEMORY;
+        if(op == 0xcd)
+            p += 1;
+        break;
+    case 0xe8:
+    case 0xe9:
+        //call/jmp rel32
+        if(p + 4 > avail)
+            return false;
+        in->kind = op == 0xe8 ? PH_CALL : PH_JUMP;
+        in->target = in->offset + p + 4 + *(int*)&code[p];
+        p += 4;
+        break;
+    case 0xeb:
+        //jmp rel8
+        if(p + 1 > avail)
+            return false;
+        in->kind = PH_JUMP;
+        in->target = in->offset + p + 1 + (signed char)code[p];
+        p += 1;
+        break;
+    case 0xf6:
+    case 0xf7:
+        MODRM();
+        switch(m.reg)
+        {
+        case 0:
+            //test r/m,imm
+            read_rm(in, &m, op == 0xf6);
+            in->writes |= PH_FLAGS;
+            in->setsflags = 1;
+            p += op == 0xf6 ? 1 : wide;
+            break;
+        case 1:
+            return false;
+        case 2:
+        case 3:
+            //not, neg
+            read_rm(in, &m, op == 0xf6);
+            write_rm(in, &m, op == 0xf6 ? 1 : partial);
+            if(m.reg == 3)
+            {
+                in->writes |= PH_FLAGS;
+                in->setsflags = 1;
+            }
+            break;
+        default:
+            //mul, imul, div, idiv of edx:eax
+            read_rm(in, &m, op == 0xf6);
+            in->reads |= PH_REG(EAX);
+            if(m.reg >= 6 && op == 0xf7)
+                in->reads |= PH_REG(EDX);
+            write_reg(in, EAX, op == 0xf6 ? 2 : partial);
+            if(op == 0xf7)
+                write_reg(in, EDX, partial);
+            in->writes |= PH_FLAGS;
+            break;
+        }
+        break;
+    case 0xfe:
+    case 0xff:
+        MODRM();
+        switch(m.reg)
+        {
+        case 0:
+        case 1:
+            //inc, dec
+            read_rm(in, &m, op == 0xfe);
+            write_rm(in, &m, op == 0xfe ? 1 : partial);
+            in->writes |= PH_FLAGS;
+            break;
+        case 2:
+            //call r/m32
+            if(op == 0xfe)
+                return false;
+            read_rm(in, &m, 0);
+            in->kind = PH_CALL;
+            in->target = -1;
+            break;
+        case 4:
+            //jmp r/m32
+            if(op == 0xfe)
+                return false;
+            read_rm(in, &m, 0);
+            in->kind = PH_INDIRECT;
+            break;
+        case 6:
+            //push r/m32
+            if(op == 0xfe)
+                return false;
+            read_rm(in, &m, 0);
+            in->reads |= PH_REG(ESP);
+            in->writes |= PH_REG(ESP) | PH_MEMORY;
+            break;
+        default:
+            return false;
+        }
+        break;
+    case 0x0f:
+    {
+        if(p >= avail)
+            return false;
+        u8 op2 = code[p++];
+        if(op2 >= 0x80 && op2 <= 0x8f)
+        {
+            //jcc rel32
+            if(p + 4 > avail)
+                return false;
+            in->kind = PH_BRANCH;
+            in->reads |= PH_FLAGS;
+            in->target = in->offset + p + 4 + *(int*)&code[p];
+            p += 4;
+        } else if(op2 >= 0x90 && op2 <= 0x9f)
+        {
+            //setcc r/m8
+            MODRM();
+            in->reads |= PH_FLAGS;
+            write_rm(in, &m, 1);
+        } else if(op2 >= 0x40 && op2 <= 0x4f)
+        {
+            //cmovcc r32,r/m32
+            MODRM();
+            in->reads |= PH_FLAGS | PH_REG(m.reg);
+            read_rm(in, &m, 0);
+            write_reg(in, m.reg, partial);
+        } else if(op2 == 0xaf)
+        {
+            //imul r32,r/m32
+            MODRM();
+            in->reads |= PH_REG(m.reg);
+            read_rm(in, &m, 0);
+            write_reg(in, m.reg, partial);
+            in->writes |= PH_FLAGS;
+        } else if(op2 == 0xb6 || op2 == 0xb7 || op2 == 0xbe || op2 == 0xbf)
+        {
+            //movzx/movsx r32,r/m8 or r/m16
+            MODRM();
+            read_rm(in, &m, op2 == 0xb6 || op2 == 0xbe);
+            write_reg(in, m.reg, partial);
+        } else
+            return false;
+    } break;
+    default:
+        return false;
+    }
+#undef MODRM
+
+    //calls clobber eax, ecx, edx and the flags, the arguments are on the stack or read from registers, see peephole_function
+    if(in->kind == PH_CALL)
+    {
+        in->reads |= PH_REG(ESP) | PH_MEMORY;
+        in->writes |= PH_REG(EAX) | PH_REG(ECX) | PH_REG(EDX) | PH_REG(ESP) | PH_FLAGS | PH_MEMORY;
+    }
+    if(p > avail || p > sizeof(in->bytes))
+        return false;
+    in->length = p;
+    memcpy(in->bytes, code, p);
+    return true;
+}
+
+//length of the instruction at code, 0 if it isn't one the decoder knows, the encoder checks what it emits with it
+int peephole_instruction_length(const u8 *code, int avail)
+{
+    struct ph_instr in = { 0 };
+    return decode(code, avail, &in) ? in.length : 0;
+}
+
+static int next(struct peephole *P, int i)
+{
+    for(++i; i < P->numinstrs && P->instrs[i].removed; ++i)
+        ;
+    return i;
+}
+
+//the instruction a jump to instruction i ends up at
+static int resolve(struct peephole *P, int i)
+{
+    while(i < P->numinstrs && P->instrs[i].removed)
+        ++i;
+    return i;
+}
+
+static void remove_instr(struct peephole *P, int i)
+{
+    P->instrs[i].removed = 1;
+    ++removed_instructions[P->rule];
+    removed_bytes[P->rule] += P->instrs[i].length;
+}
+
+static bool decode(const u8 *code, int avail, struct ph_instr *in);
+
+//the replacement is never longer than the instruction
+static void replace_instr(struct peephole *P, int i, const u8 *bytes, int length)
+{
+    assert(length > 0);
+    struct ph_instr *in = &P->instrs[i];
+    struct ph_instr replacement = { .offset = in->offset, .label = in->label };
+    removed_bytes[P->rule] += in->length - length;
+    decode(bytes, length, &replacement);
+    *in = replacement;
+}
+
+//whether what's in the register (or the flags) is overwritten before it's read again on every path from after instruction i
+static bool dead_after(struct peephole *P, int i, int bit)
+{
+    //jumps are followed a few times, loops would go on forever
+    int jumps = 0;
+    int j = next(P, i);
+    while(j < P->numinstrs)
+    {
+        struct ph_instr *in = &P->instrs[j];
+        if(in->reads & bit)
+            return false;
+        switch(in->kind)
+        {
+        case PH_CALL:
+        case PH_IMPORT:
+            //the callee keeps ebx, esi, edi and ebp
+            if(bit & (PH_REG(EAX) | PH_REG(ECX) | PH_REG(EDX) | PH_FLAGS))
+                return true;
+            break;
+        case PH_RETURN:
+            //the result is in eax, ebx, esi, edi and ebp belong to the caller
+            return (bit & (PH_REG(ECX) | PH_REG(EDX) | PH_FLAGS)) != 0;
+        case PH_TAIL_CALL:
+            //the callee leaves the result in eax, arguments in registers are read by the jump
+            return (bit & (PH_REG(EAX) | PH_REG(ECX) | PH_REG(EDX) | PH_FLAGS)) != 0;
+        case PH_JUMP:
+            if(++jumps > 8)
+                return false;
+            j = resolve(P, in->targetindex);
+            continue;
+        case PH_NORMAL:
+            if(bit == PH_FLAGS ? in->setsflags : (in->writes & bit) != 0)
+                return true;
+            break;
+        default:
+            return false;
+        }
+        j = next(P, j);
+    }
+    return false;
+}
+
+static bool is_push_register(struct ph_instr *in)
+{
+    return !in->prefix && in->kind == PH_NORMAL && in->length == 1 && in->bytes[0] >= 0x50 && in->bytes[0] <= 0x57;
+}
+
+static bool is_pop_register(struct ph_instr *in)
+{
+    return !in->prefix && in->kind == PH_NORMAL && in->length == 1 && in->bytes[0] >= 0x58 && in->bytes[0] <= 0x5f;
+}
+
+//mov r32,r32 in either encoding, gives the destination and source
+static bool is_move_register(struct ph_instr *in, int *dst, int *src)
+{
+    if(in->prefix || in->length != 2 || (in->bytes[1] >> 6) != 3)
+        return false;
+    int reg = (in->bytes[1] >> 3) & 7, rm = in->bytes[1] & 7;
+    if(in->bytes[0] == 0x89)
+    {
+        *dst = rm;
+        *src = reg;
+        return true;
+    }
+    if(in->bytes[0] == 0x8b)
+    {
+        *dst = reg;
+        *src = rm;
+        return true;
+    }
+    return false;
+}
+
+//two instructions that run one after the other, nothing jumps in between them
+static int following(struct peephole *P, int i)
+{
+    int j = next(P, i);
+    if(j >= P->numinstrs || P->instrs[j].label)
+        return -1;
+    return j;
+}
+
+//push r; pop r
+static bool push_pop_same(struct peephole *P, int i)
+{
+    int j = following(P, i);
+    if(j == -1 || !is_push_register(&P->instrs[i]) || !is_pop_register(&P->instrs[j]))
+        return false;
+    if((P->instrs[i].bytes[0] & 7) != (P->instrs[j].bytes[0] & 7))
+        return false;
+    remove_instr(P, i);
+    remove_instr(P, j);
+    return true;
+}
+
+//push r/m; pop r -> mov r,r/m
+static bool push_pop_move(struct peephole *P, int i)
+{
+    struct ph_instr *push = &P->instrs[i];
+    int j = following(P, i);
+    if(j == -1 || !is_pop_register(&P->instrs[j]) || push->fixed || push->prefix)
+        return false;
+    int dst = P->instrs[j].bytes[0] & 7;
+    if(dst == ESP)
+        return false;
+    u8 bytes[16];
+    int length;
+    if(is_push_register(push))
+    {
+        if((push->bytes[0] & 7) == dst)
+            return false;
+        struct x86_instruction mov = { X86_MOV, { x86_reg(dst), x86_reg(push->bytes[0] & 7) } };
+        length = x86_encode(&mov, bytes);
+    } else if(push->bytes[0] == 0xff && ((push->bytes[1] >> 3) & 7) == 6)
+    {
+        //the address is computed before the push moves esp, same as it is for the mov
+        //mov r32,r/m32
+        bytes[0] = 0x8b;
+        memcpy(bytes + 1, push->bytes + 1, push->length - 1);
+        bytes[1] = (bytes[1] & 0xc7) | (dst << 3);
+        length = push->length;
+    } else
+        return false;
+    replace_instr(P, i, bytes, length);
+    remove_instr(P, j);
+    return true;
+}
+
+//pop r; push r where r is overwritten before it's read, the value stays on the stack
+static bool pop_push_dead(struct peephole *P, int i)
+{
+    int j = following(P, i);
+    if(j == -1 || !is_pop_register(&P->instrs[i]) || !is_push_register(&P->instrs[j]))
+        return false;
+    int reg = P->instrs[i].bytes[0] & 7;
+    if(reg != (P->instrs[j].bytes[0] & 7) || reg == ESP || !dead_after(P, j, PH_REG(reg)))
+        return false;
+    remove_instr(P, i);
+    remove_instr(P, j);
+    return true;
+}
+
+//mov a,b; mov a,b or mov a,b; mov b,a
+static bool redundant_move(struct peephole *P, int i)
+{
+    int a, b, c, d;
+    int j = following(P, i);
+    if(j == -1 || !is_move_register(&P->instrs[i], &a, &b) || !is_move_register(&P->instrs[j], &c, &d) || a == b)
+        return false;
+    if(!((a == c && b == d) || (a == d && b == c)))
+        return false;
+    remove_instr(P, j);
+    return true;
+}
+
+//mov [m],r; mov r2,[m] -> mov [m],r; mov r2,r
+static bool store_reload(struct peephole *P, int i)
+{
+    struct ph_instr *store = &P->instrs[i];
+    int j = following(P, i);
+    if(j == -1 || store->prefix || store->bytes[0] != 0x89 || (store->bytes[1] >> 6) == 3)
+        return false;
+    struct ph_instr *load = &P->instrs[j];
+    if(load->prefix || load->fixed || load->bytes[0] != 0x8b || load->length != store->length)
+        return false;
+    //same addressing mode, base, index and displacement
+    if((load->bytes[1] & 0xc7) != (store->bytes[1] & 0xc7) || memcmp(load->bytes + 2, store->bytes + 2, store->length - 2))
+        return false;
+    int src = (store->bytes[1] >> 3) & 7, dst = (load->bytes[1] >> 3) & 7;
+    if(src == dst)
+    {
+        remove_instr(P, j);
+        return true;
+    }
+    u8 bytes[16];
+    struct x86_instruction mov = { X86_MOV, { x86_reg(dst), x86_reg(src) } };
+    replace_instr(P, j, bytes, x86_encode(&mov, bytes));
+    return true;
+}
+
+//an instruction that only writes a register nobody reads before it's written again
+static bool dead_write(struct peephole *P, int i)
+{
+    struct ph_instr *in = &P->instrs[i];
+    if(in->kind != PH_NORMAL || in->fixed)
+        return false;
+    int regs = in->writes & 0xff;
+    //exactly one register and nothing else, except for the flags
+    if(!regs || (regs & (regs - 1)) || (in->writes & PH_MEMORY) || (regs & (PH_REG(ESP) | PH_REG(EBP))))
+        return false;
+    if((in->writes & PH_FLAGS) && !dead_after(P, i, PH_FLAGS))
+        return false;
+    if(!dead_after(P, i, regs))
+        return false;
+    remove_instr(P, i);
+    return true;
+}
+
+//mov r,0 -> xor r,r when the flags it changes aren't used
+static bool zero_xor(struct peephole *P, int i)
+{
+    struct ph_instr *in = &P->instrs[i];
+    if(in->fixed || in->prefix || in->length != 5 || in->bytes[0] < 0xb8 || in->bytes[0] > 0xbf || *(int*)&in->bytes[1] != 0)
+        return false;
+    if(!dead_after(P, i, PH_FLAGS))
+        return false;
+    int reg = in->bytes[0] & 7;
+    u8 bytes[16];
+    struct x86_instruction xor = { X86_XOR, { x86_reg(reg), x86_reg(reg) } };
+    replace_instr(P, i, bytes, x86_encode(&xor, bytes));
+    return true;
+}
+
+//jmp or jcc to the instruction after it
+static bool jump_next(struct peephole *P, int i)
+{
+    struct ph_instr *in = &P->instrs[i];
+    if((in->kind != PH_JUMP && in->kind != PH_BRANCH) || in->fixed)
+        return false;
+    if(resolve(P, in->targetindex) != next(P, i))
+        return false;
+    remove_instr(P, i);
+    return true;
+}
+
+static const struct ph_rule rules[] = {
+    { "push and pop of the same register", push_pop_same },
+    { "pop and push of a dead register", pop_push_dead },
+    { "push and pop turned into a move", push_pop_move },
+    { "move that's already done", redundant_move },
+    { "load of a value that was just stored", store_reload },
+    { "write to a dead register", dead_write },
+    { "mov r,0 turned into xor r,r", zero_xor },
+    { "jump to the next instruction", jump_next }
+};
+
+static struct ph_instr *instruction_at(struct peephole *P, int *index, intptr_t offset)
+{
+    int lo = 0, hi = P->numinstrs - 1;
+    while(lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        struct ph_instr *in = &P->instrs[mid];
+        if(offset < in->offset)
+            hi = mid - 1;
+        else if(offset >= in->offset + in->length)
+            lo = mid + 1;
+        else
+        {
+            *index = mid;
+            return in;
+        }
+    }
+    return NULL;
+}
+
+static bool decode_function(struct peephole *P, const u8 *code, int size)
+{
+    int maxinstrs = 0;
+    for(int offset = 0; offset < size;)
+    {
+        if(P->numinstrs == maxinstrs)
+        {
+            maxinstrs = maxinstrs ? maxinstrs * 2 : 64;
+            P->instrs = realloc(P->instrs, maxinstrs * sizeof(struct ph_instr));
+        }
+        struct ph_instr *in = &P->instrs[P->numinstrs];
+        memset(in, 0, sizeof(*in));
+        in->offset = P->start + offset;
+        //call [P]; jmp over P; P
+        if(size - offset >= 12 && code[offset] == 0xff && code[offset + 1] == 0x15 && code[offset + 6] == 0xeb && code[offset + 7] == 0x04)
+        {
+            in->kind = PH_IMPORT;
+            in->length = 12;
+            memcpy(in->bytes, code + offset, 12);
+            in->reads = PH_REG(ESP) | PH_MEMORY;
+            in->writes = PH_REG(EAX) | PH_REG(ECX) | PH_REG(EDX) | PH_REG(ESP) | PH_FLAGS | PH_MEMORY;
+        } else if(!decode(code + offset, size - offset, in))
+        {
+            if(opt_flags & OPT_VERBOSE)
+                printf("peephole: can't decode %02x at %d\n", code[offset], in->offset);
+            return false;
+        }
+        offset += in->length;
+        ++P->numinstrs;
+    }
+    //the function itself is called
+    if(P->numinstrs > 0)
+        P->instrs[0].label = 1;
+    for(int i = 0; i < P->numinstrs; ++i)
+    {
+        struct ph_instr *in = &P->instrs[i];
+        if(in->kind != PH_JUMP && in->kind != PH_BRANCH)
+            continue;
+        int t;
+        if(in->kind == PH_JUMP && in->bytes[0] == 0xe9 && (in->target < P->start || in->target > P->start + size))
+        {
+            in->kind = PH_TAIL_CALL;
+            in->reads |= PH_REG(ESP) | PH_MEMORY;
+            continue;
+        }
+        if(in->target == P->start + size)
+            t = P->numinstrs;
+        else if(!instruction_at(P, &t, in->target) || P->instrs[t].offset != in->target)
+        {
+            if(opt_flags & OPT_VERBOSE)
+                printf("peephole: jump at %d doesn't go to an instruction in the function\n", in->offset);
+            return false;
+        } else
+            P->instrs[t].label = 1;
+        in->targetindex = t;
+    }
+    return true;
+}
+
+//new offset of every instruction, a removed one is where the one after it ends up
+static int *layout(struct peephole *P)
+{
+    int *offsets = malloc((P->numinstrs + 1) * sizeof(int));
+    int offset = P->start;
+    for(int i = 0; i < P->numinstrs; ++i)
+    {
+        offsets[i] = offset;
+        if(!P->instrs[i].removed)
+            offset += P->instrs[i].length;
+    }
+    offsets[P->numinstrs] = offset;
+    return offsets;
+}
+
+//the code generator emits every jump as rel32 and patches it later, give the ones whose target is in range of a rel8 the short form
+//shortening a jump only brings other jumps closer to their targets, so repeat until none changes
+static void relax(struct peephole *P)
+{
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        int *offsets = layout(P);
+        for(int i = 0; i < P->numinstrs; ++i)
+        {
+            struct ph_instr *in = &P->instrs[i];
+            if(in->removed || in->fixed || (in->kind != PH_JUMP && in->kind != PH_BRANCH))
+                continue;
+            u8 op;
+            if(in->bytes[0] == 0xe9)
+                op = 0xeb;
+            else if(in->bytes[0] == 0x0f && (in->bytes[1] & 0xf0) == 0x80)
+                op = 0x70 + (in->bytes[1] & 0x0f);
+            else
+                continue;
+            //offsets before this pass, the jumps shortened since only make the distance smaller
+            int displacement = offsets[in->targetindex] - (offsets[i] + 2);
+            if(displacement < -128 || displacement > 127)
+                continue;
+            ++relaxed_jumps;
+            relaxed_bytes += in->length - 2;
+            in->bytes[0] = op;
+            in->length = 2;
+            changed = true;
+        }
+        free(offsets);
+    }
+}
+
+void peephole_function(compiler_t *ctx, int start)
+{
+    int end = instruction_position(ctx);
+    struct peephole P = { .ctx = ctx, .start = start };
+    if(!decode_function(&P, (const u8*)ctx->instr + start, end - start))
+    {
+        free(P.instrs);
+        return;
+    }
+
+    //relocations and calls are patched later, those bytes stay as they are
+    linked_list_reversed_foreach(ctx->relocations, struct relocation*, it,
+    {
+        int index;
+        if(it->from >= start && it->from < end && instruction_at(&P, &index, it->from))
+            P.instrs[index].fixed = 1;
+    });
+    linked_list_reversed_foreach(ctx->call_fixups, struct call_fixup*, it,
+    {
+        int index;
+        if(it->from >= start && it->from < end && instruction_at(&P, &index, it->from))
+        {
+            P.instrs[index].fixed = 1;
+            //the first arguments may be in registers
+            for(int i = function_register_parameters(ctx, it->fn) - 1; i >= 0; --i)
+                P.instrs[index].reads |= PH_REG(parameter_registers[i]);
+        }
+    });
+
+    bool changed = (opt_flags & OPT_PEEPHOLE) != 0;
+    while(changed)
+    {
+        changed = false;
+        for(int r = 0; r < COUNT_OF(rules); ++r)
+        {
+            P.rule = r;
+            for(int i = 0; i < P.numinstrs; ++i)
+                if(!P.instrs[i].removed && rules[r].apply(&P, i))
+                    changed = true;
+        }
+    }
+
+    relax(&P);
+
+    int *offsets = layout(&P);
+    int size = offsets[P.numinstrs] - start;
+    if(size == end - start)
+    {
+        free(offsets);
+        free(P.instrs);
+        return;
+    }
+    u8 *code = malloc(size ? size : 1);
+    for(int i = 0; i < P.numinstrs; ++i)
+    {
+        struct ph_instr *in = &P.instrs[i];
+        if(in->removed)
+            continue;
+        u8 *p = code + offsets[i] - start;
+        memcpy(p, in->bytes, in->length);
+        //moving instructions closer together never puts a rel8 out of range
+        int next = offsets[i] + in->length;
+        if(in->kind == PH_JUMP || in->kind == PH_BRANCH)
+        {
+            int displacement = offsets[in->targetindex] - next;
+            if(in->bytes[0] == 0xeb || (in->bytes[0] >= 0x70 && in->bytes[0] <= 0x7f))
+                p[in->length - 1] = displacement;
+            else
+                *(int*)&p[in->length - 4] = displacement;
+        } else if(((in->kind == PH_CALL && in->bytes[0] == 0xe8) || in->kind == PH_TAIL_CALL) && !in->fixed)
+        {
+            int target = in->target;
+            int index;
+            if(target >= start && target < end && instruction_at(&P, &index, target))
+                target = offsets[index];
+            *(int*)&p[1] = target - next;
+        }
+    }
+
+    linked_list_reversed_foreach(ctx->relocations, struct relocation*, it,
+    {
+        int index;
+        if(it->from >= start && it->from < end && instruction_at(&P, &index, it->from))
+            it->from += offsets[index] - P.instrs[index].offset;
+    });
+    linked_list_reversed_foreach(ctx->call_fixups, struct call_fixup*, it,
+    {
+        int index;
+        if(it->from >= start && it->from < end && instruction_at(&P, &index, it->from))
+            it->from += offsets[index] - P.instrs[index].offset;
+    });
+
+    //keep what comes before the function, then the new code
+    heap_string instr = NULL;
+    heap_string_appendn(&instr, ctx->instr, start);
+    heap_string_appendn(&instr, code, size);
+    heap_string_free(&ctx->instr);
+    ctx->instr = instr;
+    free(code);
+    free(offsets);
+    free(P.instrs);
+}
+
+//instructions and bytes each rule removed over everything that was compiled
+void peephole_report(void)
+{
+    if(opt_flags & OPT_PEEPHOLE)
+        for(int i = 0; i < COUNT_OF(rules); ++i)
+            printf("peephole: %-40s %6d instructions %6d bytes\n", rules[i].name, removed_instructions[i], removed_bytes[i]);
+    printf("peephole: %-40s %6d jumps        %6d bytes\n", "jump with a rel8 displacement", relaxed_jumps, relaxed_bytes);
+}
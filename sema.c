@@ -0,0 +1,844 @@
+//semantic analysis, runs between generating the ast and generating code
+//resolves the type, operand size and lvalue-ness of expressions once and stores it on the node (ast_node.sema)
+//anything that can't be resolved is left unresolved, the ir gives up on those functions and the ast code generator treats it as a bug
+
+#include "ast.h"
+#include "token.h"
+#include "std.h"
+#include "rhd/linked_list.h"
+#include "rhd/hash_map.h"
+#include <limits.h>
+
+struct sema_context
+{
+    struct ast_node *function;
+    struct hash_map *variables; //name -> data type node of the declaration, same scoping as the code generator
+    struct hash_map *locals; //name -> declaration node of parameters and local variables
+    struct hash_map *functions; //name -> declaration node of the definition, NULL for bodies parsed on first use, which aren't in the call graph
+    int temporaries;
+    int loopdepth;
+};
+
+//size of a primitive type in bytes or -1 for one it doesn't know, the code generator uses it too
+int sema_primitive_size(int type)
+{
+    switch(type)
+    {
+    case DT_CHAR: return 1;
+    case DT_SHORT: return 2;
+    case DT_INT: return 4;
+    case DT_LONG: return 4;
+    case DT_NUMBER: return 4;
+    case DT_FLOAT: return 4;
+    case DT_DOUBLE: return 4;
+    case DT_VOID: return 0;
+    }
+    return -1;
+}
+
+int struct_layout(struct ast_node *decl);
+
+//size and alignment of a type in memory (i386 System V), -1 if it can't be laid out, the code generator lays out its frame with it too
+int type_layout(struct ast_node *n, int *alignment)
+{
+    switch(n->type)
+    {
+    case AST_PRIMITIVE:
+    {
+        int sz = sema_primitive_size(n->primitive_data.primitive_type);
+        //double is only 4 byte aligned on i386
+        *alignment = sz > 4 ? 4 : sz < 1 ? 1 : sz;
+        return sz;
+    }
+    case AST_POINTER_DATA_TYPE:
+        *alignment = 4;
+        return 4;
+    case AST_ARRAY_DATA_TYPE:
+    {
+        int sz = type_layout(n->data_type_data.data_type, alignment);
+        if(sz == -1)
+            return -1;
+        return sz * n->data_type_data.array_size;
+    }
+    case AST_STRUCT_DATA_TYPE:
+    {
+        struct ast_node *decl = n->data_type_data.data_type;
+        if(!decl || struct_layout(decl))
+            return -1;
+        *alignment = decl->struct_decl_data.alignment;
+        return decl->struct_decl_data.size;
+    }
+    case AST_DATA_TYPE:
+        return type_layout(n->data_type_data.data_type, alignment);
+    }
+    return -1;
+}
+
+//computes the offset of every field and the size and alignment of a struct or union once and stores it on the declaration
+//fields are aligned to their natural alignment unless the struct is packed
+int struct_layout(struct ast_node *decl)
+{
+    struct ast_struct_decl *sd = &decl->struct_decl_data;
+    if(sd->laid_out)
+        return 0;
+    if(decl->type != AST_STRUCT_DECL && decl->type != AST_UNION_DECL)
+        return 1;
+    int is_union = decl->type == AST_UNION_DECL;
+    int size = 0, alignment = 1;
+    for(int i = 0; i < sd->numfields; ++i)
+    {
+        int field_alignment = 1;
+        int sz = type_layout(sd->fields[i]->variable_decl_data.data_type, &field_alignment);
+        if(sz == -1)
+        {
+            printf("can't compute layout of field '%s' in '%s'\n", sd->fields[i]->variable_decl_data.id->identifier_data.name, sd->name);
+            return 1;
+        }
+        if(sd->packed)
+            field_alignment = 1;
+        if(field_alignment > alignment)
+            alignment = field_alignment;
+        if(is_union)
+        {
+            sd->offsets[i] = 0;
+            if(sz > size)
+                size = sz;
+        } else
+        {
+            size = (size + field_alignment - 1) & ~(field_alignment - 1);
+            sd->offsets[i] = size;
+            size += sz;
+        }
+    }
+    sd->size = (size + alignment - 1) & ~(alignment - 1);
+    sd->alignment = alignment;
+    sd->laid_out = 1;
+    return 0;
+}
+
+//size of a type in memory, -1 if it can't be laid out
+int sema_type_size(struct ast_node *n)
+{
+    int alignment;
+    return type_layout(n, &alignment);
+}
+
+//same as data_type_operand_size in x86.c, but returns -1 instead of guessing when it can't resolve the size
+static int operand_size(struct ast_node *n, int ptr)
+{
+    if(n->sema.resolved)
+        return n->sema.operand_size[ptr ? 1 : 0];
+
+    switch(n->type)
+    {
+    case AST_IDENTIFIER:
+        if(!n->sema.data_type)
+            return -1;
+        return operand_size(n->sema.data_type, ptr);
+
+    case AST_PRIMITIVE:
+        return sema_primitive_size(n->primitive_data.primitive_type);
+
+    case AST_BIN_EXPR:
+    {
+        int a = operand_size(n->bin_expr_data.lhs, ptr);
+        int b = operand_size(n->bin_expr_data.rhs, ptr);
+        if(a == -1 || b == -1)
+            return -1;
+        return a < b ? a : b;
+    }
+
+    case AST_LITERAL:
+        return 4;
+
+    case AST_POINTER_DATA_TYPE:
+    {
+        struct ast_node *to = n->data_type_data.data_type;
+        if(ptr)
+            return 4;
+        if(to->type == AST_POINTER_DATA_TYPE)
+            return operand_size(to, 1);
+        if(to->type != AST_PRIMITIVE)
+            return sema_type_size(to);
+        return sema_primitive_size(to->primitive_data.primitive_type);
+    }
+
+    case AST_ARRAY_DATA_TYPE:
+    {
+        struct ast_node *of = n->data_type_data.data_type;
+        if(of->type != AST_PRIMITIVE)
+            return sema_type_size(of);
+        return sema_primitive_size(of->primitive_data.primitive_type);
+    }
+
+    case AST_STRUCT_MEMBER_EXPR:
+        if(!n->sema.field)
+            return -1;
+        return operand_size(n->sema.field->variable_decl_data.data_type, ptr);
+
+    case AST_MEMBER_EXPR:
+        if(n->member_expr_data.object->type != AST_IDENTIFIER)
+            return -1;
+        return operand_size(n->member_expr_data.object, 0);
+
+    case AST_UNARY_EXPR:
+        if(n->unary_expr_data.operator == '*')
+            return operand_size(n->unary_expr_data.argument, 0);
+        return operand_size(n->unary_expr_data.argument, ptr);
+
+    case AST_CAST:
+        return operand_size(n->cast_data.type, ptr);
+
+    case AST_DATA_TYPE:
+        return operand_size(n->data_type_data.data_type, ptr);
+    }
+    return -1;
+}
+
+//struct declaration a struct member expression refers to, object has to be a identifier like in x86.c
+static struct ast_node *member_struct_decl(struct ast_node *n)
+{
+    struct ast_node *object = n->member_expr_data.object;
+    if(object->type != AST_IDENTIFIER || !object->sema.data_type)
+        return NULL;
+    struct ast_node *dn = object->sema.data_type;
+    struct ast_node *sr = NULL;
+    if(dn->type == AST_POINTER_DATA_TYPE)
+    {
+        struct ast_node *to = dn->data_type_data.data_type;
+        if(to->type == AST_STRUCT_DATA_TYPE)
+            sr = to->data_type_data.data_type;
+    }
+    else if(dn->type == AST_STRUCT_DATA_TYPE)
+        sr = dn->data_type_data.data_type;
+    if(!sr || (sr->type != AST_STRUCT_DECL && sr->type != AST_UNION_DECL))
+        return NULL;
+    return sr;
+}
+
+static void resolve_member(struct ast_node *n)
+{
+    struct ast_node *sr = member_struct_decl(n);
+    if(!sr || n->member_expr_data.property->type != AST_IDENTIFIER)
+        return;
+    if(struct_layout(sr))
+        return;
+    const char *name = n->member_expr_data.property->identifier_data.name;
+    for(int i = 0; i < sr->struct_decl_data.numfields; ++i)
+    {
+        struct ast_node *field = sr->struct_decl_data.fields[i];
+        if(!strcmp(field->variable_decl_data.id->identifier_data.name, name))
+        {
+            int alignment;
+            n->sema.field = field;
+            n->sema.field_offset = sr->struct_decl_data.offsets[i];
+            n->sema.field_size = type_layout(field->variable_decl_data.data_type, &alignment);
+            return;
+        }
+    }
+}
+
+static struct ast_node *expression_type(struct ast_node *n)
+{
+    switch(n->type)
+    {
+    case AST_IDENTIFIER:
+        return n->sema.data_type;
+    case AST_STRUCT_MEMBER_EXPR:
+        return n->sema.field ? n->sema.field->variable_decl_data.data_type : NULL;
+    case AST_MEMBER_EXPR:
+    {
+        struct ast_node *t = n->member_expr_data.object->sema.data_type;
+        if(t && (t->type == AST_ARRAY_DATA_TYPE || t->type == AST_POINTER_DATA_TYPE))
+            return t->data_type_data.data_type;
+    } break;
+    case AST_UNARY_EXPR:
+    {
+        struct ast_node *t = n->unary_expr_data.argument->sema.data_type;
+        if(n->unary_expr_data.operator == '*')
+            return t && t->type == AST_POINTER_DATA_TYPE ? t->data_type_data.data_type : NULL;
+        if(n->unary_expr_data.operator == TK_PLUS_PLUS || n->unary_expr_data.operator == TK_MINUS_MINUS)
+            return t;
+    } break;
+    case AST_CAST:
+        return n->cast_data.type;
+    case AST_ASSIGNMENT_EXPR:
+        return n->assignment_expr_data.lhs->sema.data_type;
+    }
+    return NULL;
+}
+
+//unsigned char and short are promoted to int, only unsigned int makes an expression unsigned
+static bool unsigned_type(struct ast_node *t)
+{
+    if(!t)
+        return false;
+    switch(t->type)
+    {
+    case AST_PRIMITIVE:
+        return (t->primitive_data.qualifiers & TQ_UNSIGNED) && sema_primitive_size(t->primitive_data.primitive_type) == 4;
+    case AST_DATA_TYPE:
+        return (t->data_type_data.qualifiers & TQ_UNSIGNED) || unsigned_type(t->data_type_data.data_type);
+    }
+    return false;
+}
+
+//the usual arithmetic conversions, an unsigned operand makes the other one unsigned
+static bool unsigned_expression(struct ast_node *n)
+{
+    switch(n->type)
+    {
+    case AST_BIN_EXPR:
+        switch(n->bin_expr_data.operator)
+        {
+        case TK_LSHIFT:
+        case TK_RSHIFT:
+            return n->bin_expr_data.lhs->sema.is_unsigned;
+        case '+':
+        case '-':
+        case '*':
+        case '/':
+        case '%':
+        case '&':
+        case '|':
+        case '^':
+            return n->bin_expr_data.lhs->sema.is_unsigned || n->bin_expr_data.rhs->sema.is_unsigned;
+        }
+        return false;
+    case AST_ASSIGNMENT_EXPR:
+        if(n->assignment_expr_data.operator == '=')
+            return n->assignment_expr_data.lhs->sema.is_unsigned;
+        return n->assignment_expr_data.lhs->sema.is_unsigned || n->assignment_expr_data.rhs->sema.is_unsigned;
+    case AST_UNARY_EXPR:
+        switch(n->unary_expr_data.operator)
+        {
+        case '-':
+        case '+':
+        case '~':
+        case TK_PLUS_PLUS:
+        case TK_MINUS_MINUS:
+            return n->unary_expr_data.argument->sema.is_unsigned;
+        }
+        break;
+    case AST_TERNARY_EXPR:
+        return n->ternary_expr_data.consequent->sema.is_unsigned || n->ternary_expr_data.alternative->sema.is_unsigned;
+    }
+    return unsigned_type(n->sema.data_type);
+}
+
+//mirrors the nodes lvalue() in x86.c can take the address of
+static int is_lvalue(struct ast_node *n)
+{
+    switch(n->type)
+    {
+    case AST_IDENTIFIER:
+    case AST_STRUCT_MEMBER_EXPR:
+    case AST_MEMBER_EXPR:
+        return 1;
+    case AST_UNARY_EXPR:
+        return n->unary_expr_data.operator == '*';
+    case AST_CAST:
+        return is_lvalue(n->cast_data.expr);
+    }
+    return 0;
+}
+
+static int expression(struct sema_context *ctx, struct ast_node *n);
+static int statement(struct sema_context *ctx, struct ast_node *n);
+
+static struct ast_node *local_declaration(struct sema_context *ctx, struct ast_node *n)
+{
+    if(n->type != AST_IDENTIFIER)
+        return NULL;
+    struct ast_node **decl = hash_map_find(ctx->locals, n->identifier_data.name);
+    return decl ? *decl : NULL;
+}
+
+//the code generator can only access this variable through it's address
+static void pin_variable(struct sema_context *ctx, struct ast_node *n)
+{
+    struct ast_node *decl = local_declaration(ctx, n);
+    if(decl)
+        decl->sema.address_taken = 1;
+}
+
+//the operand that's evaluated first is kept in a register while the other one is evaluated, see ast_rhs_first
+//leafs are loaded straight into a register and anything that isn't register only spills to the stack instead
+static int count_temporaries(struct ast_node *n)
+{
+    if(n->type != AST_BIN_EXPR)
+        return 0;
+    struct ast_node *lhs = n->bin_expr_data.lhs;
+    struct ast_node *rhs = n->bin_expr_data.rhs;
+    if(ast_is_leaf(rhs))
+        return lhs->sema.temporaries;
+    if(ast_is_leaf(lhs))
+        return rhs->sema.temporaries;
+    struct ast_node *first = ast_rhs_first(n) ? rhs : lhs;
+    struct ast_node *second = first == lhs ? rhs : lhs;
+    int a = first->sema.temporaries;
+    int b = second->sema.temporaries;
+    if(ast_is_register_only(second))
+        b += 1;
+    return a > b ? a : b;
+}
+
+static bool integer_constant(struct ast_node *n, int *value)
+{
+    if(n->type != AST_LITERAL || n->literal_data.type != LITERAL_INTEGER)
+        return false;
+    *value = n->literal_data.integer;
+    return true;
+}
+
+static void replace_with_constant(struct ast_node *n, int value)
+{
+    n->type = AST_LITERAL;
+    memset(&n->literal_data, 0, sizeof(n->literal_data));
+    n->literal_data.type = LITERAL_INTEGER;
+    n->literal_data.integer = value;
+    memset(&n->sema, 0, sizeof(n->sema));
+}
+
+//the node takes the place of the one it's replaced with, nothing refers to the old one afterwards
+static void replace_with_node(struct ast_node *n, struct ast_node *with)
+{
+    struct ast_node *parent = n->parent;
+    *n = *with;
+    n->parent = parent;
+}
+
+//value of a binary operator applied to two ints, wrapping around like the generated code does
+//false when it's undefined or traps at runtime, those are left for the code to do
+static bool evaluate_binary(int operator, int a, int b, int *result)
+{
+    unsigned int ua = a, ub = b;
+    switch(operator)
+    {
+    case '+': *result = ua + ub; break;
+    case '-': *result = ua - ub; break;
+    case '*': *result = ua * ub; break;
+    case '/':
+    case '%':
+        if(b == 0 || (a == INT_MIN && b == -1))
+            return false;
+        *result = operator == '/' ? a / b : a % b;
+        break;
+    case '&': *result = a & b; break;
+    case '|': *result = a | b; break;
+    case '^': *result = a ^ b; break;
+    case TK_LSHIFT:
+        if(b < 0 || b > 31)
+            return false;
+        *result = ua << b;
+        break;
+    case TK_RSHIFT:
+        if(b < 0 || b > 31)
+            return false;
+        *result = a >> b;
+        break;
+    case TK_EQUAL: *result = a == b; break;
+    case TK_NOT_EQUAL: *result = a != b; break;
+    case '<': *result = a < b; break;
+    case TK_LEQUAL: *result = a <= b; break;
+    case '>': *result = a > b; break;
+    case TK_GEQUAL: *result = a >= b; break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+//replaces an expression whose operands are integer constants with it's value
+static void fold(struct ast_node *n)
+{
+    int a, b, value;
+    switch(n->type)
+    {
+    case AST_BIN_EXPR:
+        if(integer_constant(n->bin_expr_data.lhs, &a) && integer_constant(n->bin_expr_data.rhs, &b) &&
+           evaluate_binary(n->bin_expr_data.operator, a, b, &value))
+            replace_with_constant(n, value);
+        break;
+    case AST_UNARY_EXPR:
+        if(!integer_constant(n->unary_expr_data.argument, &a))
+            break;
+        switch(n->unary_expr_data.operator)
+        {
+        case '-': replace_with_constant(n, -(unsigned int)a); break;
+        case '+': replace_with_constant(n, a); break;
+        case '~': replace_with_constant(n, ~a); break;
+        case '!': replace_with_constant(n, !a); break;
+        }
+        break;
+    case AST_TERNARY_EXPR:
+        if(integer_constant(n->ternary_expr_data.condition, &a))
+            replace_with_node(n, a ? n->ternary_expr_data.consequent : n->ternary_expr_data.alternative);
+        break;
+    case AST_SIZEOF:
+    {
+        struct ast_node *subject = n->sizeof_data.subject;
+        if(subject->type == AST_IDENTIFIER)
+            subject = subject->sema.data_type;
+        int sz = subject ? sema_type_size(subject) : -1;
+        if(sz > 0)
+            replace_with_constant(n, sz);
+    } break;
+    case AST_CAST:
+    {
+        //only int sized integers, narrowing and pointers keep the cast for the type it gives the expression
+        struct ast_node *type = n->cast_data.type;
+        if(type->type == AST_DATA_TYPE)
+            type = type->data_type_data.data_type;
+        if(type->type == AST_PRIMITIVE && (type->primitive_data.primitive_type == DT_INT || type->primitive_data.primitive_type == DT_LONG) &&
+           !unsigned_type(n->cast_data.type) && integer_constant(n->cast_data.expr, &a))
+            replace_with_constant(n, a);
+    } break;
+    }
+}
+
+static void annotate(struct sema_context *ctx, struct ast_node *n)
+{
+    if(n->type == AST_STRUCT_MEMBER_EXPR)
+        resolve_member(n);
+    n->sema.data_type = n->type == AST_IDENTIFIER ? n->sema.data_type : expression_type(n);
+    n->sema.lvalue = is_lvalue(n);
+    n->sema.is_unsigned = unsigned_expression(n);
+    n->sema.temporaries = count_temporaries(n);
+    if(n->sema.temporaries > ctx->temporaries)
+        ctx->temporaries = n->sema.temporaries;
+    int a = operand_size(n, 0);
+    int b = operand_size(n, 1);
+    if(a != -1 && b != -1)
+    {
+        n->sema.operand_size[0] = a;
+        n->sema.operand_size[1] = b;
+        n->sema.resolved = 1;
+    }
+}
+
+//an edge in the call graph from the function that's checked to the function called name, if it's defined in the program
+static struct ast_node *reference_function(struct sema_context *ctx, const char *name)
+{
+    struct ast_node **decl = ctx->functions ? hash_map_find(ctx->functions, name) : NULL;
+    if(!decl)
+        return NULL;
+    struct ast_sema *s = &ctx->function->sema;
+    s->callees = realloc(s->callees, (s->numcallees + 1) * sizeof(s->callees[0]));
+    s->callees[s->numcallees++] = *decl;
+    return *decl;
+}
+
+static int expression(struct sema_context *ctx, struct ast_node *n)
+{
+    if(!n)
+        return 0;
+    int ret = 0;
+    switch(n->type)
+    {
+    case AST_IDENTIFIER:
+    {
+        struct ast_node **type = hash_map_find(ctx->variables, n->identifier_data.name);
+        n->sema.data_type = type ? *type : NULL;
+        struct ast_node *decl = local_declaration(ctx, n);
+        if(decl)
+            decl->sema.uses += 1 << (3 * (ctx->loopdepth < 5 ? ctx->loopdepth : 5));
+        //a function used as a value can be called from anywhere
+        else if(!type && (decl = reference_function(ctx, n->identifier_data.name)))
+            decl->sema.address_taken = 1;
+    } break;
+    case AST_BIN_EXPR:
+        ret |= expression(ctx, n->bin_expr_data.lhs);
+        ret |= expression(ctx, n->bin_expr_data.rhs);
+        break;
+    case AST_ASSIGNMENT_EXPR:
+        ret |= expression(ctx, n->assignment_expr_data.lhs);
+        ret |= expression(ctx, n->assignment_expr_data.rhs);
+        switch(n->assignment_expr_data.operator)
+        {
+        case '=':
+        case TK_PLUS_ASSIGN:
+        case TK_MINUS_ASSIGN:
+        case TK_MULTIPLY_ASSIGN:
+        case TK_DIVIDE_ASSIGN:
+        case TK_MOD_ASSIGN:
+            break;
+        default:
+            pin_variable(ctx, n->assignment_expr_data.lhs);
+            break;
+        }
+        if(!is_lvalue(n->assignment_expr_data.lhs))
+        {
+            printf("error: can't assign to '%s' in function '%s'\n", AST_NODE_TYPE_to_string(n->assignment_expr_data.lhs->type),
+                   ctx->function->func_decl_data.id->identifier_data.name);
+            ret = 1;
+        }
+        break;
+    case AST_UNARY_EXPR:
+    {
+        struct ast_node *arg = n->unary_expr_data.argument;
+        ret |= expression(ctx, arg);
+        switch(n->unary_expr_data.operator)
+        {
+        case '*':
+            //*p++ takes the address of p, only register variables that aren't pointers get in the way
+            if(arg->type == AST_UNARY_EXPR)
+            {
+                struct ast_node *p = arg->unary_expr_data.argument;
+                if(!p->sema.data_type || p->sema.data_type->type != AST_POINTER_DATA_TYPE)
+                    pin_variable(ctx, p);
+            }
+            break;
+        case TK_PLUS_PLUS:
+        case '-':
+        case '!':
+        case '~':
+            break;
+        default:
+            pin_variable(ctx, arg);
+            break;
+        }
+    } break;
+    case AST_TERNARY_EXPR:
+        ret |= expression(ctx, n->ternary_expr_data.condition);
+        ret |= expression(ctx, n->ternary_expr_data.consequent);
+        ret |= expression(ctx, n->ternary_expr_data.alternative);
+        break;
+    case AST_FUNCTION_CALL_EXPR:
+    {
+        //the callee is a function name, not a variable
+        struct ast_node *callee = n->call_expr_data.callee;
+        if(callee->type == AST_IDENTIFIER)
+            reference_function(ctx, callee->identifier_data.name);
+        for(int i = 0; i < n->call_expr_data.numargs; ++i)
+            ret |= expression(ctx, n->call_expr_data.arguments[i]);
+    } break;
+    //the object is an array, a struct or a pointer, arrays and structs always live in memory
+    case AST_MEMBER_EXPR:
+        ret |= expression(ctx, n->member_expr_data.object);
+        ret |= expression(ctx, n->member_expr_data.property);
+        break;
+    case AST_STRUCT_MEMBER_EXPR:
+        //the property is a field name, not a variable
+        ret |= expression(ctx, n->member_expr_data.object);
+        break;
+    case AST_SIZEOF:
+        if(n->sizeof_data.subject->type == AST_IDENTIFIER)
+            ret |= expression(ctx, n->sizeof_data.subject);
+        break;
+    case AST_CAST:
+        ret |= expression(ctx, n->cast_data.expr);
+        pin_variable(ctx, n->cast_data.expr);
+        break;
+    case AST_SEQ_EXPR:
+        for(int i = 0; i < n->seq_expr_data.numexpr; ++i)
+            ret |= statement(ctx, n->seq_expr_data.expr[i]);
+        return ret;
+    case AST_LITERAL:
+        break;
+    default:
+        return ret;
+    }
+    fold(n);
+    annotate(ctx, n);
+    return ret;
+}
+
+static int statement(struct sema_context *ctx, struct ast_node *n)
+{
+    if(!n)
+        return 0;
+    int ret = 0;
+    switch(n->type)
+    {
+    case AST_BLOCK_STMT:
+        linked_list_reversed_foreach(n->block_stmt_data.body, struct ast_node**, it,
+        {
+            ret |= statement(ctx, *it);
+        });
+        break;
+    case AST_VARIABLE_DECL:
+    {
+        //the code generator adds the variable before the initializer is evaluated
+        struct ast_node *id = n->variable_decl_data.id;
+        //the code generator doesn't scope variables, keep names that are declared more than once in memory
+        struct ast_node *prev = local_declaration(ctx, id);
+        if(prev || hash_map_find(ctx->variables, id->identifier_data.name))
+        {
+            n->sema.address_taken = 1;
+            if(prev)
+                prev->sema.address_taken = 1;
+        }
+        hash_map_insert(ctx->variables, id->identifier_data.name, n->variable_decl_data.data_type);
+        hash_map_insert(ctx->locals, id->identifier_data.name, n);
+        ret |= expression(ctx, id);
+        ret |= expression(ctx, n->variable_decl_data.initializer_value);
+    } break;
+    case AST_IF_STMT:
+    {
+        int test;
+        ret |= expression(ctx, n->if_stmt_data.test);
+        //only the branch that's taken is kept
+        if(integer_constant(n->if_stmt_data.test, &test))
+        {
+            struct ast_node *taken = test ? n->if_stmt_data.consequent : n->if_stmt_data.alternative;
+            if(!taken)
+            {
+                n->type = AST_EMPTY;
+                break;
+            }
+            replace_with_node(n, taken);
+            return ret | statement(ctx, n);
+        }
+        ret |= statement(ctx, n->if_stmt_data.consequent);
+        ret |= statement(ctx, n->if_stmt_data.alternative);
+    } break;
+    case AST_WHILE_STMT:
+    {
+        int test;
+        ++ctx->loopdepth;
+        ret |= expression(ctx, n->while_stmt_data.test);
+        if(integer_constant(n->while_stmt_data.test, &test) && !test)
+        {
+            --ctx->loopdepth;
+            n->type = AST_EMPTY;
+            break;
+        }
+        ret |= statement(ctx, n->while_stmt_data.body);
+        --ctx->loopdepth;
+    } break;
+    case AST_DO_WHILE_STMT:
+        ++ctx->loopdepth;
+        ret |= statement(ctx, n->do_while_stmt_data.body);
+        ret |= expression(ctx, n->do_while_stmt_data.test);
+        --ctx->loopdepth;
+        break;
+    case AST_FOR_STMT:
+    {
+        int test;
+        ret |= statement(ctx, n->for_stmt_data.init);
+        ++ctx->loopdepth;
+        ret |= expression(ctx, n->for_stmt_data.test);
+        //the loop never runs, only the initialization is left
+        if(n->for_stmt_data.test && integer_constant(n->for_stmt_data.test, &test) && !test)
+        {
+            --ctx->loopdepth;
+            if(n->for_stmt_data.init)
+                replace_with_node(n, n->for_stmt_data.init);
+            else
+                n->type = AST_EMPTY;
+            break;
+        }
+        ret |= statement(ctx, n->for_stmt_data.body);
+        ret |= statement(ctx, n->for_stmt_data.update);
+        --ctx->loopdepth;
+    } break;
+    case AST_RETURN_STMT:
+        ret |= expression(ctx, n->return_stmt_data.argument);
+        break;
+    case AST_EXPR_STMT:
+        ret |= expression(ctx, n->expr_stmt_data.expr);
+        break;
+    case AST_EMIT:
+    case AST_BREAK_STMT:
+    case AST_EMPTY:
+    case AST_EXIT:
+        break;
+    default:
+        ret |= expression(ctx, n);
+        break;
+    }
+    return ret;
+}
+
+static int function(struct ast_node *decl, struct hash_map *functions)
+{
+    assert(decl->type == AST_FUNCTION_DECL);
+    if(!decl->func_decl_data.body)
+        return 0;
+    struct sema_context ctx = {
+        .function = decl,
+        .variables = hash_map_create(struct ast_node*),
+        .locals = hash_map_create(struct ast_node*),
+        .functions = functions
+    };
+    for(int i = 0; i < decl->func_decl_data.numparms; ++i)
+    {
+        struct ast_node *parm = decl->func_decl_data.parameters[i];
+        hash_map_insert(ctx.variables, parm->variable_decl_data.id->identifier_data.name, parm->variable_decl_data.data_type);
+        hash_map_insert(ctx.locals, parm->variable_decl_data.id->identifier_data.name, parm);
+    }
+    int ret = statement(&ctx, decl->func_decl_data.body);
+    decl->sema.temporaries = ctx.temporaries;
+    return ret;
+}
+
+int ast_parse_function_body(struct ast_node *program, struct ast_node *decl);
+
+//a body parsed after sema ran on the program, its calls go in the same call graph
+int sema_function(struct ast_node *program, struct ast_node *decl)
+{
+    return function(decl, program->program_data.functions);
+}
+
+//lazy bodies that can run are parsed here, so the call graph is the same as when everything is parsed up front
+static int mark_reachable(struct ast_node *program, struct ast_node *decl)
+{
+    if(decl->sema.reachable)
+        return 0;
+    decl->sema.reachable = 1;
+    if(ast_function_is_lazy(decl) && (ast_parse_function_body(program, decl) || sema_function(program, decl)))
+        return 1;
+    int ret = 0;
+    for(int i = 0; i < decl->sema.numcallees; ++i)
+        ret |= mark_reachable(program, decl->sema.callees[i]);
+    return ret;
+}
+
+int sema(struct ast_node *program)
+{
+    assert(program->type == AST_PROGRAM);
+    int ret = 0;
+    //calls are counted on the definition, which gets the inline attributes of the prototypes too
+    struct hash_map *functions = hash_map_create(struct ast_node*);
+    linked_list_reversed_foreach(program->program_data.body, struct ast_node**, it,
+    {
+        struct ast_node *decl = *it;
+        struct ast_node **existing = NULL;
+        if(decl->type == AST_FUNCTION_DECL)
+            existing = hash_map_find(functions, decl->func_decl_data.id->identifier_data.name);
+        if(existing)
+        {
+            struct ast_node *definition = decl->func_decl_data.body || ast_function_is_lazy(decl) ? decl : *existing;
+            struct ast_node *other = definition == decl ? *existing : decl;
+            if(other->func_decl_data.inlining > definition->func_decl_data.inlining)
+                definition->func_decl_data.inlining = other->func_decl_data.inlining;
+            if(definition->func_decl_data.regparm == -1)
+                definition->func_decl_data.regparm = other->func_decl_data.regparm;
+            *existing = definition;
+        } else if(decl->type == AST_FUNCTION_DECL)
+            hash_map_insert(functions, decl->func_decl_data.id->identifier_data.name, decl);
+    });
+    program->program_data.functions = functions;
+    linked_list_reversed_foreach(program->program_data.body, struct ast_node**, it,
+    {
+        if((*it)->type == AST_FUNCTION_DECL)
+            ret |= function(*it, functions);
+    });
+
+    //what can run starts at main and the functions whose address is taken, calls are counted from there
+    linked_list_reversed_foreach(program->program_data.body, struct ast_node**, it,
+    {
+        struct ast_node *decl = *it;
+        if(decl->type == AST_FUNCTION_DECL && (decl->sema.address_taken || !strcmp(decl->func_decl_data.id->identifier_data.name, "main")))
+            ret |= mark_reachable(program, decl);
+    });
+    linked_list_reversed_foreach(program->program_data.body, struct ast_node**, it,
+    {
+        struct ast_node *decl = *it;
+        if(decl->type == AST_FUNCTION_DECL && decl->sema.reachable)
+            for(int i = 0; i < decl->sema.numcallees; ++i)
+                ++decl->sema.callees[i]->sema.calls;
+    });
+    return ret;
+}
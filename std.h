@@ -10,7 +10,10 @@ enum OPT_FLAG
 	OPT_VERBOSE = 1,
     OPT_DEBUG = 2,
     OPT_AST = 4,
-    OPT_INSTR = 8
+    OPT_INSTR = 8,
+    OPT_EMIT_IR = 16,
+    OPT_PEEPHOLE = 32,
+    OPT_OMIT_FRAME_POINTER = 64
 };
 
 extern int opt_flags;
@@ -4,10 +4,22 @@
 
 #include "std.h"
 #include "compile.h"
+#include "ir.h"
+#include "encode.h"
 #include "rhd/linked_list.h"
 #include "rhd/hash_map.h"
 
-struct ast_node *get_struct_member_info(compiler_t* ctx, struct ast_struct_decl *decl, const char *member_name, int *offset, int *size);
+struct ast_node *get_struct_member_info(compiler_t* ctx, struct ast_node *decl, const char *member_name, int *offset, int *size);
+int ast_parse_function_body(struct ast_node *program, struct ast_node *decl);
+int sema_function(struct ast_node *program, struct ast_node *decl);
+int struct_layout(struct ast_node *decl);
+int sema_primitive_size(int type);
+int sema_type_size(struct ast_node *n);
+int type_layout(struct ast_node *n, int *alignment);
+void peephole_function(compiler_t *ctx, int start);
+void peephole_report(void);
+void icf_fold_functions(compiler_t *ctx);
+int peephole_instruction_length(const u8 *code, int avail);
 
 int instruction_position(compiler_t *ctx)
 {
@@ -72,21 +84,48 @@ struct function* lookup_function_by_name(compiler_t *ctx, const char *name)
     return NULL;
 }
 
+//functions that weren't parsed yet are only generated once they're referenced, so are the ones the inliner parsed
+static struct function *reference_lazy_function(compiler_t *ctx, const char *name)
+{
+    if(!ctx->program)
+        return NULL;
+    struct ast_node *decl = NULL;
+    linked_list_reversed_foreach(ctx->program->program_data.body, struct ast_node**, it,
+    {
+        if(!decl && (*it)->type == AST_FUNCTION_DECL && (ast_function_is_lazy(*it) || (*it)->func_decl_data.body) &&
+           !strcmp((*it)->func_decl_data.id->identifier_data.name, name))
+            decl = *it;
+    });
+    if(!decl)
+        return NULL;
+    struct function func = {
+        .location = -1,
+        .name = decl->func_decl_data.id->identifier_data.name,
+        .decl = decl,
+        .pending = 1
+    };
+    return linked_list_prepend(ctx->functions, func);
+}
+
+static struct function *next_pending_function(compiler_t *ctx)
+{
+    linked_list_reversed_foreach(ctx->functions, struct function*, it,
+    {
+        if(it->pending)
+            return it;
+    });
+    return NULL;
+}
+
 static int primitive_data_type_size(int type)
 {
-    switch(type)
-	{
-    case DT_CHAR: return 1;
-    case DT_SHORT: return 2;
-    case DT_INT: return 4;
-    case DT_LONG: return 4;
-    case DT_NUMBER: return 4;
-    case DT_FLOAT: return 4;
-    case DT_DOUBLE: return 4;
-    case DT_VOID: return 0;
-	}
-    debug_printf("unhandled type %d\n", type);
-    return 0;
+    int size = sema_primitive_size(type);
+    if(size == -1)
+    {
+        debug_printf("unhandled type %d\n", type);
+        return 0;
+    }
+    return size;
 }
 
 static int data_type_size(compiler_t *ctx, struct ast_node *n)
@@ -95,29 +134,19 @@ static int data_type_size(compiler_t *ctx, struct ast_node *n)
 	{
     case AST_STRUCT_DATA_TYPE:
     {
-        int total = 0;
         struct ast_node *ref = n->data_type_data.data_type;
         assert(ref);
-		if(ref->type == AST_UNION_DECL)
-		{				
-			for(int i = 0; i < ref->struct_decl_data.numfields; ++i)
-			{
-				int tmp = data_type_size(ctx, ref->struct_decl_data.fields[i]->variable_decl_data.data_type);
-				if(tmp > total)
-					total = tmp;
-			}
-		} else if(ref->type == AST_STRUCT_DECL)
-		{
-			for(int i = 0; i < ref->struct_decl_data.numfields; ++i)
-				total += data_type_size(ctx, ref->struct_decl_data.fields[i]->variable_decl_data.data_type);
-		} else
+		if(struct_layout(ref))
 		{
 			debug_printf( "unhandled struct data type node '%s', can't get size\n", AST_NODE_TYPE_to_string( ref->type ) );
+			return 0;
 		}
-        return total;
+        return ref->struct_decl_data.size;
 	} break;
     case AST_IDENTIFIER:
 	{
+        if(n->sema.data_type)
+            return data_type_size(ctx, n->sema.data_type);
 		struct variable* var = hash_map_find( ctx->function->variables, n->identifier_data.name );
 		assert( var );
         return data_type_size(ctx, var->data_type_node);
@@ -135,6 +164,8 @@ static int data_type_size(compiler_t *ctx, struct ast_node *n)
 
 		if ( n->data_type_data.data_type->type == AST_ARRAY_DATA_TYPE )
 			return data_type_size( ctx, n->data_type_data.data_type ) * n->data_type_data.array_size;
+		else if ( n->data_type_data.data_type->type == AST_STRUCT_DATA_TYPE )
+			return data_type_size( ctx, n->data_type_data.data_type ) * n->data_type_data.array_size;
 		else if ( n->data_type_data.data_type->type == AST_PRIMITIVE )
 		{
             //printf("array size = %d, primitive_type_size = %d\n", n->data_type_data.array_size, primitive_data_type_size(  n->data_type_data.data_type->primitive_data_type_data.primitive_type ));
@@ -163,50 +194,383 @@ static int data_type_pass_by_reference(struct ast_node *n)
 //TODO: implement all opcodes we'll be using so we can keep track of the registers and their values
 //TODO: replace our "real" registers with "virtual" registers
 
+//appends the shortest encoding of the instruction, which has to decode back to an instruction of the same length
+static void encode(compiler_t *ctx, struct x86_instruction *in)
+{
+    u8 bytes[16];
+    in->offset = instruction_position(ctx);
+    in->length = x86_encode(in, bytes);
+    if(!in->length)
+    {
+        printf("no encoding for %s with these operands\n", x86_mnemonic_name(in->mnemonic));
+        exit(1);
+    }
+    assert(peephole_instruction_length(bytes, in->length) == in->length);
+    buf(ctx, bytes, in->length);
+}
+
+static void emit(compiler_t *ctx, int mnemonic, struct x86_operand a, struct x86_operand b)
+{
+    struct x86_instruction in = { .mnemonic = mnemonic, .operands = { a, b } };
+    encode(ctx, &in);
+}
+
+static void emit_none(compiler_t *ctx, int mnemonic)
+{
+    emit(ctx, mnemonic, (struct x86_operand){ 0 }, (struct x86_operand){ 0 });
+}
+
+static void emit_one(compiler_t *ctx, int mnemonic, struct x86_operand a)
+{
+    emit(ctx, mnemonic, a, (struct x86_operand){ 0 });
+}
+
 static void push(compiler_t *ctx, reg_t reg)
 {
-    db(ctx, 0x50 + reg);
+    emit_one(ctx, X86_PUSH, x86_reg(reg));
     ctx->registers[ESP] -= 4;
 }
 
 static void inc(compiler_t *ctx, reg_t reg)
 {
-    db(ctx, 0x40 + reg);
+    emit_one(ctx, X86_INC, x86_reg(reg));
 }
 
 static void pop(compiler_t *ctx, reg_t reg)
 {
-    db(ctx, 0x58 + reg);
+    emit_one(ctx, X86_POP, x86_reg(reg));
     ctx->registers[ESP] += 4;
 }
 
+static void mov(compiler_t *ctx, reg_t dst, reg_t src)
+{
+    ctx->registers[dst] = ctx->registers[src];
+    emit(ctx, X86_MOV, x86_reg(dst), x86_reg(src));
+}
+
+//callee saved registers for local variables and the lhs of a binary expression while the rhs is evaluated
+//ebx is left out, it's used for addresses everywhere
+static const reg_t saved_registers[] = { ESI, EDI };
+#define NUM_SAVED_REGISTERS (sizeof(saved_registers) / sizeof(saved_registers[0]))
+
+static reg_t allocate_temporary(compiler_t *ctx)
+{
+    for(int i = 0; i < ctx->function->numtemporaries; ++i)
+    {
+        if(ctx->function->temporaries & (1 << i))
+            continue;
+        ctx->function->temporaries |= 1 << i;
+        return saved_registers[ctx->function->numregistervariables + i];
+    }
+    return ESP; //none left, spill
+}
+
+static void free_temporary(compiler_t *ctx, reg_t reg)
+{
+    for(int i = 0; i < ctx->function->numtemporaries; ++i)
+    {
+        if(saved_registers[ctx->function->numregistervariables + i] == reg)
+            ctx->function->temporaries &= ~(1 << i);
+    }
+}
+
+static void function_epilogue(compiler_t *ctx)
+{
+    int n = ctx->function->numregistervariables + ctx->function->numtemporaries;
+    if(n > 0)
+    {
+        //lea esp,[ebp - framesize - saved registers]
+        emit(ctx, X86_LEA, x86_reg(ESP), x86_mem(EBP, 0, 0, -(ctx->function->framesize + n * 4)));
+        for(int i = n - 1; i >= 0; --i)
+            pop(ctx, saved_registers[i]);
+    }
+
+    //mov esp,ebp
+    //pop ebp
+    emit(ctx, X86_MOV, x86_reg(ESP), x86_reg(EBP));
+    emit_one(ctx, X86_POP, x86_reg(EBP));
+    emit_none(ctx, X86_RET);
+}
+
 static void mov_r_imm32(compiler_t *ctx, reg_t reg, i32 imm)
 {
     ctx->registers[reg] = imm;
-    db(ctx, 0xb8 + reg);
-    dd(ctx, imm);
+    emit(ctx, X86_MOV, x86_reg(reg), x86_imm(imm));
 }
 
 static void add(compiler_t *ctx, reg_t a, reg_t b)
 {
     ctx->registers[a] += ctx->registers[b];
-    db(ctx, 0x01);
-    db(ctx, 0xc0 + b * 9 + a);
+    emit(ctx, X86_ADD, x86_reg(a), x86_reg(b));
 }
 
 static void xor(compiler_t *ctx, reg_t a, reg_t b)
 {
     assert(a == EAX && b == EAX);
     ctx->registers[a] ^= ctx->registers[b];
-	db( ctx, 0x31 );
-	db( ctx, 0xc0 + b * 9 + a );
+    emit(ctx, X86_XOR, x86_reg(a), x86_reg(b));
 }
 
 static void sub(compiler_t *ctx, reg_t a, reg_t b)
 {
-    ctx->registers[a] += ctx->registers[b];
-    db(ctx, 0x29);
-    db(ctx, 0xc0 + b * 9 + a);
+    ctx->registers[a] -= ctx->registers[b];
+    emit(ctx, X86_SUB, x86_reg(a), x86_reg(b));
+}
+
+//modrm, sib and displacement of the memory operand [base + index * scale + disp] in its shortest encoding
+//scale is 0 without an index, esp can't be an index
+static void memory_operand(compiler_t *ctx, int field, reg_t base, reg_t index, int scale, i32 disp)
+{
+    u8 bytes[8];
+    buf(ctx, bytes, x86_encode_memory(bytes, field, base, index, scale, disp));
+}
+
+//shl/shr/sar r32,imm8
+static void shift_r_imm(compiler_t *ctx, int mnemonic, reg_t reg, int count)
+{
+    emit(ctx, mnemonic, x86_reg(reg), x86_imm(count));
+}
+
+static void and_r_imm(compiler_t *ctx, reg_t reg, i32 imm)
+{
+    emit(ctx, X86_AND, x86_reg(reg), x86_imm(imm));
+}
+
+//imul dst,src,imm
+static void imul_r_imm(compiler_t *ctx, reg_t dst, reg_t src, i32 imm)
+{
+    struct x86_instruction in = { .mnemonic = X86_IMUL, .operands = { x86_reg(dst), x86_reg(src), x86_imm(imm) } };
+    encode(ctx, &in);
+}
+
+static int log2_exact(u32 value)
+{
+    if(!value || (value & (value - 1)))
+        return -1;
+    int n = 0;
+    while(value >>= 1)
+        ++n;
+    return n;
+}
+
+//reg *= c with shifts and lea where that's shorter or faster than imul
+static void multiply_by_constant(compiler_t *ctx, reg_t reg, i32 c)
+{
+    int k = log2_exact(c);
+    if(c == 0)
+    {
+        emit(ctx, X86_XOR, x86_reg(reg), x86_reg(reg));
+        return;
+    }
+    if(c == -1)
+    {
+        emit_one(ctx, X86_NEG, x86_reg(reg));
+        return;
+    }
+    if(k == 0)
+        return;
+    if(k > 0)
+    {
+        shift_r_imm(ctx, X86_SHL, reg, k);
+        return;
+    }
+    //3, 5 and 9 times a power of two, lea r32,[r32+r32*scale] then shift
+    for(int scale = 1; scale <= 3 && reg != EBP && reg != ESP; ++scale)
+    {
+        if(c % ((1 << scale) + 1))
+            continue;
+        k = log2_exact(c / ((1 << scale) + 1));
+        if(k < 0)
+            continue;
+        emit(ctx, X86_LEA, x86_reg(reg), x86_mem(reg, reg, 1 << scale, 0));
+        if(k > 0)
+            shift_r_imm(ctx, X86_SHL, reg, k);
+        return;
+    }
+    imul_r_imm(ctx, reg, reg, c);
+}
+
+//multiplier and shift that turn signed division by d >= 2 into a multiplication, see hacker's delight chapter 10
+static void signed_magic(i32 d, i32 *multiplier, int *shift)
+{
+    const u32 two31 = 0x80000000;
+    u32 ad = d;
+    u32 anc = two31 - 1 - two31 % ad;
+    u32 q1 = two31 / anc, r1 = two31 - q1 * anc;
+    u32 q2 = two31 / ad, r2 = two31 - q2 * ad;
+    u32 delta;
+    int p = 31;
+    do
+    {
+        ++p;
+        q1 *= 2;
+        r1 *= 2;
+        if(r1 >= anc)
+        {
+            ++q1;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if(r2 >= ad)
+        {
+            ++q2;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while(q1 < delta || (q1 == delta && r1 == 0));
+    *multiplier = q2 + 1;
+    *shift = p - 32;
+}
+
+//same for unsigned division by 2 <= d < 2^31, when wide is set the multiplier is 33 bits
+static void unsigned_magic(u32 d, u32 *multiplier, int *shift, int *wide)
+{
+    u32 nc = -1 - (-d) % d;
+    u32 q1 = 0x80000000 / nc, r1 = 0x80000000 - q1 * nc;
+    u32 q2 = 0x7fffffff / d, r2 = 0x7fffffff - q2 * d;
+    u32 delta;
+    int p = 31;
+    *wide = 0;
+    do
+    {
+        ++p;
+        if(r1 >= nc - r1)
+        {
+            q1 = 2 * q1 + 1;
+            r1 = 2 * r1 - nc;
+        } else
+        {
+            q1 = 2 * q1;
+            r1 = 2 * r1;
+        }
+        if(r2 + 1 >= d - r2)
+        {
+            if(q2 >= 0x7fffffff)
+                *wide = 1;
+            q2 = 2 * q2 + 1;
+            r2 = 2 * r2 + 1 - d;
+        } else
+        {
+            if(q2 >= 0x80000000)
+                *wide = 1;
+            q2 = 2 * q2;
+            r2 = 2 * r2 + 1;
+        }
+        delta = d - 1 - r2;
+    } while(p < 64 && (q1 < delta || (q1 == delta && r1 == 0)));
+    *multiplier = q2 + 1;
+    *shift = p - 32;
+}
+
+//sign or zero extends eax into edx:eax for idiv or div
+static void extend_dividend(compiler_t *ctx, int is_unsigned)
+{
+    if(is_unsigned)
+        emit(ctx, X86_XOR, x86_reg(EDX), x86_reg(EDX));
+    else
+        emit_none(ctx, X86_CDQ);
+}
+
+//eax = eax / d or eax % d, without a div instruction unless d is 0, INT_MIN or too large for an unsigned multiplier
+//clobbers ecx and edx
+static void divide_by_constant(compiler_t *ctx, i32 d, int modulo, int is_unsigned)
+{
+    int k = log2_exact(d);
+    if(d == 0 || (u32)d == 0x80000000 || (is_unsigned && d < 0))
+    {
+        mov_r_imm32(ctx, ECX, d);
+        extend_dividend(ctx, is_unsigned);
+        emit_one(ctx, is_unsigned ? X86_DIV : X86_IDIV, x86_reg(ECX));
+        if(modulo)
+            mov(ctx, EAX, EDX);
+        return;
+    }
+    if(d == 1 || d == -1)
+    {
+        if(modulo)
+            emit(ctx, X86_XOR, x86_reg(EAX), x86_reg(EAX));
+        else if(d == -1)
+            emit_one(ctx, X86_NEG, x86_reg(EAX));
+        return;
+    }
+    if(is_unsigned)
+    {
+        if(k > 0)
+        {
+            if(modulo)
+                and_r_imm(ctx, EAX, d - 1);
+            else
+                shift_r_imm(ctx, X86_SHR, EAX, k);
+            return;
+        }
+        u32 multiplier;
+        int shift, wide;
+        unsigned_magic(d, &multiplier, &shift, &wide);
+        mov(ctx, ECX, EAX);
+        mov_r_imm32(ctx, EDX, multiplier);
+        emit_one(ctx, X86_MUL, x86_reg(EDX));
+        if(wide)
+        {
+            //eax = ((x - hi) >> 1) + hi >> shift - 1
+            mov(ctx, EAX, ECX);
+            sub(ctx, EAX, EDX);
+            shift_r_imm(ctx, X86_SHR, EAX, 1);
+            add(ctx, EAX, EDX);
+            if(shift > 1)
+                shift_r_imm(ctx, X86_SHR, EAX, shift - 1);
+        } else
+        {
+            mov(ctx, EAX, EDX);
+            if(shift > 0)
+                shift_r_imm(ctx, X86_SHR, EAX, shift);
+        }
+    } else
+    {
+        i32 ad = d < 0 ? -d : d;
+        k = log2_exact(ad);
+        if(k > 0)
+        {
+            //round towards zero by adding ad - 1 to negative dividends
+            emit_none(ctx, X86_CDQ);
+            and_r_imm(ctx, EDX, ad - 1);
+            add(ctx, EAX, EDX);
+            if(modulo)
+            {
+                and_r_imm(ctx, EAX, ad - 1);
+                sub(ctx, EAX, EDX);
+                return;
+            }
+            shift_r_imm(ctx, X86_SAR, EAX, k);
+        } else
+        {
+            i32 multiplier;
+            int shift;
+            signed_magic(ad, &multiplier, &shift);
+            mov(ctx, ECX, EAX);
+            mov_r_imm32(ctx, EDX, multiplier);
+            emit_one(ctx, X86_IMUL, x86_reg(EDX));
+            if(multiplier < 0)
+                add(ctx, EDX, ECX);
+            if(shift > 0)
+                shift_r_imm(ctx, X86_SAR, EDX, shift);
+            //add one for negative dividends
+            mov(ctx, EAX, ECX);
+            shift_r_imm(ctx, X86_SHR, EAX, 31);
+            add(ctx, EAX, EDX);
+        }
+        if(d < 0 && !modulo)
+            emit_one(ctx, X86_NEG, x86_reg(EAX));
+        //the remainder has the sign of the dividend whatever the sign of d
+        d = ad;
+    }
+    if(modulo)
+    {
+        //x - x / d * d
+        imul_r_imm(ctx, EAX, EAX, d);
+        sub(ctx, ECX, EAX);
+        mov(ctx, EAX, ECX);
+    }
 }
 
 static int add_data(compiler_t *ctx, void *data, u32 data_size)
@@ -266,10 +630,12 @@ static FUNCTION_CALL_TYPE identify_function_call_type(compiler_t* ctx, const cha
         return FUNCTION_CALL_SYSCALL;
 
     struct function *fn = lookup_function_by_name(ctx, function_name);
+    if (!fn)
+        fn = reference_lazy_function(ctx, function_name);
     if (fn)
     {
         *fn_out = fn;
-        if (fn->location != -1)
+        if (fn->location != -1 || fn->pending)
             return FUNCTION_CALL_NORMAL;
         struct dynlib_sym* sym = ctx->find_import_fn(ctx->find_import_fn_userptr, function_name);
         if (sym)
@@ -283,6 +649,92 @@ static FUNCTION_CALL_TYPE identify_function_call_type(compiler_t* ctx, const cha
     return FUNCTION_CALL_NOT_FOUND;
 }
 
+//the first arguments of calls between functions defined in the program can go in registers, the rest are pushed
+const reg_t parameter_registers[] = { EAX, EDX, ECX };
+
+//the number of arguments fn takes in parameter_registers. functions called from outside, through their address or
+//as the entry point, and variadic ones take them all on the stack
+int function_register_parameters(compiler_t *ctx, struct function *fn)
+{
+    struct ast_node *decl = fn->decl;
+    if (!decl || decl->func_decl_data.variadic || decl->sema.address_taken || !strcmp(fn->name, "main"))
+        return 0;
+    int n = decl->func_decl_data.regparm == -1 ? ctx->regparm : decl->func_decl_data.regparm;
+    return n < decl->func_decl_data.numparms ? n : decl->func_decl_data.numparms;
+}
+
+//the arguments of a call to fn that go in registers, a call with less arguments than parameters passes less
+static int call_register_arguments(compiler_t *ctx, struct function *fn, int numargs)
+{
+    int n = function_register_parameters(ctx, fn);
+    return n < numargs ? n : numargs;
+}
+
+//the arguments are already pushed, they're popped again after the call
+static void call_import(compiler_t *ctx, struct dynlib_sym *sym, int numargs)
+{
+    //db(ctx, 0xcc);
+
+    db(ctx, 0xff);
+    db(ctx, 0x15);
+    int from = instruction_position(ctx);
+    dd(ctx, 0x0); //pointer to location P
+    
+    //jmp 6
+    db(ctx, 0xeb);
+    db(ctx, 0x04);
+
+    //location P
+    //actual location of imported function
+    dd(ctx, 0x0);
+
+    //db(ctx, 0xcc);
+
+    if (numargs > 0)
+    {
+        // add esp, 4
+        db(ctx, 0x83);
+        db(ctx, 0xc4);
+        db(ctx, numargs * 4);
+    }
+
+    struct relocation reloc = {
+        .from = from,
+        .to = (intptr_t)sym,
+        .size = 4,
+        .type = RELOC_IMPORT
+    };
+    linked_list_prepend(ctx->relocations, reloc);
+}
+
+static void call_function(compiler_t *ctx, struct function *fn, int numargs)
+{
+    //every call is patched once the functions are placed, identical code folding can move them
+    int t = instruction_position(ctx);
+    db(ctx, 0xe8);
+    dd(ctx, fn->location - t - 5);
+    struct call_fixup fixup = { .from = t + 1, .fn = fn };
+    linked_list_prepend(ctx->call_fixups, fixup);
+
+    if (numargs > 0)
+    {
+        // add esp, 4
+        db(ctx, 0x83);
+        db(ctx, 0xc4);
+        db(ctx, numargs * 4);
+    }
+}
+
+//jmp to fn at the end of a tail call, the frame is gone already
+static void jump_function(compiler_t *ctx, struct function *fn)
+{
+    int t = instruction_position(ctx);
+    db(ctx, 0xe9);
+    dd(ctx, fn->location - t - 5);
+    struct call_fixup fixup = { .from = t + 1, .fn = fn };
+    linked_list_prepend(ctx->call_fixups, fixup);
+}
+
 static int function_call_ident(compiler_t *ctx, const char *function_name, struct ast_node **args, int numargs)
 {
     struct function *fn;
@@ -310,38 +762,7 @@ static int function_call_ident(compiler_t *ctx, const char *function_name, struc
             db(ctx, 0x50);
         }
 
-        //db(ctx, 0xcc);
-
-        db(ctx, 0xff);
-        db(ctx, 0x15);
-        int from = instruction_position(ctx);
-        dd(ctx, 0x0); //pointer to location P
-        
-        //jmp 6
-        db(ctx, 0xeb);
-        db(ctx, 0x04);
-
-        //location P
-        //actual location of imported function
-        dd(ctx, 0x0);
-
-        //db(ctx, 0xcc);
-
-        if (numargs > 0)
-        {
-            // add esp, 4
-            db(ctx, 0x83);
-            db(ctx, 0xc4);
-            db(ctx, numargs * 4);
-        }
-
-        struct relocation reloc = {
-            .from = from,
-            .to = (intptr_t)sym,
-            .size = 4,
-            .type = RELOC_IMPORT
-        };
-        linked_list_prepend(ctx->relocations, reloc);
+        call_import(ctx, sym, numargs);
     } break;
 
     case FUNCTION_CALL_INT3:
@@ -358,22 +779,20 @@ static int function_call_ident(compiler_t *ctx, const char *function_name, struc
             db(ctx, 0x50);
         }
 
-        int t = instruction_position(ctx);
-        db(ctx, 0xe8);
-        dd(ctx, fn->location - t - 5);
-
-        if (numargs > 0)
-        {
-            // add esp, 4
-            db(ctx, 0x83);
-            db(ctx, 0xc4);
-            db(ctx, numargs * 4);
-        }
+        //the first arguments are on top
+        int numregs = call_register_arguments(ctx, fn, numargs);
+        for (int i = 0; i < numregs; ++i)
+            pop(ctx, parameter_registers[i]);
+        call_function(ctx, fn, numargs - numregs);
     } break;
 
     case FUNCTION_CALL_SYSCALL:
         assert(numargs > 0);
 
+        //the arguments go in esi and edi, which may hold our variables
+        push(ctx, ESI);
+        push(ctx, EDI);
+
         for (int i = 0; i < 6 - numargs; ++i)
         {
             xor (ctx, EAX, EAX);
@@ -402,31 +821,50 @@ static int function_call_ident(compiler_t *ctx, const char *function_name, struc
 
         db(ctx, 0xcd); //int 0x80
         db(ctx, 0x80);
+
+        pop(ctx, EDI);
+        pop(ctx, ESI);
         break;
     }
     return 0;
 }
 
+static int register_variable_index(compiler_t *ctx, struct ast_node *decl)
+{
+    for(int i = 0; i < ctx->function->numregistervariables; ++i)
+        if(ctx->function->register_variables[i] == decl)
+            return i;
+    return -1;
+}
+
+//offset below ebp of a local placed under the used bytes of the frame, rounded up so it's aligned to its type
+static int local_variable_offset( int used, struct ast_node* data_type, int* alignment )
+{
+	int size = type_layout( data_type, alignment );
+	assert( size > 0 );
+	return ( used + size + *alignment - 1 ) & ~( *alignment - 1 );
+}
+
+//the locals that aren't kept in registers and the parameters passed in registers, laid out the same way AST_VARIABLE_DECL does
+//and rounded up to the largest alignment so esp stays at least 4 byte aligned
 static int function_variable_declaration_stack_size( compiler_t* ctx, struct ast_node* n )
 {
 	assert( n->type == AST_FUNCTION_DECL );
 	int nd = n->func_decl_data.numdeclarations;
-	int total = 0;
+	int total = function_register_parameters( ctx, ctx->function ) * 4;
+	int alignment = 4;
 	for ( int i = 0; i < nd; ++i )
 	{
 		struct ast_node* decl = n->func_decl_data.declarations[i];
 		assert( decl->type == AST_VARIABLE_DECL );
-		int ds = data_type_size( ctx, decl->variable_decl_data.data_type );
-		assert( ds > 0 );
-		total += ds;
+		if ( register_variable_index( ctx, decl ) != -1 )
+			continue;
+		int a;
+		total = local_variable_offset( total, decl->variable_decl_data.data_type, &a );
+		if ( a > alignment )
+			alignment = a;
 	}
-    
-    //align to 32
-    //TODO: fix this make sure the esp value is aligned instead
-    int aligned = total & ~31;
-    if(aligned == 0)
-        return 32;
-    return aligned;
+    return ( total + alignment - 1 ) & ~( alignment - 1 );
 }
 
 #if 0 
@@ -473,103 +911,275 @@ static struct ast_node *identifier_data_node(compiler_t *ctx, struct ast_node *n
     if(n->type != AST_IDENTIFIER)
         debug_printf("expected identifier, got '%s'\n", AST_NODE_TYPE_to_string(n->type));
 	assert(n->type == AST_IDENTIFIER);
+    if(n->sema.data_type)
+        return n->sema.data_type;
     struct variable *var = hash_map_find(ctx->function->variables, n->identifier_data.name);
     assert(var);
     return var->data_type_node;
 }
 
+//local variable that's kept in a register, NULL if n isn't one
+static struct variable *register_variable(compiler_t *ctx, struct ast_node *n)
+{
+    if(n->type != AST_IDENTIFIER)
+        return NULL;
+    struct variable *var = hash_map_find(ctx->function->variables, n->identifier_data.name);
+    return var && var->is_register ? var : NULL;
+}
+
+//picks the most used local int variables whose address isn't needed to keep in registers
+static void choose_register_variables(compiler_t *ctx, struct ast_node *n)
+{
+    struct function *fn = ctx->function;
+    fn->numregistervariables = 0;
+    for(int i = 0; i < n->func_decl_data.numdeclarations; ++i)
+    {
+        struct ast_node *decl = n->func_decl_data.declarations[i];
+        struct ast_node *type = decl->variable_decl_data.data_type;
+        if(decl->sema.address_taken || type->type != AST_PRIMITIVE)
+            continue;
+        if(type->primitive_data.primitive_type != DT_INT && type->primitive_data.primitive_type != DT_LONG)
+            continue;
+        //keep them sorted by uses, replacing the least used one when we're full
+        int k = fn->numregistervariables;
+        if(k == NUM_SAVED_REGISTERS)
+        {
+            if(fn->register_variables[k - 1]->sema.uses >= decl->sema.uses)
+                continue;
+            --k;
+        } else
+            ++fn->numregistervariables;
+        while(k > 0 && fn->register_variables[k - 1]->sema.uses < decl->sema.uses)
+        {
+            fn->register_variables[k] = fn->register_variables[k - 1];
+            --k;
+        }
+        fn->register_variables[k] = decl;
+    }
+}
+
+//sema resolves the operand size of every expression, only type nodes are measured here
 static int data_type_operand_size(compiler_t *ctx, struct ast_node *n, int ptr)
 {
+    if(n->sema.resolved)
+        return n->sema.operand_size[ptr ? 1 : 0];
 	switch ( n->type )
 	{
-	// not a datatype, but we'll resolve it
-	case AST_IDENTIFIER:
-        return data_type_operand_size(ctx, identifier_data_node(ctx, n), ptr);
-
 	case AST_PRIMITIVE:
 		return primitive_data_type_size( n->primitive_data.primitive_type );
-        
-#ifndef MIN
-#define MIN( a, b ) ( ( a ) > ( b ) ? ( b ) : ( a ) )
-#endif
-	case AST_BIN_EXPR:
-        return MIN( data_type_operand_size(ctx, n->bin_expr_data.lhs, ptr), data_type_operand_size(ctx, n->bin_expr_data.rhs, ptr) );
-
-    case AST_LITERAL:
-        return 4;
 
 	case AST_POINTER_DATA_TYPE:
 		if ( ptr )
 			return 4;
 		if ( n->data_type_data.data_type->type == AST_POINTER_DATA_TYPE )
 			return data_type_operand_size( ctx, n->data_type_data.data_type, 1 );
-		else
-			return primitive_data_type_size(
-				n->data_type_data.data_type->primitive_data.primitive_type );
+		if ( n->data_type_data.data_type->type != AST_PRIMITIVE )
+			return sema_type_size( n->data_type_data.data_type );
+		return primitive_data_type_size( n->data_type_data.data_type->primitive_data.primitive_type );
 
 	case AST_ARRAY_DATA_TYPE:
+		//arrays of structs or arrays are strided by the laid out size of the element
+		if ( n->data_type_data.data_type->type != AST_PRIMITIVE )
+			return sema_type_size( n->data_type_data.data_type );
 		return primitive_data_type_size( n->data_type_data.data_type->primitive_data.primitive_type );
 
-    case AST_STRUCT_MEMBER_EXPR:
-    {
-		struct ast_node* idn = identifier_data_node(ctx, n->member_expr_data.object);
-        //ast_print_node_type("idn", idn);
-		assert(idn->type == AST_STRUCT_DATA_TYPE || idn->type == AST_POINTER_DATA_TYPE);
-        struct ast_node *sr = NULL;
-        if(idn->type == AST_POINTER_DATA_TYPE)
-            sr = idn->data_type_data.data_type->data_type_data.data_type;
-        else
-            sr = idn->data_type_data.data_type;
-            
-		for (int i = 0; i < sr->struct_decl_data.numfields; ++i)
-		{
-			if (!strcmp(sr->struct_decl_data.fields[i]
-							->variable_decl_data.id->identifier_data.name,
-						n->member_expr_data.property->identifier_data.name))
-			{
-				return data_type_operand_size(
-					ctx,
-					sr->struct_decl_data.fields[i]->variable_decl_data.data_type,
-					ptr);
-			}
-		}
-		abort();
-		return 0;
-	} break;
-        
-    case AST_MEMBER_EXPR:
-    {
-		assert(n->member_expr_data.object->type == AST_IDENTIFIER);
-		return data_type_operand_size(ctx, n->member_expr_data.object, 0);
-	} break;
-	case AST_WHILE_STMT:
-        return data_type_operand_size(ctx, n->while_stmt_data.test, ptr);
-    case AST_DO_WHILE_STMT:
-        return data_type_operand_size(ctx, n->do_while_stmt_data.test, ptr);
-    case AST_FOR_STMT:
-        return data_type_operand_size(ctx, n->for_stmt_data.test, ptr);
-    case AST_UNARY_EXPR:
-		if ( n->unary_expr_data.operator== '*' )
-			return data_type_operand_size( ctx, n->unary_expr_data.argument, 0 );
-		return data_type_operand_size(ctx, n->unary_expr_data.argument, ptr);
-    case AST_CAST:
-        return data_type_operand_size(ctx, n->cast_data.type, ptr);
 	case AST_DATA_TYPE:
 		return data_type_operand_size(ctx, n->data_type_data.data_type, ptr);
 	}
-	debug_printf( "unhandled data type '%s'\n", AST_NODE_TYPE_to_string( n->type ) );
+	debug_printf( "no operand size for '%s', sema didn't resolve it\n", AST_NODE_TYPE_to_string( n->type ) );
+	abort();
 	return 0;
 }
 
+//uses the field sema already looked up for this struct member expression if there is one
+static struct ast_node *struct_member_expr_info(compiler_t *ctx, struct ast_node *n, struct ast_node *sr, int *offset, int *size)
+{
+    if(n->sema.field)
+    {
+        *offset = n->sema.field_offset;
+        *size = n->sema.field_size;
+        return n->sema.field;
+    }
+    return get_struct_member_info(ctx, sr, n->member_expr_data.property->identifier_data.name, offset, size);
+}
+
 int rvalue(compiler_t *ctx, reg_t reg, struct ast_node *n);
 int lvalue(compiler_t *ctx, reg_t reg, struct ast_node *n);
-void store_operand(compiler_t *ctx, struct ast_node *n);
-static void ast_handle_assignment_expression( compiler_t* ctx, struct ast_node* n )
+
+//ebp relative, parameters are above the return address and locals below the saved ebp
+static i32 variable_displacement(struct variable *var)
 {
-    push(ctx, EBX);
-	struct ast_node* lhs = n->assignment_expr_data.lhs;
+    return var->is_param ? 4 + var->offset : -var->offset;
+}
+
+//displacement of a scalar variable that lives on the stack, 0 if n isn't one
+static int stack_variable(compiler_t *ctx, struct ast_node *n, i32 *disp)
+{
+	if ( n->type != AST_IDENTIFIER )
+		return 0;
+	struct variable *var = hash_map_find( ctx->function->variables, n->identifier_data.name );
+	if ( !var || var->is_register )
+		return 0;
+	if ( var->data_type_node->type != AST_PRIMITIVE && var->data_type_node->type != AST_POINTER_DATA_TYPE )
+		return 0;
+	*disp = variable_displacement( var );
+	return 1;
+}
+
+//stores eax to [base + index * scale + disp] with the size of what n refers to
+static void store_operand_mem(compiler_t *ctx, struct ast_node *n, reg_t base, reg_t index, int scale, i32 disp)
+{
+	int os = data_type_operand_size( ctx, n, 1 );
+	switch ( os )
+	{
+	case 4:
+		// mov [mem],eax
+		db( ctx, 0x89 );
+		break;
+    case 2:
+		// mov word ptr [mem], ax
+		db( ctx, 0x66 );
+		db( ctx, 0x89 );
+        break;
+	case 1:
+		// mov byte ptr [mem], al
+		db( ctx, 0x88 );
+		break;
+	default:
+		//TODO: FIXME throw a proper error
+		//ran into issue with
+		//void *buffer = malloc(n);
+		//where buffer[offset] = 0;
+		//resulted in a error with operand size of 0
+		//because void operand size is 0
+		//and the above doesn't make sense
+		//preferably with a node token / source line file debug information
+		debug_printf( "unhandled operand size %d for node '%s'\n", os, AST_NODE_TYPE_to_string(n->type));
+		exit( 1 );
+		break;
+	}
+	memory_operand( ctx, EAX, base, index, scale, disp );
+}
+
+void store_operand(compiler_t *ctx, struct ast_node *n);
+static void assign_register_variable(compiler_t *ctx, struct variable *var, int operator, int is_unsigned)
+{
+	reg_t r = var->reg;
+	switch ( operator )
+	{
+	case '=':
+		mov( ctx, r, EAX );
+		break;
+	case TK_PLUS_ASSIGN:
+		// add r32,eax
+		db( ctx, 0x01 );
+		db( ctx, 0xc0 + r );
+		break;
+	case TK_MINUS_ASSIGN:
+		// sub r32,eax
+		db( ctx, 0x29 );
+		db( ctx, 0xc0 + r );
+		break;
+	case TK_MULTIPLY_ASSIGN:
+		// imul r32,eax
+		db( ctx, 0x0f );
+		db( ctx, 0xaf );
+		db( ctx, 0xc0 + r * 8 );
+		break;
+	case TK_DIVIDE_ASSIGN:
+	case TK_MOD_ASSIGN:
+		mov( ctx, ECX, EAX );
+		mov( ctx, EAX, r );
+
+		extend_dividend( ctx, is_unsigned );
+
+		// idiv ecx or div ecx
+		db( ctx, 0xf7 );
+		db( ctx, is_unsigned ? 0xf1 : 0xf9 );
+
+		mov( ctx, r, operator == TK_MOD_ASSIGN ? EDX : EAX );
+		break;
+	default:
+		printf( "unhandled assignment operator\n" );
+		break;
+	}
+	mov( ctx, EAX, r );
+}
+
+static void ast_handle_assignment_expression( compiler_t* ctx, struct ast_node* n )
+{
+	struct ast_node* lhs = n->assignment_expr_data.lhs;
 	struct ast_node* rhs = n->assignment_expr_data.rhs;
 
+	int operator = n->assignment_expr_data.operator;
+	int is_unsigned = n->sema.is_unsigned;
+	struct variable *var = register_variable( ctx, lhs );
+
+	//constant multipliers and divisors are applied to the lhs directly
+	if ( rhs->type == AST_LITERAL && rhs->literal_data.type == LITERAL_INTEGER &&
+		 ( operator == TK_MULTIPLY_ASSIGN || operator == TK_DIVIDE_ASSIGN || operator == TK_MOD_ASSIGN ) )
+	{
+		rvalue( ctx, EAX, lhs );
+		if ( operator == TK_MULTIPLY_ASSIGN )
+			multiply_by_constant( ctx, EAX, rhs->literal_data.integer );
+		else
+			divide_by_constant( ctx, rhs->literal_data.integer, operator == TK_MOD_ASSIGN, is_unsigned );
+		if ( var )
+		{
+			mov( ctx, var->reg, EAX );
+			return;
+		}
+		push( ctx, EBX );
+		push( ctx, EAX );
+		lvalue( ctx, EBX, lhs );
+		pop( ctx, EAX );
+		store_operand( ctx, lhs );
+		pop( ctx, EBX );
+		return;
+	}
+
+	if ( var )
+	{
+		rvalue( ctx, EAX, rhs );
+		assign_register_variable( ctx, var, operator, is_unsigned );
+		return;
+	}
+
+	//stack variables are addressed through ebp instead of computing their address in ebx
+	i32 disp = 0;
+	reg_t base = stack_variable( ctx, lhs, &disp ) ? EBP : EBX;
+
+	//adding or subtracting a constant updates the memory in place
+	if ( rhs->type == AST_LITERAL && rhs->literal_data.type == LITERAL_INTEGER && data_type_operand_size( ctx, lhs, 1 ) == 4 &&
+		 ( operator == TK_PLUS_ASSIGN || operator == TK_MINUS_ASSIGN ) )
+	{
+		i32 imm = rhs->literal_data.integer;
+		int small = imm >= -128 && imm <= 127;
+		if ( base == EBX )
+		{
+			push( ctx, EBX );
+			lvalue( ctx, EBX, lhs );
+		}
+		// add/sub dword [mem], imm
+		db( ctx, small ? 0x83 : 0x81 );
+		memory_operand( ctx, operator == TK_PLUS_ASSIGN ? 0 : 5, base, 0, 0, disp );
+		if ( small )
+			db( ctx, imm & 0xff );
+		else
+			dd( ctx, imm );
+		if ( base == EBX )
+			pop( ctx, EBX );
+		return;
+	}
+
+	if ( base == EBP && operator == '=' )
+	{
+		rvalue( ctx, EAX, rhs );
+		store_operand_mem( ctx, lhs, EBP, 0, 0, disp );
+		return;
+	}
+
+    push(ctx, EBX);
 	rvalue( ctx, EAX, rhs );
 	// we should now have our result in eax
 
@@ -602,20 +1212,20 @@ static void ast_handle_assignment_expression( compiler_t* ctx, struct ast_node*
 
 	case TK_MOD_ASSIGN:
 	{
-		// mov esi, eax
-		db( ctx, 0x89 );
-		db( ctx, 0xc6 );
-
-		// TODO: maybe push esi, incase we trash the register
+		// keep the rhs on the stack, esi may hold a variable
+		push( ctx, EAX );
 		rvalue( ctx, EAX, lhs );
 
-		// xor edx,edx
-		db( ctx, 0x31 );
-		db( ctx, 0xd2 );
+		extend_dividend( ctx, is_unsigned );
 
-		// idiv esi
+		// idiv dword [esp] or div dword [esp]
 		db( ctx, 0xf7 );
-		db( ctx, 0xfe );
+		db( ctx, is_unsigned ? 0x34 : 0x3c );
+		db( ctx, 0x24 );
+		// add esp, 4
+		db( ctx, 0x83 );
+		db( ctx, 0xc4 );
+		db( ctx, 0x04 );
 
 		push( ctx, EDX );
 		lvalue( ctx, EBX, lhs );
@@ -629,20 +1239,20 @@ static void ast_handle_assignment_expression( compiler_t* ctx, struct ast_node*
 
 	case TK_DIVIDE_ASSIGN:
 	{
-		// mov esi, eax
-		db( ctx, 0x89 );
-		db( ctx, 0xc6 );
-
-		// TODO: maybe push esi, incase we trash the register
+		// keep the rhs on the stack, esi may hold a variable
+		push( ctx, EAX );
 		rvalue( ctx, EAX, lhs );
 
-		// xor edx,edx
-		db( ctx, 0x31 );
-		db( ctx, 0xd2 );
+		extend_dividend( ctx, is_unsigned );
 
-		// idiv esi
+		// idiv dword [esp] or div dword [esp]
 		db( ctx, 0xf7 );
-		db( ctx, 0xfe );
+		db( ctx, is_unsigned ? 0x34 : 0x3c );
+		db( ctx, 0x24 );
+		// add esp, 4
+		db( ctx, 0x83 );
+		db( ctx, 0xc4 );
+		db( ctx, 0x04 );
 
 		push( ctx, EAX );
 		lvalue( ctx, EBX, lhs );
@@ -656,20 +1266,22 @@ static void ast_handle_assignment_expression( compiler_t* ctx, struct ast_node*
 
 	case TK_MULTIPLY_ASSIGN:
 	{
-		// mov esi, eax
-		db( ctx, 0x89 );
-		db( ctx, 0xc6 );
-
-		// TODO: maybe push esi, incase we trash the register
+		// keep the rhs on the stack, esi may hold a variable
+		push( ctx, EAX );
 		rvalue( ctx, EAX, lhs );
 
 		// xor edx,edx
 		db( ctx, 0x31 );
 		db( ctx, 0xd2 );
 
-		// imul esi
+		// imul dword [esp]
 		db( ctx, 0xf7 );
-		db( ctx, 0xee );
+		db( ctx, 0x2c );
+		db( ctx, 0x24 );
+		// add esp, 4
+		db( ctx, 0x83 );
+		db( ctx, 0xc4 );
+		db( ctx, 0x04 );
 
 		push( ctx, EAX );
 		lvalue( ctx, EBX, lhs );
@@ -701,71 +1313,144 @@ static void ast_handle_assignment_expression( compiler_t* ctx, struct ast_node*
 
 void store_operand(compiler_t *ctx, struct ast_node *n)
 {
-	int os = data_type_operand_size( ctx, n, 1 );
 	// TODO: fix hardcoded EBX
-	switch ( os )
-	{
-	case 4:
-		// mov [ebx],eax
-		db( ctx, 0x89 );
-		db( ctx, 0x03 );
-		break;
-    case 2:
-		// mov word ptr [ebx], ax
-		db( ctx, 0x66 );
-		db( ctx, 0x89 );
-		db( ctx, 0x03 );
-        break;
-	case 1:
-		// mov byte ptr [ebx], al
-		db( ctx, 0x88 );
-		db( ctx, 0x03 );
-		break;
-	default:
-		//TODO: FIXME throw a proper error
-		//ran into issue with
-		//void *buffer = malloc(n);
-		//where buffer[offset] = 0;
-		//resulted in a error with operand size of 0
-		//because void operand size is 0
-		//and the above doesn't make sense
-		//preferably with a node token / source line file debug information
-		debug_printf( "unhandled operand size %d for node '%s'\n", os, AST_NODE_TYPE_to_string(n->type));
-		exit( 1 );
-		break;
-	}
+	store_operand_mem( ctx, n, EBX, 0, 0, 0 );
 }
 
-static int load_operand(compiler_t *ctx, struct ast_node *n)
+//loads what n refers to from [base + index * scale + disp]
+static int load_operand_mem(compiler_t *ctx, reg_t reg, struct ast_node *n, reg_t base, reg_t index, int scale, i32 disp)
 {
 	int os = data_type_operand_size( ctx, n, 0 );
 	switch ( os )
 	{
 	case 4:
-		// mov eax, [ebx]
+		// mov r32, [mem]
 		db( ctx, 0x8b );
-		db( ctx, 0x03 );
 		break;
     case 2:
-		// movzx eax, word [ebx]
+		// movzx r32, word [mem]
 		db( ctx, 0x0f );
 		db( ctx, 0xb7 );
-		db( ctx, 0x03 );
         break;
 	case 1:
-		// movzx eax, byte [ebx]
+		// movzx r32, byte [mem]
 		db( ctx, 0x0f );
 		db( ctx, 0xb6 );
-		db( ctx, 0x03 );
 		break;
 	default:
 		debug_printf( "unhandled regsz '%d' for load_operand \n", os );
 		exit( 1 );
 		break;
 	}
+	memory_operand( ctx, reg, base, index, scale, disp );
     return os;
 }
 
+static int load_operand_reg(compiler_t *ctx, reg_t reg, struct ast_node *n)
+{
+    return load_operand_mem(ctx, reg, n, EBX, 0, 0, 0);
+}
+
+static int load_operand(compiler_t *ctx, struct ast_node *n)
+{
+    return load_operand_reg(ctx, EAX, n);
+}
+
+//evaluates the operands of a binary expression, lhs into eax and rhs into ecx
+//the one that needs the most registers goes first, see ast_rhs_first
+static void binary_operands(compiler_t *ctx, struct ast_node *n)
+{
+    struct ast_node *lhs = n->bin_expr_data.lhs;
+    struct ast_node *rhs = n->bin_expr_data.rhs;
+
+    if(ast_is_leaf(rhs))
+    {
+        rvalue(ctx, EAX, lhs);
+        rvalue(ctx, ECX, rhs);
+        return;
+    }
+    if(ast_is_leaf(lhs))
+    {
+        rvalue(ctx, EAX, rhs);
+        mov(ctx, ECX, EAX);
+        rvalue(ctx, EAX, lhs);
+        return;
+    }
+
+    int rhs_first = ast_rhs_first(n);
+    struct ast_node *first = rhs_first ? rhs : lhs;
+    struct ast_node *second = rhs_first ? lhs : rhs;
+    rvalue(ctx, EAX, first);
+
+    //keep the first in a register if the second leaves it alone, otherwise spill it
+    reg_t tmp = ast_is_register_only(second) ? allocate_temporary(ctx) : ESP;
+    if(tmp != ESP)
+        mov(ctx, tmp, EAX);
+    else
+        push(ctx, EAX);
+    rvalue(ctx, EAX, second);
+    reg_t dst = rhs_first ? ECX : EAX;
+    if(!rhs_first)
+        mov(ctx, ECX, EAX);
+    if(tmp != ESP)
+    {
+        mov(ctx, dst, tmp);
+        free_temporary(ctx, tmp);
+    } else
+        pop(ctx, dst);
+}
+
+//condition code for the jcc of a relational or equality operator, -1 if there is none
+static int comparison_condition(int operator)
+{
+    switch(operator)
+    {
+    case TK_EQUAL: return 0x4; //e
+    case TK_NOT_EQUAL: return 0x5; //ne
+    case '<': return 0xc; //l
+    case TK_GEQUAL: return 0xd; //ge
+    case TK_LEQUAL: return 0xe; //le
+    case '>': return 0xf; //g
+    }
+    return -1;
+}
+
+//emits a jcc rel32 that is taken when the truth of test equals jump_if, returns its position so the
+//caller can patch the displacement at pos + 2. comparisons become a single cmp + jcc instead of
+//materializing a boolean and testing it
+static int condition_jump(compiler_t *ctx, struct ast_node *test, int jump_if)
+{
+    int cc = -1;
+    if(test->type == AST_UNARY_EXPR && test->unary_expr_data.operator == '!')
+        return condition_jump(ctx, test->unary_expr_data.argument, !jump_if);
+
+    if(test->type == AST_BIN_EXPR)
+        cc = comparison_condition(test->bin_expr_data.operator);
+    if(cc != -1)
+    {
+        binary_operands(ctx, test);
+        //cmp eax,ecx
+        db(ctx, 0x39);
+        db(ctx, 0xc8);
+    } else
+    {
+        rvalue(ctx, EAX, test);
+        // test eax,eax
+        db(ctx, 0x85);
+        db(ctx, 0xc0);
+        cc = 0x5; //nz
+    }
+    //the condition codes come in pairs, the low bit inverts them
+    if(!jump_if)
+        cc ^= 1;
+
+    int pos = instruction_position(ctx);
+    db(ctx, 0x0f);
+    db(ctx, 0x80 + cc);
+    dd(ctx, 0x0); // placeholder
+    return pos;
+}
+
 int rvalue(compiler_t *ctx, reg_t reg, struct ast_node *n)
 {
     //printf("rvalue node '%s'\n", AST_NODE_TYPE_to_string(n->type));
@@ -797,21 +1482,19 @@ int rvalue(compiler_t *ctx, reg_t reg, struct ast_node *n)
         if(!var)
             printf("var '%s' does not exist\n", variable_name);
 		assert( var );
-        int offset = var->is_param ? 4 + var->offset : 0xff - var->offset + 1;
+        if(var->is_register)
+        {
+            if(reg != var->reg)
+                mov(ctx, reg, var->reg);
+            break;
+        }
+        i32 offset = variable_displacement(var);
         switch(var->data_type_node->type)
 		{
         case AST_ARRAY_DATA_TYPE:
 			// lea r32,[ebp - offset]
-
-            // handles only byte size offset
-			//db( ctx, 0x8d );
-			//db( ctx, 0x45 + 8 * reg );
-			//db( ctx, offset );
-
-			// lea r32,[ebp - offset]
 			db(ctx, 0x8d);
-			db(ctx, 0x85 + 8 * reg);
-			dd(ctx, offset);
+			memory_operand(ctx, reg, EBP, 0, 0, offset);
 			break;
             
         default:
@@ -820,22 +1503,13 @@ int rvalue(compiler_t *ctx, reg_t reg, struct ast_node *n)
             switch(os)
 			{
             case 4:
-				/* // mov r32,[ebp - offset] */
-				/* db( ctx, 0x8b ); */
-				/* db( ctx, 0x45 + 8 * reg ); */
-				/* db( ctx, offset ); */
-                
 				// mov r32,[ebp - offset]
 				db(ctx, 0x8b);
-				db(ctx, 0x85 + 8 * reg);
-				dd(ctx, offset);
+				memory_operand(ctx, reg, EBP, 0, 0, offset);
 				break;
             case 2:
             case 1:
-                push(ctx,EBX);
-                lvalue(ctx,EBX,n);
-                load_operand(ctx, n);
-                pop(ctx,EBX);
+                load_operand_mem(ctx, reg, n, EBP, 0, 0, offset);
                 break;
             default:
                 perror("unhandled case for loading identifier rvalue");
@@ -853,16 +1527,7 @@ int rvalue(compiler_t *ctx, reg_t reg, struct ast_node *n)
         struct ast_node *condition = n->ternary_expr_data.condition;
         struct ast_node *alternative = n->ternary_expr_data.alternative;
 
-        process(ctx, condition);
-		// test eax,eax
-		db( ctx, 0x85 );
-		db( ctx, 0xc0 );
-
-		// jz rel32
-		int jz_pos = instruction_position( ctx ); // jmp_pos + 2 = new_pos
-		db( ctx, 0x0f );
-		db( ctx, 0x84 );
-		dd( ctx, 0x0 ); // placeholder
+        int jz_pos = condition_jump(ctx, condition, 0);
         
         process(ctx, consequent);
         
@@ -878,26 +1543,27 @@ int rvalue(compiler_t *ctx, reg_t reg, struct ast_node *n)
     {
         struct ast_node *lhs = n->bin_expr_data.lhs;
         struct ast_node *rhs = n->bin_expr_data.rhs;
+        int operator = n->bin_expr_data.operator;
+        if(operator == '*' && lhs->type == AST_LITERAL && lhs->literal_data.type == LITERAL_INTEGER)
+        {
+            lhs = rhs;
+            rhs = n->bin_expr_data.lhs;
+        }
+        //multiplying and dividing by a constant doesn't need the rhs in a register
+        if(rhs->type == AST_LITERAL && rhs->literal_data.type == LITERAL_INTEGER && (operator == '*' || operator == '/' || operator == '%'))
+        {
+            rvalue(ctx, EAX, lhs);
+            if(operator == '*')
+            {
+                multiply_by_constant(ctx, EAX, rhs->literal_data.integer);
+                break;
+            }
+            divide_by_constant(ctx, rhs->literal_data.integer, operator == '%', n->sema.is_unsigned);
+            break;
+        }
+        binary_operands(ctx, n);
 
-        rvalue(ctx, EAX, lhs);
-        
-        push( ctx, EAX );
-		rvalue( ctx, EAX, rhs );
-		// mov ecx,eax
-		db( ctx, 0x89 );
-		db( ctx, 0xc1 );
-        
-		pop( ctx, EAX );
-
-        //xor edx,edx
-        db(ctx, 0x31);
-        db(ctx, 0xd2);
-
-        //xor edx,edx
-        //db(ctx, 0x31);
-        //db(ctx, 0xd2);
-
-        switch(n->bin_expr_data.operator)
+        switch(operator)
         {
         case '*':
             //imul ecx
@@ -905,9 +1571,10 @@ int rvalue(compiler_t *ctx, reg_t reg, struct ast_node *n)
             db(ctx, 0xe9);
             break;
         case '/':
-            //idiv ecx
+            extend_dividend(ctx, n->sema.is_unsigned);
+            //idiv ecx or div ecx
             db(ctx, 0xf7);
-            db(ctx, 0xf9);
+            db(ctx, n->sema.is_unsigned ? 0xf1 : 0xf9);
             break;
 
         case '+':
@@ -936,168 +1603,39 @@ int rvalue(compiler_t *ctx, reg_t reg, struct ast_node *n)
             db(ctx, 0xf0);
             break;
         case TK_RSHIFT:
+            //sar eax,cl or shr eax,cl
             db(ctx, 0xd3);
-            db(ctx, 0xf8);
+            db(ctx, n->sema.is_unsigned ? 0xe8 : 0xf8);
             break;
         case '%':
+            extend_dividend(ctx, n->sema.is_unsigned);
+            //idiv ecx or div ecx
             db(ctx, 0xf7);
-            db(ctx, 0xf9);
+            db(ctx, n->sema.is_unsigned ? 0xf1 : 0xf9);
+            //mov eax,edx
             db(ctx, 0x89);
             db(ctx, 0xd0);
             break;
 
         case TK_GEQUAL:
-            //cmp eax,ecx
-            db(ctx, 0x39);
-            db(ctx, 0xc8);
-            
-            //jl <relative offset>
-            db(ctx, 0x7c);
-            db(ctx, 0x5);
-            
-            //xor eax,eax
-            db(ctx, 0x31);
-            db(ctx, 0xc0);
-            
-            //inc eax
-            db(ctx, 0x40);
-            
-            //jmp
-            db(ctx, 0xeb);
-            db(ctx, 0x02);
-            
-            //xor eax,eax
-            db(ctx, 0x31);
-            db(ctx, 0xc0);
-            
-            break;
-            
         case TK_LEQUAL:
-            //cmp eax,ecx
-            db(ctx, 0x39);
-            db(ctx, 0xc8);
-            
-            //jg <relative offset>
-            db(ctx, 0x7f);
-            db(ctx, 0x5);
-            
-            //xor eax,eax
-            db(ctx, 0x31);
-            db(ctx, 0xc0);
-            
-            //inc eax
-            db(ctx, 0x40);
-            
-            //jmp
-            db(ctx, 0xeb);
-            db(ctx, 0x02);
-            
-            //xor eax,eax
-            db(ctx, 0x31);
-            db(ctx, 0xc0);
-            
-            break;
-            
         case '>':
+        case '<':
+        case TK_EQUAL:
+        case TK_NOT_EQUAL:
             //cmp eax,ecx
             db(ctx, 0x39);
             db(ctx, 0xc8);
-            
-            //jle <relative offset>
-            db(ctx, 0x7e);
-            db(ctx, 0x5);
-            
-            //xor eax,eax
-            db(ctx, 0x31);
+
+            //setcc al
+            db(ctx, 0x0f);
+            db(ctx, 0x90 + comparison_condition(n->bin_expr_data.operator));
             db(ctx, 0xc0);
-            
-            //inc eax
-            db(ctx, 0x40);
-            
-            //jmp
-            db(ctx, 0xeb);
-            db(ctx, 0x02);
-            
-            //xor eax,eax
-            db(ctx, 0x31);
+
+            //movzx eax,al
+            db(ctx, 0x0f);
+            db(ctx, 0xb6);
             db(ctx, 0xc0);
-            
-            break;
-            
-        case '<':
-            //cmp eax,ecx
-            db(ctx, 0x39);
-            db(ctx, 0xc8);
-            
-            //jge <relative offset>
-            db(ctx, 0x7d);
-            db(ctx, 0x5);
-            
-            //xor eax,eax
-            db(ctx, 0x31);
-            db(ctx, 0xc0);
-            
-            //inc eax
-            db(ctx, 0x40);
-            
-            //jmp
-            db(ctx, 0xeb);
-            db(ctx, 0x02);
-            
-            //xor eax,eax
-            db(ctx, 0x31);
-            db(ctx, 0xc0);
-            
-            break;
-            
-        case TK_EQUAL:
-            //cmp eax,ecx
-            db(ctx, 0x39);
-            db(ctx, 0xc8);
-            
-            //jne <relative offset>
-            db(ctx, 0x75);
-            db(ctx, 0x5);
-            
-            //xor eax,eax
-            db(ctx, 0x31);
-            db(ctx, 0xc0);
-            
-            //inc eax
-            db(ctx, 0x40);
-            
-            //jmp
-            db(ctx, 0xeb);
-            db(ctx, 0x02);
-            
-            //xor eax,eax
-            db(ctx, 0x31);
-            db(ctx, 0xc0);            
-            break;
-            
-        case TK_NOT_EQUAL:
-            //cmp eax,ecx
-            db(ctx, 0x39);
-            db(ctx, 0xc8);
-            
-            //je <relative offset>
-            db(ctx, 0x74);
-            db(ctx, 0x5);
-            
-            //xor eax,eax
-            db(ctx, 0x31);
-            db(ctx, 0xc0);
-            
-            //inc eax
-            db(ctx, 0x40);
-            
-            //jmp
-            db(ctx, 0xeb);
-            db(ctx, 0x02);
-            
-            //xor eax,eax
-            db(ctx, 0x31);
-            db(ctx, 0xc0);            
             break;
 
         default:
@@ -1131,11 +1669,8 @@ int rvalue(compiler_t *ctx, reg_t reg, struct ast_node *n)
 			sz = data_type_size(ctx,n->data_type_data.data_type);
 			break;
 		case AST_IDENTIFIER:
-		{
-            struct variable *var = hash_map_find(ctx->function->variables, n->sizeof_data.subject->identifier_data.name);
-			assert( var );
-			sz = data_type_size( ctx, var->data_type_node );
-		}
+			sz = data_type_size( ctx, n->sizeof_data.subject );
+			break;
 		break;
 		default:
             debug_printf("unhandled sizeof '%s'\n", AST_NODE_TYPE_to_string(n->sizeof_data.subject->type));
@@ -1173,16 +1708,10 @@ int rvalue(compiler_t *ctx, reg_t reg, struct ast_node *n)
 
 		assert(n->member_expr_data.property->type == AST_IDENTIFIER);
 		int off, sz;
-		struct ast_node *field = get_struct_member_info(ctx, &sr->struct_decl_data, n->member_expr_data.property->identifier_data.name, &off,
-							   &sz);
+		struct ast_node *field = struct_member_expr_info(ctx, n, sr, &off, &sz);
 		assert(sz > 0);
 
-		// add ebx, imm32
-		db(ctx, 0x81);
-		db(ctx, 0xc3);
-		dd(ctx, off);
-
-		load_operand(ctx, field->variable_decl_data.data_type);
+		load_operand_mem(ctx, EAX, field->variable_decl_data.data_type, EBX, 0, 0, off);
         pop(ctx, EBX);
 	} break;    
 
@@ -1207,21 +1736,15 @@ int rvalue(compiler_t *ctx, reg_t reg, struct ast_node *n)
         rvalue( ctx, reg, n->member_expr_data.property );
         
 		int os = data_type_operand_size( ctx, object, 0 );
-
-		push( ctx, ESI );
-        
-		// mov esi, imm32
-		db( ctx, 0xbe );
-		dd( ctx, os );
-        
-		// imul esi
-		db( ctx, 0xf7 );
-		db( ctx, 0xee );
-        
-		pop( ctx, ESI );
-        
-        add( ctx, EBX, reg );
-        load_operand(ctx, dn);
+		//element sizes of 1, 2, 4 and 8 are the scale of the index in the memory operand
+		if ( os == 1 || os == 2 || os == 4 || os == 8 )
+			load_operand_mem( ctx, reg, dn, EBX, reg, os, 0 );
+		else
+		{
+			multiply_by_constant( ctx, reg, os );
+			add( ctx, EBX, reg );
+			load_operand_reg( ctx, reg, dn );
+		}
         pop(ctx, EBX);
 	} break;
     
@@ -1332,6 +1855,18 @@ int rvalue(compiler_t *ctx, reg_t reg, struct ast_node *n)
 			} break;
 
             case TK_PLUS_PLUS:
+			{
+				struct variable *var = register_variable( ctx, n->unary_expr_data.argument );
+				if ( var )
+				{
+					if ( n->unary_expr_data.prefix )
+						inc( ctx, var->reg );
+					mov( ctx, EAX, var->reg );
+					if ( !n->unary_expr_data.prefix )
+						inc( ctx, var->reg );
+					break;
+				}
+			}
 				// handle generic ++ case
 				push( ctx, EBX );
 				lvalue( ctx, EBX, n->unary_expr_data.argument );
@@ -1373,10 +1908,9 @@ int rvalue(compiler_t *ctx, reg_t reg, struct ast_node *n)
                 rvalue(ctx, EAX, arg);
                 if(n->unary_expr_data.operator=='!')
                 {
-                    //cmp eax, 0
-                    db(ctx, 0x83);
-                    db(ctx, 0xf8);
-                    db(ctx, 0x00);
+                    //test eax,eax
+                    db(ctx, 0x85);
+                    db(ctx, 0xc0);
                     
                     //sete al
                     db(ctx, 0x0f);
@@ -1456,19 +1990,19 @@ int rvalue(compiler_t *ctx, reg_t reg, struct ast_node *n)
     return 0;
 }
 
-struct ast_node *get_struct_member_info(compiler_t* ctx, struct ast_struct_decl *decl, const char *member_name, int *offset, int *size)
+struct ast_node *get_struct_member_info(compiler_t* ctx, struct ast_node *decl, const char *member_name, int *offset, int *size)
 {
-    int total_offset = 0;
-    for(int i = 0; i < decl->numfields; ++i)
+    if(struct_layout(decl))
+        return NULL;
+    struct ast_struct_decl *sd = &decl->struct_decl_data;
+    for(int i = 0; i < sd->numfields; ++i)
 	{
-        int sz = data_type_operand_size(ctx, decl->fields[i]->variable_decl_data.data_type, 1);
-		if (!strcmp(decl->fields[i]->variable_decl_data.id->identifier_data.name, member_name))
+		if (!strcmp(sd->fields[i]->variable_decl_data.id->identifier_data.name, member_name))
 		{
-            *offset = total_offset;
-            *size = sz;
-            return decl->fields[i];
+            *offset = sd->offsets[i];
+            *size = data_type_size(ctx, sd->fields[i]->variable_decl_data.data_type);
+            return sd->fields[i];
 		}
-        total_offset += sz;
 	}
     return NULL;
 }
@@ -1483,18 +2017,15 @@ int lvalue( compiler_t* ctx, reg_t reg, struct ast_node* n )
 		const char* variable_name = n->identifier_data.name;
 		struct variable* var = hash_map_find( ctx->function->variables, variable_name );
 		assert( var );
+		if ( var->is_register )
+		{
+			debug_printf( "variable '%s' is kept in a register and has no address\n", variable_name );
+			abort();
+		}
         struct ast_node *variable_type = var->data_type_node;
-        int offset = var->is_param ? 4 + var->offset : 0xff - var->offset + 1;
-        
-		/* // lea r32,[ebp - offset] */
-		/* db( ctx, 0x8d ); */
-		/* db( ctx, 0x45 + 8 * reg ); */
-		/* db( ctx, offset ); */
-        
 		// lea r32,[ebp - offset]
 		db(ctx, 0x8d);
-		db(ctx, 0x85 + 8 * reg);
-		dd(ctx, offset);
+		memory_operand(ctx, reg, EBP, 0, 0, variable_displacement(var));
 	} break;
     
 	case AST_STRUCT_MEMBER_EXPR:
@@ -1534,165 +2065,1494 @@ int lvalue( compiler_t* ctx, reg_t reg, struct ast_node* n )
 				+ 4
 			*/
 
-		}
-		struct ast_node* dn = identifier_data_node(ctx, object);
-        switch(dn->type)
-		{
-		case AST_POINTER_DATA_TYPE:
-		case AST_STRUCT_DATA_TYPE:
-		{
-			struct ast_node* sr = NULL;
-			if (dn->type == AST_POINTER_DATA_TYPE)
-				sr = dn->data_type_data.data_type->data_type_data.data_type;
-			else
-				sr = dn->data_type_data.data_type;
+		}
+		struct ast_node* dn = identifier_data_node(ctx, object);
+        switch(dn->type)
+		{
+		case AST_POINTER_DATA_TYPE:
+		case AST_STRUCT_DATA_TYPE:
+		{
+			struct ast_node* sr = NULL;
+			if (dn->type == AST_POINTER_DATA_TYPE)
+				sr = dn->data_type_data.data_type->data_type_data.data_type;
+			else
+				sr = dn->data_type_data.data_type;
+
+			assert(n->member_expr_data.property->type == AST_IDENTIFIER);
+			int off, sz;
+			struct ast_node *field = struct_member_expr_info(ctx, n, sr, &off, &sz);
+			assert(field);
+			assert(sz > 0);
+			// printf("offset = %d, sz = %d for '%s'\n", off, sz, n->member_expr_data.property->identifier_data.name);
+
+			push(ctx, EAX);
+			if (dn->type == AST_POINTER_DATA_TYPE)
+			{
+                //should be good to go for identifiers, most of the rvalue values are still hardcoded to EAX though...
+                assert(object->type == AST_IDENTIFIER);
+				rvalue(ctx, reg, object);
+			}
+			else
+				lvalue(ctx, reg, object);
+
+			if (off)
+			{
+				// lea r32, [r32 + off]
+				db(ctx, 0x8d);
+				memory_operand(ctx, reg, reg, 0, 0, off);
+			}
+
+			pop(ctx, EAX);
+		}
+		break;
+		}
+	}
+	break;
+
+	case AST_MEMBER_EXPR:
+	{
+		// TODO: FIXME for multidimensional arrays
+		struct ast_node* object = n->member_expr_data.object;
+		struct ast_node* dn = identifier_data_node( ctx, object );
+
+        switch(dn->type)
+		{
+		case AST_ARRAY_DATA_TYPE:
+		case AST_POINTER_DATA_TYPE: //only when it's a pointer to an primtive array type e.g const char * or int *
+			push(ctx, EAX);
+			if (dn->type == AST_POINTER_DATA_TYPE)
+			{
+                //should be good to go for identifiers, most of the rvalue values are still hardcoded to EAX though...
+                assert(object->type == AST_IDENTIFIER);
+				rvalue(ctx, reg, object);
+			}
+			else
+				lvalue(ctx, reg, object);
+			rvalue(ctx, EAX, n->member_expr_data.property);
+
+			int os = data_type_operand_size(ctx, object, 0);
+			if (os == 1 || os == 2 || os == 4 || os == 8)
+			{
+				// lea r32, [r32 + eax * os]
+				db(ctx, 0x8d);
+				memory_operand(ctx, reg, reg, EAX, os, 0);
+			} else
+			{
+				multiply_by_constant(ctx, EAX, os);
+				add(ctx, reg, EAX);
+			}
+			pop(ctx, EAX);
+
+			break;
+        default:
+            debug_printf("unhandled member expr case '%s'\n", AST_NODE_TYPE_to_string(dn->type));
+            abort();
+            break;
+		}
+
+	} break;
+
+	case AST_UNARY_EXPR:
+	{
+		//printf( "operator = %s\n", token_type_to_string( n->unary_expr_data.operator) );
+		switch ( n->unary_expr_data.operator)
+		{
+		case '*':
+			lvalue( ctx, reg, n->unary_expr_data.argument );
+			// mov ebx, [ebx]
+			db( ctx, 0x8b );
+			db( ctx, 0x1b );
+			break;
+
+		default:
+			debug_printf( "unhandled unary lvalue '%s'\n", AST_NODE_TYPE_to_string( n->type ) );
+			return 1;
+		}
+	}
+	break;
+    
+	case AST_CAST:
+	{
+        lvalue(ctx, reg, n->cast_data.expr);
+        struct ast_node *from_type = n->cast_data.expr;
+        struct ast_node *to_type = n->cast_data.type;
+        switch(from_type->type)
+		{
+        case AST_IDENTIFIER:
+		{
+            struct ast_node *ident_node = identifier_data_node(ctx, n->cast_data.expr);
+            switch(ident_node->type)
+			{
+			default:
+                //pointers of different sizes will be handled in e.g data_type_size
+                if(ident_node->type != to_type->type)
+				{
+					printf( "lvalue: cannot cast identifier type '%s' to '%s'\n",
+							AST_NODE_TYPE_to_string( ident_node->type ), AST_NODE_TYPE_to_string( to_type->type ) );
+					exit( -1 );
+				}
+				break;
+			}
+		} break;
+
+		default:
+            if(from_type->type != to_type->type)
+			{
+				printf( "lvalue: cannot cast '%s' to '%s'\n", AST_NODE_TYPE_to_string( from_type->type ),
+						AST_NODE_TYPE_to_string( to_type->type ) );
+				exit( -1 );
+			}
+			break;
+		}
+	} break;
+
+	default:
+        debug_printf("unhandled lvalue '%s'\n", AST_NODE_TYPE_to_string(n->type));
+        return 1;
+	}
+    return 0;
+}
+
+//machine code for functions lowered to the ir (ir.c), used from -O1
+//virtual registers live in ebx, esi and edi or are spilled below the local variables, eax, ecx and edx are scratch registers
+//with -fomit-frame-pointer the frame is addressed off esp and ebp holds virtual registers as well
+static const reg_t ir_registers[] = { EBX, ESI, EDI, EBP };
+#define NUM_IR_REGISTERS (sizeof(ir_registers) / sizeof(ir_registers[0]))
+
+struct ir_backend
+{
+    struct ir_function *fn;
+    int *location; //see ir_allocate_registers
+    int *uses; //number of times each virtual register is read
+    int *slot_disp; //ebp relative, see ir_frame_rm
+    int spill_disp;
+    int framesize;
+    int frame_pointer;
+    int pushed; //bytes pushed since the prologue, for addressing the frame off esp
+    int *block_pushed; //the same at the start of every block
+    int numregparms; //parameters that come in parameter_registers
+    int *slot_register; //the register of a parameter that's only copied into its variable, it gets no slot, or -1
+    int numsaved;
+    reg_t saved[NUM_IR_REGISTERS];
+    int *block_offsets;
+    int *jump_from, *jump_block; //rel32 operands that are patched once the blocks are placed, block -1 is the epilogue
+    int numjumps;
+    int tail_calls; //calls that return their result can jump to the function, nothing points into the frame
+};
+
+//register or memory operand of an instruction, memory is [reg + index * scale + disp]
+struct ir_rm
+{
+    int isreg;
+    reg_t reg;
+    int disp;
+    reg_t index;
+    int scale; //0 without an index
+};
+
+static struct x86_operand ir_x86_operand(struct ir_rm rm)
+{
+    if (rm.isreg)
+        return x86_reg(rm.reg);
+    return x86_mem(rm.reg, rm.index, rm.scale, rm.disp);
+}
+
+static struct ir_rm ir_register_rm(reg_t reg)
+{
+    struct ir_rm rm = { .isreg = 1, .reg = reg };
+    return rm;
+}
+
+//memory in the frame at a displacement from ebp, without a frame pointer it's where ebp would point to if it had
+//been pushed, except that the parameters are right above the return address
+static struct ir_rm ir_frame_rm(struct ir_backend *B, int disp)
+{
+    struct ir_rm rm = { .isreg = 0, .reg = EBP, .disp = disp };
+    if (B->frame_pointer)
+        return rm;
+    rm.reg = ESP;
+    rm.disp = (disp > 0 ? disp - 4 : disp) + B->framesize + B->numsaved * 4 + B->pushed;
+    return rm;
+}
+
+static struct ir_rm ir_vreg_rm(struct ir_backend *B, int v)
+{
+    int loc = B->location[v];
+    if (loc >= 0)
+        return ir_register_rm(ir_registers[loc]);
+    return ir_frame_rm(B, B->spill_disp - (-1 - loc) * 4);
+}
+
+static struct ir_rm ir_slot_rm(struct ir_backend *B, int slot)
+{
+    return ir_frame_rm(B, B->slot_disp[slot]);
+}
+
+//the machine register an operand is in, if it's in one
+static bool ir_operand_register(struct ir_backend *B, struct ir_operand o, reg_t *reg)
+{
+    if (o.kind != IR_VREG || B->location[o.value] < 0)
+        return false;
+    *reg = ir_registers[B->location[o.value]];
+    return true;
+}
+
+static void ir_load(compiler_t *ctx, struct ir_backend *B, reg_t reg, struct ir_operand o)
+{
+    switch (o.kind)
+    {
+    case IR_IMM:
+        if (o.value == 0)
+            emit(ctx, X86_XOR, x86_reg(reg), x86_reg(reg));
+        else
+            mov_r_imm32(ctx, reg, o.value);
+        break;
+    case IR_SLOT:
+        emit(ctx, X86_LEA, x86_reg(reg), ir_x86_operand(ir_slot_rm(B, o.value)));
+        break;
+    case IR_VREG:
+    {
+        struct ir_rm rm = ir_vreg_rm(B, o.value);
+        if (rm.isreg && rm.reg == reg)
+            break;
+        emit(ctx, X86_MOV, x86_reg(reg), ir_x86_operand(rm));
+    } break;
+    }
+}
+
+static void ir_store(compiler_t *ctx, struct ir_backend *B, int dst, reg_t reg)
+{
+    struct ir_rm rm = ir_vreg_rm(B, dst);
+    if (rm.isreg && rm.reg == reg)
+        return;
+    emit(ctx, X86_MOV, ir_x86_operand(rm), x86_reg(reg));
+}
+
+//register to compute the result in, the one of the destination unless the second operand is in it
+static reg_t ir_result_register(struct ir_backend *B, struct ir_instr *in)
+{
+    struct ir_rm rm = ir_vreg_rm(B, in->dst);
+    reg_t b;
+    if (!rm.isreg || (ir_operand_register(B, in->b, &b) && b == rm.reg))
+        return EAX;
+    return rm.reg;
+}
+
+//add, or, and, sub, xor or cmp of a register and an operand
+static void ir_alu(compiler_t *ctx, struct ir_backend *B, int mnemonic, reg_t reg, struct ir_operand o)
+{
+    switch (o.kind)
+    {
+    case IR_IMM:
+        emit(ctx, mnemonic, x86_reg(reg), x86_imm(o.value));
+        break;
+    case IR_SLOT:
+        ir_load(ctx, B, ECX, o);
+        emit(ctx, mnemonic, x86_reg(reg), x86_reg(ECX));
+        break;
+    case IR_VREG:
+        emit(ctx, mnemonic, x86_reg(reg), ir_x86_operand(ir_vreg_rm(B, o.value)));
+        break;
+    }
+}
+
+//the alu instruction of an ir operation
+static int ir_alu_mnemonic(int op)
+{
+    static const int mnemonics[IR_OP_MAX] = { [IR_ADD] = X86_ADD, [IR_SUB] = X86_SUB, [IR_AND] = X86_AND, [IR_OR] = X86_OR, [IR_XOR] = X86_XOR };
+    return mnemonics[op];
+}
+
+//address of a load or store, base + index * scale + disp where scale is 0 without an index
+struct ir_address_mode
+{
+    struct ir_operand base, index;
+    int scale;
+    int disp;
+};
+
+//memory operand for an address, a base that isn't in a register is loaded into ecx and an index into eax
+static struct ir_rm ir_address(compiler_t *ctx, struct ir_backend *B, struct ir_address_mode *m)
+{
+    struct ir_rm rm = { .isreg = 0, .reg = ECX, .disp = m->disp, .scale = m->scale };
+    if (m->base.kind == IR_SLOT)
+    {
+        struct ir_rm slot = ir_slot_rm(B, m->base.value);
+        rm.reg = slot.reg;
+        rm.disp += slot.disp;
+    } else if (!ir_operand_register(B, m->base, &rm.reg))
+        ir_load(ctx, B, ECX, m->base);
+    if (m->scale && !ir_operand_register(B, m->index, &rm.index))
+    {
+        rm.index = EAX;
+        ir_load(ctx, B, EAX, m->index);
+    }
+    return rm;
+}
+
+//the address arithmetic at instruction j, an add of a base and a displacement or an index that may be scaled by the
+//mul or shl before it, returns the number of instructions it takes up and the virtual register they compute
+static int ir_match_address(struct ir_backend *B, struct ir_block *b, int j, struct ir_address_mode *m, int *address)
+{
+    struct ir_instr *in = &b->instrs[j];
+    struct ir_instr *scaled = NULL;
+    memset(m, 0, sizeof(*m));
+    if ((in->op == IR_MUL || in->op == IR_SHL) && in->a.kind == IR_VREG && in->b.kind == IR_IMM && B->uses[in->dst] == 1 &&
+        j + 1 < b->numinstrs)
+    {
+        int scale = in->b.value;
+        if (in->op == IR_SHL)
+            scale = in->b.value >= 0 && in->b.value <= 3 ? 1 << in->b.value : 0;
+        if (scale == 1 || scale == 2 || scale == 4 || scale == 8)
+        {
+            scaled = in;
+            m->index = in->a;
+            m->scale = scale;
+            in = &b->instrs[j + 1];
+        }
+    }
+    if (in->op != IR_ADD)
+        return 0;
+    struct ir_operand x = in->a, y = in->b;
+    //the base goes first, slots are always the base
+    if (scaled ? x.kind == IR_VREG && x.value == scaled->dst : x.kind == IR_IMM || y.kind == IR_SLOT)
+    {
+        x = in->b;
+        y = in->a;
+    }
+    if (x.kind != IR_VREG && x.kind != IR_SLOT)
+        return 0;
+    m->base = x;
+    if (scaled)
+    {
+        if (y.kind != IR_VREG || y.value != scaled->dst)
+            return 0;
+    } else if (y.kind == IR_IMM)
+        m->disp = y.value;
+    else if (y.kind == IR_VREG)
+    {
+        m->index = y;
+        m->scale = 1;
+    } else
+        return 0;
+    *address = in->dst;
+    return scaled ? 2 : 1;
+}
+
+//condition codes of jcc and setcc
+static int ir_condition_code(int op)
+{
+    switch (op)
+    {
+    case IR_EQ: return 0x4;
+    case IR_NE: return 0x5;
+    case IR_LT: return 0xc;
+    case IR_GE: return 0xd;
+    case IR_LE: return 0xe;
+    case IR_GT: return 0xf;
+    }
+    return -1;
+}
+
+static void ir_jump(compiler_t *ctx, struct ir_backend *B, int block)
+{
+    //jmp rel32
+    db(ctx, 0xe9);
+    B->jump_from[B->numjumps] = instruction_position(ctx);
+    B->jump_block[B->numjumps++] = block;
+    dd(ctx, 0);
+}
+
+static void ir_branch(compiler_t *ctx, struct ir_backend *B, int cc, int t, int f, int next)
+{
+    if (t == next)
+    {
+        t = f;
+        f = next;
+        cc ^= 1;
+    }
+    //jcc rel32
+    db(ctx, 0x0f);
+    db(ctx, 0x80 + cc);
+    B->jump_from[B->numjumps] = instruction_position(ctx);
+    B->jump_block[B->numjumps++] = t;
+    dd(ctx, 0);
+    if (f != next)
+        ir_jump(ctx, B, f);
+}
+
+//cmp a, b with a in a register
+static void ir_compare(compiler_t *ctx, struct ir_backend *B, struct ir_instr *in)
+{
+    reg_t a;
+    if (!ir_operand_register(B, in->a, &a))
+    {
+        a = EAX;
+        ir_load(ctx, B, EAX, in->a);
+    }
+    ir_alu(ctx, B, X86_CMP, a, in->b);
+}
+
+static const reg_t syscall_registers[] = { EAX, EBX, ECX, EDX, ESI, EDI };
+
+//arguments right before a call that takes them in registers are loaded straight into them, returns how many of the
+//last ones are. a syscall has them all there or none, a call to a function with register parameters the first ones
+static int ir_register_arguments(compiler_t *ctx, struct ir_block *b, int call)
+{
+    struct ir_instr *in = &b->instrs[call];
+    struct function *fn;
+    struct dynlib_sym *sym;
+    if (in->op != IR_CALL)
+        return 0;
+    if (strcmp(in->str, "syscall"))
+    {
+        if (identify_function_call_type(ctx, in->str, &fn, &sym) != FUNCTION_CALL_NORMAL)
+            return 0;
+        int numregs = call_register_arguments(ctx, fn, in->imm);
+        int n = 0;
+        while (n < numregs && n < call && b->instrs[call - 1 - n].op == IR_ARG)
+            ++n;
+        return n;
+    }
+    if (in->imm < 1 || in->imm > COUNT_OF(syscall_registers) ||
+        call < in->imm || (ctx->build_target != BT_LINUX && ctx->build_target != BT_OPCODES))
+        return 0;
+    for (int i = call - in->imm; i < call; ++i)
+        if (b->instrs[i].op != IR_ARG)
+            return 0;
+    return in->imm;
+}
+
+//the argument at index j isn't pushed when it's one of those
+static int ir_register_argument(compiler_t *ctx, struct ir_block *b, int j)
+{
+    int k = j;
+    while (k < b->numinstrs && b->instrs[k].op == IR_ARG)
+        ++k;
+    return k < b->numinstrs && j >= k - ir_register_arguments(ctx, b, k);
+}
+
+//the number of arguments of the call at index j that were pushed
+static int ir_pushed_arguments(compiler_t *ctx, struct ir_block *b, int j)
+{
+    return b->instrs[j].imm - ir_register_arguments(ctx, b, j);
+}
+
+//int 0x80 with the arguments loaded from wherever they are, the first argument is pushed last so it's right before the call
+//registers that hold virtual registers are saved first, an argument in one that was overwritten already is read from the copy
+static void ir_syscall(compiler_t *ctx, struct ir_backend *B, struct ir_instr *in)
+{
+    int numargs = in->imm;
+    reg_t saved[COUNT_OF(syscall_registers)];
+    int numsaved = 0;
+    for (int i = 0; i < numargs; ++i)
+    {
+        reg_t r = syscall_registers[i];
+        if (r == EBX || r == ESI || r == EDI)
+        {
+            push(ctx, r);
+            saved[numsaved++] = r;
+            B->pushed += 4;
+        }
+    }
+    for (int i = 0; i < numargs; ++i)
+    {
+        struct ir_operand o = in[-1 - i].a;
+        reg_t src;
+        int copy = -1;
+        if (ir_operand_register(B, o, &src))
+        {
+            for (int m = 0; m < i; ++m)
+                if (syscall_registers[m] == src)
+                    for (int k = 0; k < numsaved; ++k)
+                        if (saved[k] == src)
+                            copy = k;
+        }
+        if (copy != -1)
+            emit(ctx, X86_MOV, x86_reg(syscall_registers[i]), x86_mem(ESP, 0, 0, (numsaved - 1 - copy) * 4));
+        else
+            ir_load(ctx, B, syscall_registers[i], o);
+    }
+    db(ctx, 0xcd); //int 0x80
+    db(ctx, 0x80);
+    for (int i = numsaved - 1; i >= 0; --i)
+        pop(ctx, saved[i]);
+    B->pushed -= numsaved * 4;
+}
+
+static void ir_epilogue(compiler_t *ctx, struct ir_backend *B)
+{
+    if (!B->frame_pointer)
+    {
+        for (int i = B->numsaved - 1; i >= 0; --i)
+            pop(ctx, B->saved[i]);
+        if (B->framesize > 0)
+            emit(ctx, X86_ADD, x86_reg(ESP), x86_imm(B->framesize));
+        return;
+    }
+    if (B->numsaved > 0)
+    {
+        //lea esp,[ebp - framesize - saved registers]
+        emit(ctx, X86_LEA, x86_reg(ESP), x86_mem(EBP, 0, 0, -(B->framesize + B->numsaved * 4)));
+        for (int i = B->numsaved - 1; i >= 0; --i)
+            pop(ctx, B->saved[i]);
+    }
+    //mov esp,ebp
+    //pop ebp
+    emit(ctx, X86_MOV, x86_reg(ESP), x86_reg(EBP));
+    emit_one(ctx, X86_POP, x86_reg(EBP));
+}
+
+//the arguments of a call to fn that go in registers, the ones that weren't pushed are loaded from where they are
+//and the pushed ones are popped, they're on top of the rest
+static void ir_load_register_arguments(compiler_t *ctx, struct ir_backend *B, struct ir_block *b, struct ir_instr *in, struct function *fn)
+{
+    int numregs = call_register_arguments(ctx, fn, in->imm);
+    int direct = ir_register_arguments(ctx, b, in - b->instrs);
+    for (int i = 0; i < direct; ++i)
+        ir_load(ctx, B, parameter_registers[i], in[-1 - i].a);
+    for (int i = direct; i < numregs; ++i)
+        pop(ctx, parameter_registers[i]);
+}
+
+//a call whose result is returned right away reuses the frame of the caller: the arguments are popped over the
+//caller's own, the frame is left and the function is jumped to. it returns to our caller, which removes the
+//arguments it pushed itself, so only calls with no more arguments on the stack than that
+static int ir_tail_call(compiler_t *ctx, struct ir_backend *B, struct ir_block *b, struct ir_instr *in)
+{
+    struct function *fn;
+    struct dynlib_sym *sym;
+    int numargs = in->imm;
+    if (!B->tail_calls || !ir_returns_call(B->fn, b, in - b->instrs) ||
+        identify_function_call_type(ctx, in->str, &fn, &sym) != FUNCTION_CALL_NORMAL)
+        return 0;
+    int numregs = call_register_arguments(ctx, fn, numargs);
+    if (numargs - numregs > B->fn->decl->func_decl_data.numparms - B->numregparms)
+        return 0;
+    //the stack arguments are popped through a register that doesn't hold one of the others
+    if (numregs == COUNT_OF(parameter_registers) && numargs > numregs)
+        return 0;
+    reg_t scratch = numregs == 0 ? EAX : ECX;
+    int direct = ir_register_arguments(ctx, b, in - b->instrs);
+    for (int i = 0; i < direct; ++i)
+        ir_load(ctx, B, parameter_registers[i], in[-1 - i].a);
+    for (int i = direct; i < numargs; ++i)
+    {
+        if (i < numregs)
+        {
+            pop(ctx, parameter_registers[i]);
+            B->pushed -= 4;
+            continue;
+        }
+        pop(ctx, scratch);
+        B->pushed -= 4;
+        emit(ctx, X86_MOV, ir_x86_operand(ir_frame_rm(B, 8 + (i - numregs) * 4)), x86_reg(scratch));
+    }
+    ir_epilogue(ctx, B);
+    jump_function(ctx, fn);
+    return 1;
+}
+
+static void ir_call(compiler_t *ctx, struct ir_backend *B, struct ir_block *b, struct ir_instr *in)
+{
+    struct function *fn;
+    struct dynlib_sym *sym;
+    int numargs = in->imm;
+    switch (identify_function_call_type(ctx, in->str, &fn, &sym))
+    {
+    default:
+        printf("invalid function call to '%s'\n", in->str);
+        db(ctx, 0xcc);
+        db(ctx, 0xcc);
+        db(ctx, 0xcc);
+        break;
+
+    case FUNCTION_CALL_IMPORT:
+        call_import(ctx, sym, numargs);
+        break;
+
+    case FUNCTION_CALL_NORMAL:
+        ir_load_register_arguments(ctx, B, b, in, fn);
+        call_function(ctx, fn, numargs - call_register_arguments(ctx, fn, numargs));
+        break;
+
+    case FUNCTION_CALL_INT3:
+        if (opt_flags & OPT_DEBUG)
+            db(ctx, 0xcc); //int3
+        if (numargs > 0)
+        {
+            // add esp, 4
+            db(ctx, 0x83);
+            db(ctx, 0xc4);
+            db(ctx, numargs * 4);
+        }
+        break;
+
+    case FUNCTION_CALL_SYSCALL:
+    {
+        assert(numargs > 0);
+        if (ir_register_arguments(ctx, b, in - b->instrs))
+        {
+            ir_syscall(ctx, B, in);
+            break;
+        }
+        //the arguments go in registers that may hold virtual registers, the missing ones are zero
+        push(ctx, EBX);
+        push(ctx, ESI);
+        push(ctx, EDI);
+        for (int i = 0; i < 6; ++i)
+        {
+            reg_t r = syscall_registers[i];
+            if (i >= numargs)
+            {
+                //xor r32,r32
+                db(ctx, 0x31);
+                db(ctx, 0xc0 + r * 9);
+                continue;
+            }
+            //mov r32,[esp + 12 + i * 4]
+            db(ctx, 0x8b);
+            db(ctx, 0x44 + r * 8);
+            db(ctx, 0x24);
+            db(ctx, 12 + i * 4);
+        }
+        db(ctx, 0xcd); //int 0x80
+        db(ctx, 0x80);
+        pop(ctx, EDI);
+        pop(ctx, ESI);
+        pop(ctx, EBX);
+        // add esp, 4
+        db(ctx, 0x83);
+        db(ctx, 0xc4);
+        db(ctx, numargs * 4);
+    } break;
+    }
+    B->pushed -= ir_pushed_arguments(ctx, b, in - b->instrs) * 4;
+    if (in->dst != -1 && B->uses[in->dst] > 0)
+        ir_store(ctx, B, in->dst, EAX);
+}
+
+//bytes of arguments pushed at the start of every block, a branch can come between the arguments of a call
+static void ir_block_pushed(compiler_t *ctx, struct ir_backend *B)
+{
+    struct ir_function *fn = B->fn;
+    for (int i = 0; i < fn->numblocks; ++i)
+        B->block_pushed[i] = -1;
+    B->block_pushed[0] = 0;
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (int i = 0; i < fn->numblocks; ++i)
+        {
+            struct ir_block *b = fn->blocks[i];
+            int pushed = B->block_pushed[i];
+            if (pushed == -1)
+                continue;
+            for (int j = 0; j < b->numinstrs; ++j)
+            {
+                if (b->instrs[j].op == IR_ARG && !ir_register_argument(ctx, b, j))
+                    pushed += 4;
+                else if (b->instrs[j].op == IR_CALL)
+                    pushed -= ir_pushed_arguments(ctx, b, j) * 4;
+            }
+            for (int k = 0; k < b->numsucc; ++k)
+            {
+                if (B->block_pushed[b->succ[k]] == -1)
+                {
+                    B->block_pushed[b->succ[k]] = pushed;
+                    changed = 1;
+                }
+            }
+        }
+    }
+}
+
+static void ir_load_memory(compiler_t *ctx, struct ir_backend *B, struct ir_instr *in, struct ir_address_mode *m)
+{
+    struct ir_rm mem = ir_address(ctx, B, m);
+    struct ir_rm rm = ir_vreg_rm(B, in->dst);
+    reg_t r = rm.isreg ? rm.reg : EAX;
+    //smaller values are zero extended
+    emit(ctx, in->size == 4 ? X86_MOV : X86_MOVZX, x86_reg(r), x86_size(ir_x86_operand(mem), in->size));
+    ir_store(ctx, B, in->dst, r);
+}
+
+static void ir_store_memory(compiler_t *ctx, struct ir_backend *B, struct ir_instr *in, struct ir_address_mode *m)
+{
+    reg_t r = EDX;
+    if (in->b.kind != IR_IMM)
+    {
+        //only ebx of the registers we keep values in has a byte register
+        if (!ir_operand_register(B, in->b, &r) || (in->size == 1 && r != EBX))
+        {
+            r = EDX;
+            ir_load(ctx, B, EDX, in->b);
+        }
+    }
+    struct ir_rm mem = ir_address(ctx, B, m);
+    struct x86_operand src = in->b.kind == IR_IMM ? x86_imm(in->b.value) : x86_size(x86_reg(r), in->size);
+    emit(ctx, X86_MOV, x86_size(ir_x86_operand(mem), in->size), src);
+}
+
+static int ir_same_operand(struct ir_operand x, struct ir_operand y)
+{
+    return x.kind == y.kind && x.value == y.value;
+}
+
+//a load, an add, sub, and, or or xor of the loaded value and a store of the result back to the same address at
+//instruction j is done on memory directly
+static int ir_read_modify_write(compiler_t *ctx, struct ir_backend *B, struct ir_block *b, int j, struct ir_operand address,
+                                struct ir_address_mode *m)
+{
+    if (j + 2 >= b->numinstrs)
+        return 0;
+    struct ir_instr *ld = &b->instrs[j], *op = &b->instrs[j + 1], *st = &b->instrs[j + 2];
+    if (ld->op != IR_LOAD || ld->size != 4 || !ir_same_operand(ld->a, address) || B->uses[ld->dst] != 1)
+        return 0;
+    if (op->op != IR_ADD && op->op != IR_SUB && op->op != IR_AND && op->op != IR_OR && op->op != IR_XOR)
+        return 0;
+    struct ir_operand loaded = { .kind = IR_VREG, .value = ld->dst };
+    struct ir_operand x = op->b;
+    if (!ir_same_operand(op->a, loaded))
+    {
+        if (!ir_is_commutative(op->op) || !ir_same_operand(op->b, loaded))
+            return 0;
+        x = op->a;
+    }
+    if (x.kind != IR_IMM && x.kind != IR_VREG)
+        return 0;
+    if (st->op != IR_STORE || st->size != 4 || !ir_same_operand(st->a, address) || st->b.kind != IR_VREG ||
+        st->b.value != op->dst || B->uses[op->dst] != 1)
+        return 0;
+
+    reg_t r = EDX;
+    if (x.kind == IR_VREG && !ir_operand_register(B, x, &r))
+    {
+        r = EDX;
+        ir_load(ctx, B, EDX, x);
+    }
+    struct ir_rm mem = ir_address(ctx, B, m);
+    emit(ctx, ir_alu_mnemonic(op->op), ir_x86_operand(mem), x.kind == IR_IMM ? x86_imm(x.value) : x86_reg(r));
+    return 1;
+}
+
+//loads and stores through the address computed by the instructions at j, returns the number of instructions done
+static int ir_memory_access(compiler_t *ctx, struct ir_backend *B, struct ir_block *b, int j)
+{
+    struct ir_instr *in = &b->instrs[j];
+    struct ir_address_mode m;
+    int address;
+    int k = ir_match_address(B, b, j, &m, &address);
+    if (k > 0 && j + k < b->numinstrs)
+    {
+        struct ir_instr *access = &b->instrs[j + k];
+        struct ir_operand a = { .kind = IR_VREG, .value = address };
+        if (B->uses[address] == 1 && (access->op == IR_LOAD || access->op == IR_STORE) && ir_same_operand(access->a, a))
+        {
+            if (access->op == IR_LOAD)
+                ir_load_memory(ctx, B, access, &m);
+            else
+                ir_store_memory(ctx, B, access, &m);
+            return k + 1;
+        }
+        if (B->uses[address] == 2 && ir_read_modify_write(ctx, B, b, j + k, a, &m))
+            return k + 3;
+        return 0;
+    }
+    if (in->op == IR_LOAD)
+    {
+        m = (struct ir_address_mode){ .base = in->a };
+        if (ir_read_modify_write(ctx, B, b, j, in->a, &m))
+            return 3;
+    }
+    return 0;
+}
+
+static void ir_instruction(compiler_t *ctx, struct ir_backend *B, struct ir_block *b, struct ir_instr *in, int next)
+{
+    switch (in->op)
+    {
+    case IR_NOP:
+        break;
+
+    case IR_MOV:
+    {
+        struct ir_rm rm = ir_vreg_rm(B, in->dst);
+        if (rm.isreg)
+            ir_load(ctx, B, rm.reg, in->a);
+        else if (in->a.kind == IR_IMM)
+            emit(ctx, X86_MOV, ir_x86_operand(rm), x86_imm(in->a.value));
+        else
+        {
+            ir_load(ctx, B, EAX, in->a);
+            ir_store(ctx, B, in->dst, EAX);
+        }
+    } break;
+
+    case IR_STRING:
+    {
+        struct ir_rm rm = ir_vreg_rm(B, in->dst);
+        reg_t r = rm.isreg ? rm.reg : EAX;
+        mov_r_string(ctx, r, in->str);
+        ir_store(ctx, B, in->dst, r);
+    } break;
+
+    case IR_LOAD:
+    case IR_STORE:
+    {
+        struct ir_address_mode m = { .base = in->a };
+        if (in->op == IR_LOAD)
+            ir_load_memory(ctx, B, in, &m);
+        else
+            ir_store_memory(ctx, B, in, &m);
+    } break;
+
+    case IR_ADD:
+    case IR_SUB:
+    case IR_AND:
+    case IR_OR:
+    case IR_XOR:
+    {
+        reg_t a, d;
+        //compute a + b as b + a when b is already where the result goes
+        if (ir_is_commutative(in->op) && ir_operand_register(B, in->b, &a) && ir_vreg_rm(B, in->dst).isreg &&
+            ir_vreg_rm(B, in->dst).reg == a)
+        {
+            struct ir_operand t = in->a;
+            in->a = in->b;
+            in->b = t;
+        }
+        d = ir_result_register(B, in);
+        ir_load(ctx, B, d, in->a);
+        ir_alu(ctx, B, ir_alu_mnemonic(in->op), d, in->b);
+        ir_store(ctx, B, in->dst, d);
+    } break;
+
+    case IR_MUL:
+    {
+        reg_t d = ir_result_register(B, in);
+        ir_load(ctx, B, d, in->a);
+        if (in->b.kind == IR_IMM)
+            multiply_by_constant(ctx, d, in->b.value);
+        else
+        {
+            struct ir_rm rm = ir_register_rm(ECX);
+            if (in->b.kind == IR_SLOT)
+                ir_load(ctx, B, ECX, in->b);
+            else
+                rm = ir_vreg_rm(B, in->b.value);
+            emit(ctx, X86_IMUL, x86_reg(d), ir_x86_operand(rm));
+        }
+        ir_store(ctx, B, in->dst, d);
+    } break;
+
+    case IR_DIV:
+    case IR_MOD:
+    case IR_UDIV:
+    case IR_UMOD:
+    {
+        int is_unsigned = in->op == IR_UDIV || in->op == IR_UMOD;
+        int modulo = in->op == IR_MOD || in->op == IR_UMOD;
+        if (in->b.kind == IR_IMM)
+        {
+            ir_load(ctx, B, EAX, in->a);
+            divide_by_constant(ctx, in->b.value, modulo, is_unsigned);
+            ir_store(ctx, B, in->dst, EAX);
+            break;
+        }
+        struct ir_rm rm = ir_register_rm(ECX);
+        if (in->b.kind == IR_VREG)
+            rm = ir_vreg_rm(B, in->b.value);
+        else
+            ir_load(ctx, B, ECX, in->b);
+        ir_load(ctx, B, EAX, in->a);
+        extend_dividend(ctx, is_unsigned);
+        emit_one(ctx, is_unsigned ? X86_DIV : X86_IDIV, ir_x86_operand(rm));
+        ir_store(ctx, B, in->dst, modulo ? EDX : EAX);
+    } break;
+
+    case IR_SHL:
+    case IR_SAR:
+    case IR_SHR:
+    {
+        int mnemonic = in->op == IR_SHL ? X86_SHL : in->op == IR_SAR ? X86_SAR : X86_SHR;
+        reg_t d = ir_result_register(B, in);
+        if (in->b.kind == IR_IMM)
+        {
+            ir_load(ctx, B, d, in->a);
+            shift_r_imm(ctx, mnemonic, d, in->b.value & 31);
+        } else
+        {
+            ir_load(ctx, B, ECX, in->b);
+            ir_load(ctx, B, d, in->a);
+            emit(ctx, mnemonic, x86_reg(d), x86_size(x86_reg(ECX), 1));
+        }
+        ir_store(ctx, B, in->dst, d);
+    } break;
+
+    case IR_EQ:
+    case IR_NE:
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+        ir_compare(ctx, B, in);
+        //setcc al
+        db(ctx, 0x0f);
+        db(ctx, 0x90 + ir_condition_code(in->op));
+        db(ctx, 0xc0);
+        //movzx eax,al
+        db(ctx, 0x0f);
+        db(ctx, 0xb6);
+        db(ctx, 0xc0);
+        ir_store(ctx, B, in->dst, EAX);
+        break;
+
+    case IR_NEG:
+    case IR_NOT:
+    {
+        struct ir_rm rm = ir_vreg_rm(B, in->dst);
+        reg_t d = rm.isreg ? rm.reg : EAX;
+        ir_load(ctx, B, d, in->a);
+        emit_one(ctx, in->op == IR_NEG ? X86_NEG : X86_NOT, x86_reg(d));
+        ir_store(ctx, B, in->dst, d);
+    } break;
+
+    case IR_LNOT:
+    {
+        struct ir_instr cmp = { .a = in->a, .b = { .kind = IR_IMM, .value = 0 } };
+        ir_compare(ctx, B, &cmp);
+        //sete al
+        db(ctx, 0x0f);
+        db(ctx, 0x94);
+        db(ctx, 0xc0);
+        //movzx eax,al
+        db(ctx, 0x0f);
+        db(ctx, 0xb6);
+        db(ctx, 0xc0);
+        ir_store(ctx, B, in->dst, EAX);
+    } break;
+
+    case IR_ARG:
+    {
+        reg_t r;
+        if (ir_register_argument(ctx, b, in - b->instrs))
+            break;
+        if (in->a.kind == IR_IMM)
+            emit_one(ctx, X86_PUSH, x86_imm(in->a.value));
+        else if (in->a.kind == IR_SLOT)
+        {
+            ir_load(ctx, B, EAX, in->a);
+            push(ctx, EAX);
+        } else if (ir_operand_register(B, in->a, &r))
+            push(ctx, r);
+        else
+            emit_one(ctx, X86_PUSH, ir_x86_operand(ir_vreg_rm(B, in->a.value)));
+        B->pushed += 4;
+    } break;
+
+    case IR_CALL:
+        ir_call(ctx, B, b, in);
+        break;
+
+    case IR_JMP:
+        if (in->target[0] != next)
+            ir_jump(ctx, B, in->target[0]);
+        break;
+
+    case IR_BR:
+    {
+        reg_t r;
+        if (in->a.kind != IR_VREG)
+        {
+            //constant condition or the address of a slot which is never null
+            int t = in->a.kind == IR_SLOT || in->a.value ? in->target[0] : in->target[1];
+            if (t != next)
+                ir_jump(ctx, B, t);
+            break;
+        }
+        if (ir_operand_register(B, in->a, &r))
+            emit(ctx, X86_TEST, x86_reg(r), x86_reg(r));
+        else
+            emit(ctx, X86_CMP, ir_x86_operand(ir_vreg_rm(B, in->a.value)), x86_imm(0));
+        ir_branch(ctx, B, 0x5, in->target[0], in->target[1], next);
+    } break;
+
+    case IR_RET:
+        if (in->a.kind != IR_NONE)
+            ir_load(ctx, B, EAX, in->a);
+        //the epilogue follows the last block
+        if (next != B->fn->numblocks)
+            ir_jump(ctx, B, -1);
+        break;
+    }
+}
+
+static void ir_generate(compiler_t *ctx, struct ir_function *fn)
+{
+    struct ir_backend B = { .fn = fn };
+    B.location = malloc((fn->numvregs + 1) * sizeof(int));
+    B.uses = calloc(fn->numvregs + 1, sizeof(int));
+    B.slot_disp = malloc((fn->numslots + 1) * sizeof(int));
+    B.block_offsets = malloc((fn->numblocks + 1) * sizeof(int));
+    B.block_pushed = malloc((fn->numblocks + 1) * sizeof(int));
+    B.frame_pointer = !(opt_flags & OPT_OMIT_FRAME_POINTER);
+    int numspills = ir_allocate_registers(fn, B.frame_pointer ? NUM_IR_REGISTERS - 1 : NUM_IR_REGISTERS, B.location);
+    //the copies of the arguments and the epilogue are bigger than the call
+    B.tail_calls = !ctx->optimize_size && !ir_slot_address_taken(fn);
+
+    //every block ends in at most two jumps
+    B.jump_from = malloc((fn->numblocks * 2 + 1) * sizeof(int));
+    B.jump_block = malloc((fn->numblocks * 2 + 1) * sizeof(int));
+
+    //registers that are written to have to be saved
+    unsigned used = 0;
+    for (int i = 0; i < fn->numblocks; ++i)
+    {
+        struct ir_block *b = fn->blocks[i];
+        for (int j = 0; j < b->numinstrs; ++j)
+        {
+            struct ir_instr *in = &b->instrs[j];
+            if (in->a.kind == IR_VREG)
+                ++B.uses[in->a.value];
+            if (in->b.kind == IR_VREG)
+                ++B.uses[in->b.value];
+            if (in->dst != -1 && B.location[in->dst] >= 0)
+                used |= 1 << B.location[in->dst];
+        }
+    }
+    for (int i = 0; i < NUM_IR_REGISTERS; ++i)
+        if (used & (1 << i))
+            B.saved[B.numsaved++] = ir_registers[i];
+
+    //parameters that come in registers are stored with the locals, unless all that reads them is the copy into
+    //their variable at the start which can be done from the register
+    B.numregparms = function_register_parameters(ctx, ctx->function);
+    B.slot_register = malloc((fn->numslots + 1) * sizeof(int));
+    int *slot_uses = calloc(fn->numslots + 1, sizeof(int));
+    for (int i = 0; i < fn->numslots; ++i)
+        B.slot_register[i] = -1;
+    for (int i = 0; i < fn->numblocks; ++i)
+    {
+        struct ir_block *b = fn->blocks[i];
+        for (int j = 0; j < b->numinstrs; ++j)
+        {
+            if (b->instrs[j].a.kind == IR_SLOT)
+                ++slot_uses[b->instrs[j].a.value];
+            if (b->instrs[j].b.kind == IR_SLOT)
+                ++slot_uses[b->instrs[j].b.value];
+        }
+    }
+    for (int j = 0; j < fn->blocks[0]->numinstrs; ++j)
+    {
+        struct ir_instr *in = &fn->blocks[0]->instrs[j];
+        if (in->op != IR_LOAD || in->a.kind != IR_SLOT || in->size != 4)
+            break;
+        int param = fn->slots[in->a.value].param;
+        if (param == -1 || param >= B.numregparms || slot_uses[in->a.value] != 1)
+            break;
+        B.slot_register[in->a.value] = parameter_registers[param];
+    }
+    free(slot_uses);
+
+    //locals below ebp, parameters above the return address
+    int localsize = 0;
+    for (int i = 0; i < fn->numslots; ++i)
+    {
+        if (fn->slots[i].param >= B.numregparms)
+        {
+            B.slot_disp[i] = 8 + (fn->slots[i].param - B.numregparms) * 4;
+            continue;
+        }
+        if (B.slot_register[i] != -1)
+            continue;
+        localsize += (fn->slots[i].size + 3) & ~3;
+        B.slot_disp[i] = -localsize;
+    }
+    B.spill_disp = -localsize - 4;
+    B.framesize = localsize + numspills * 4;
 
-			assert(n->member_expr_data.property->type == AST_IDENTIFIER);
-			int off, sz;
-			struct ast_node *field = get_struct_member_info(ctx, &sr->struct_decl_data, n->member_expr_data.property->identifier_data.name, &off,
-								   &sz);
-			assert(field);
-			//TODO: FIXME nested union/struct types
-			//for now the offset for any field in the struct is always 0
-			//altough if we then reference a struct that may be added and the union will just always be 0
-			//e.g union.struct_field.b
-			//union.struct_field = 0
-			//struct_field.b can be non-zero
-			if(sr->type == AST_UNION_DECL)
-			{
-				off = 0;
-			}
-			assert(sz > 0);
-			// printf("offset = %d, sz = %d for '%s'\n", off, sz, n->member_expr_data.property->identifier_data.name);
+    if (B.frame_pointer)
+    {
+        push(ctx, EBP);
+        mov(ctx, EBP, ESP);
+    }
+    if (B.framesize > 0)
+        emit(ctx, X86_SUB, x86_reg(ESP), x86_imm(B.framesize));
+    for (int i = 0; i < B.numsaved; ++i)
+        push(ctx, B.saved[i]);
+    for (int i = 0; i < fn->numslots; ++i)
+        if (fn->slots[i].param != -1 && fn->slots[i].param < B.numregparms && B.slot_register[i] == -1)
+            emit(ctx, X86_MOV, ir_x86_operand(ir_slot_rm(&B, i)), x86_reg(parameter_registers[fn->slots[i].param]));
+    ir_block_pushed(ctx, &B);
+
+    for (int i = 0; i < fn->numblocks; ++i)
+    {
+        struct ir_block *b = fn->blocks[i];
+        B.block_offsets[i] = instruction_position(ctx);
+        B.pushed = B.block_pushed[i];
+        for (int j = 0; j < b->numinstrs; ++j)
+        {
+            struct ir_instr *in = &b->instrs[j];
+            struct ir_instr *br = j + 1 < b->numinstrs ? &b->instrs[j + 1] : NULL;
+            if (in->op == IR_LOAD && in->a.kind == IR_SLOT && B.slot_register[in->a.value] != -1)
+            {
+                ir_store(ctx, &B, in->dst, B.slot_register[in->a.value]);
+                continue;
+            }
+            //a comparison that's only used by the branch after it jumps on the flags
+            int cc = ir_condition_code(in->op);
+            if (cc != -1 && br && br->op == IR_BR && br->a.kind == IR_VREG && br->a.value == in->dst && B.uses[in->dst] == 1)
+            {
+                ir_compare(ctx, &B, in);
+                ir_branch(ctx, &B, cc, br->target[0], br->target[1], i + 1);
+                ++j;
+                continue;
+            }
+            //the rest of the block is the return
+            if (in->op == IR_CALL && ir_tail_call(ctx, &B, b, in))
+                break;
+            int k = ir_memory_access(ctx, &B, b, j);
+            if (k > 0)
+            {
+                j += k - 1;
+                continue;
+            }
+            ir_instruction(ctx, &B, b, in, i + 1);
+        }
+    }
 
-			push(ctx, EAX);
-			if (dn->type == AST_POINTER_DATA_TYPE)
-			{
-                //should be good to go for identifiers, most of the rvalue values are still hardcoded to EAX though...
-                assert(object->type == AST_IDENTIFIER);
-				rvalue(ctx, reg, object);
-			}
-			else
-				lvalue(ctx, reg, object);
+    int epilogue = instruction_position(ctx);
+    ir_epilogue(ctx, &B);
+    emit_none(ctx, X86_RET);
 
-			// add ebx, imm32
-			db(ctx, 0x81);
-			db(ctx, 0xc3);
-			dd(ctx, off);
+    for (int i = 0; i < B.numjumps; ++i)
+    {
+        int to = B.jump_block[i] == -1 ? epilogue : B.block_offsets[B.jump_block[i]];
+        set32(ctx, B.jump_from[i], to - B.jump_from[i] - 4);
+    }
+    free(B.location);
+    free(B.uses);
+    free(B.slot_disp);
+    free(B.block_offsets);
+    free(B.block_pushed);
+    free(B.slot_register);
+    free(B.jump_from);
+    free(B.jump_block);
+}
 
-			pop(ctx, EAX);
-		}
-		break;
-		}
-	}
-	break;
+//the ir of a function defined in the program for the inliner, a body that wasn't parsed yet is parsed now
+static struct ir_function *inline_callee(void *userptr, const char *name)
+{
+    compiler_t *ctx = userptr;
+    struct ast_node *decl = NULL;
+    if (!ctx->program)
+        return NULL;
+    linked_list_reversed_foreach(ctx->program->program_data.body, struct ast_node**, it,
+    {
+        struct ast_node *n = *it;
+        if (!decl && n->type == AST_FUNCTION_DECL && (n->func_decl_data.body || ast_function_is_lazy(n)) &&
+            !strcmp(n->func_decl_data.id->identifier_data.name, name))
+            decl = n;
+    });
+    if (!decl || decl->func_decl_data.inlining == INLINE_NEVER || decl->func_decl_data.variadic)
+        return NULL;
+    int lazy = ast_function_is_lazy(decl);
+    if (ast_parse_function_body(ctx->program, decl) || (lazy && sema_function(ctx->program, decl)))
+        exit(1);
+    struct ir_function *fn = ir_lower_function(decl);
+    if (fn)
+    {
+        ir_eliminate_tail_recursion(fn);
+        ir_fold_constants(fn);
+    }
+    return fn;
+}
 
-	case AST_MEMBER_EXPR:
-	{
-		// TODO: FIXME for multidimensional arrays
-		struct ast_node* object = n->member_expr_data.object;
-		struct ast_node* dn = identifier_data_node( ctx, object );
+//generates n from the ir when optimizing, returns 1 if it wasn't and n has to be generated from the ast
+static int ir_function(compiler_t *ctx, struct ast_node *n)
+{
+    if (ctx->optimize < 1 && !(opt_flags & OPT_EMIT_IR))
+        return 1;
+    struct ir_function *fn = ir_lower_function(n);
+    if (!fn)
+        return 1;
+    if (ctx->optimize >= 1)
+    {
+        ir_eliminate_tail_recursion(fn);
+        //-Os only inlines functions that are no bigger than the call or called from one place
+        ir_inline_calls(fn, ctx->optimize_size ? 0 : ctx->optimize >= 2 ? 32 : 16, inline_callee, ctx);
+        //mutual recursion that was inlined calls itself now
+        ir_eliminate_tail_recursion(fn);
+        ir_fold_constants(fn);
+    }
+    if (opt_flags & OPT_EMIT_IR)
+        ir_print_function(fn);
+    int ret = 1;
+    if (ctx->optimize >= 1)
+    {
+        ir_generate(ctx, fn);
+        ret = 0;
+    }
+    ir_free_function(fn);
+    return ret;
+}
 
-        switch(dn->type)
-		{
-		case AST_ARRAY_DATA_TYPE:
-		case AST_POINTER_DATA_TYPE: //only when it's a pointer to an primtive array type e.g const char * or int *
-			push(ctx, EAX);
-			if (dn->type == AST_POINTER_DATA_TYPE)
-			{
-                //should be good to go for identifiers, most of the rvalue values are still hardcoded to EAX though...
-                assert(object->type == AST_IDENTIFIER);
-				rvalue(ctx, reg, object);
-			}
-			else
-				lvalue(ctx, reg, object);
-			rvalue(ctx, EAX, n->member_expr_data.property);
+//tree pattern instruction selection for expression statements whose value isn't used
+//the lhs is matched as a register variable or a memory operand and the rhs as each of the nonterminals below,
+//every rule for the assignment operator that fits is costed by the size of its encoding and its cycles
+//-O2 picks the fastest and everything else the smallest, statements no rule matches are left to rvalue
+enum SELECT_NONTERMINAL
+{
+    NT_IMM,
+    NT_ONE,
+    NT_ZERO, //xor of the destination with itself
+    NT_REG, //register variable, or a 4 byte stack variable or constant loaded into eax
+    NT_EXPR, //anything, computed into eax by rvalue before the address is
+    NT_MAX
+};
+
+struct select_cost
+{
+    int size; //bytes
+    int cycles;
+};
 
-			int os = data_type_operand_size(ctx, object, 0);
+//an operand and the loads of the scratch registers it needs
+struct select_operand
+{
+    struct x86_operand operand;
+    struct x86_instruction loads[2];
+    int numloads;
+    struct select_cost cost;
+};
 
-			push(ctx, ESI);
+struct select_rule
+{
+    int operator; //assignment operator, ++ and -- are += 1 and -= 1
+    int rhs;
+    int mnemonic;
+    int cycles; //with a memory destination, register destinations take 1
+};
+
+static const struct select_rule select_rules[] = {
+    { '=', NT_IMM, X86_MOV, 1 },
+    { '=', NT_ZERO, X86_XOR, 1 },
+    { '=', NT_REG, X86_MOV, 1 },
+    { '=', NT_EXPR, X86_MOV, 1 },
+    //inc and dec are smaller than add and sub but have to merge the carry they leave alone
+    { TK_PLUS_ASSIGN, NT_ONE, X86_INC, 4 },
+    { TK_MINUS_ASSIGN, NT_ONE, X86_DEC, 4 },
+#define SELECT_ALU(operator, mnemonic) \
+    { operator, NT_IMM, mnemonic, 3 }, \
+    { operator, NT_REG, mnemonic, 3 }, \
+    { operator, NT_EXPR, mnemonic, 3 }
+    SELECT_ALU(TK_PLUS_ASSIGN, X86_ADD),
+    SELECT_ALU(TK_MINUS_ASSIGN, X86_SUB),
+    SELECT_ALU(TK_AND_ASSIGN, X86_AND),
+    SELECT_ALU(TK_OR_ASSIGN, X86_OR),
+    SELECT_ALU(TK_XOR_ASSIGN, X86_XOR)
+#undef SELECT_ALU
+};
+
+//a is cheaper than b
+static bool select_cheaper(compiler_t *ctx, struct select_cost a, struct select_cost b)
+{
+    if (ctx->optimize >= 2 && !ctx->optimize_size)
+        return a.cycles < b.cycles || (a.cycles == b.cycles && a.size < b.size);
+    return a.size < b.size || (a.size == b.size && a.cycles < b.cycles);
+}
 
-			// mov esi, imm32
-			db(ctx, 0xbe);
-			dd(ctx, os);
+static int select_encoded_size(struct x86_instruction *in)
+{
+    u8 bytes[16];
+    return x86_encode(in, bytes);
+}
 
-			// imul esi
-			db(ctx, 0xf7);
-			db(ctx, 0xee);
+static void select_load(struct select_operand *o, reg_t scratch, struct x86_operand from, int cycles)
+{
+    struct x86_instruction *in = &o->loads[o->numloads++];
+    *in = (struct x86_instruction){ .mnemonic = X86_MOV, .operands = { x86_reg(scratch), from } };
+    o->cost.size += select_encoded_size(in);
+    o->cost.cycles += cycles;
+    o->operand = x86_reg(scratch);
+}
 
-			pop(ctx, ESI);
+static bool select_constant(struct ast_node *n, i32 *value)
+{
+    if (n->type != AST_LITERAL || n->literal_data.type != LITERAL_INTEGER)
+        return false;
+    *value = n->literal_data.integer;
+    return true;
+}
 
-			add(ctx, EBX, EAX);
-			pop(ctx, EAX);
+static bool select_register(compiler_t *ctx, struct ast_node *n, reg_t scratch, struct select_operand *o)
+{
+    struct variable *var = register_variable(ctx, n);
+    i32 disp, value;
+    if (var)
+        o->operand = x86_reg(var->reg);
+    else if (stack_variable(ctx, n, &disp) && data_type_operand_size(ctx, n, 1) == 4)
+        select_load(o, scratch, x86_mem(EBP, 0, 0, disp), 4);
+    else if (select_constant(n, &value))
+        select_load(o, scratch, x86_imm(value), 1);
+    else
+        return false;
+    return true;
+}
 
-			break;
-        default:
-            debug_printf("unhandled member expr case '%s'\n", AST_NODE_TYPE_to_string(dn->type));
-            abort();
-            break;
-		}
+//primitive the array or pointer n points to, its size or 0 if it's something else
+static int select_element_size(compiler_t *ctx, struct ast_node *n)
+{
+    struct ast_node *dn = identifier_data_node(ctx, n);
+    if (!dn || (dn->type != AST_ARRAY_DATA_TYPE && dn->type != AST_POINTER_DATA_TYPE))
+        return 0;
+    if (dn->data_type_data.data_type->type != AST_PRIMITIVE)
+        return 0;
+    int os = primitive_data_type_size(dn->data_type_data.data_type->primitive_data.primitive_type);
+    return os == 1 || os == 2 || os == 4 ? os : 0;
+}
 
-	} break;
+//the lhs in a register variable or memory: a stack variable, an element of a local array or of what a pointer points to
+//or *p, the address is computed from ebp, register variables, and variables and constants loaded into ecx and edx
+static bool select_destination(compiler_t *ctx, struct ast_node *n, struct select_operand *o, int *size)
+{
+    struct variable *var = register_variable(ctx, n);
+    i32 disp, value;
+    *size = 4;
+    if (var)
+    {
+        o->operand = x86_reg(var->reg);
+        return true;
+    }
+    if (stack_variable(ctx, n, &disp))
+    {
+        *size = data_type_operand_size(ctx, n, 1);
+        o->operand = x86_mem(EBP, 0, 0, disp);
+        return *size == 1 || *size == 2 || *size == 4;
+    }
+    if (n->type == AST_UNARY_EXPR && n->unary_expr_data.operator == '*')
+    {
+        struct ast_node *pointer = n->unary_expr_data.argument;
+        if (pointer->type != AST_IDENTIFIER || !(*size = select_element_size(ctx, pointer)) ||
+            !select_register(ctx, pointer, ECX, o) || o->operand.kind != X86_REG)
+            return false;
+        o->operand = x86_mem(o->operand.reg, 0, 0, 0);
+        return true;
+    }
+    if (n->type != AST_MEMBER_EXPR || n->member_expr_data.object->type != AST_IDENTIFIER)
+        return false;
+    struct ast_node *object = n->member_expr_data.object;
+    struct ast_node *property = n->member_expr_data.property;
+    if (!(*size = select_element_size(ctx, object)))
+        return false;
+    struct x86_operand mem = x86_mem(EBP, 0, 0, 0);
+    var = hash_map_find(ctx->function->variables, object->identifier_data.name);
+    if (!var)
+        return false;
+    if (var->data_type_node->type == AST_ARRAY_DATA_TYPE && !var->is_register && !var->is_param)
+        mem.value = variable_displacement(var);
+    else if (select_register(ctx, object, ECX, o))
+        mem.reg = o->operand.reg;
+    else
+        return false;
+    struct select_operand index = { 0 };
+    if (select_constant(property, &value))
+        mem.value += value * *size;
+    else if (select_register(ctx, property, EDX, &index))
+    {
+        mem.index = index.operand.reg;
+        mem.scale = *size;
+        for (int i = 0; i < index.numloads; ++i)
+            o->loads[o->numloads++] = index.loads[i];
+        o->cost.size += index.cost.size;
+        o->cost.cycles += index.cost.cycles;
+    } else
+        return false;
+    o->operand = mem;
+    return true;
+}
 
-	case AST_UNARY_EXPR:
-	{
-		//printf( "operator = %s\n", token_type_to_string( n->unary_expr_data.operator) );
-		switch ( n->unary_expr_data.operator)
-		{
-		case '*':
-			lvalue( ctx, reg, n->unary_expr_data.argument );
-			// mov ebx, [ebx]
-			db( ctx, 0x8b );
-			db( ctx, 0x1b );
-			break;
+//returns 1 if n was generated
+static int select_statement(compiler_t *ctx, struct ast_node *n)
+{
+    struct ast_node one = { .type = AST_LITERAL };
+    struct ast_node *lhs, *rhs;
+    int operator;
+    if (n->type == AST_ASSIGNMENT_EXPR)
+    {
+        lhs = n->assignment_expr_data.lhs;
+        rhs = n->assignment_expr_data.rhs;
+        operator = n->assignment_expr_data.operator;
+    } else if (n->type == AST_UNARY_EXPR &&
+               (n->unary_expr_data.operator == TK_PLUS_PLUS || n->unary_expr_data.operator == TK_MINUS_MINUS))
+    {
+        one.literal_data.type = LITERAL_INTEGER;
+        one.literal_data.integer = 1;
+        lhs = n->unary_expr_data.argument;
+        rhs = &one;
+        operator = n->unary_expr_data.operator == TK_PLUS_PLUS ? TK_PLUS_ASSIGN : TK_MINUS_ASSIGN;
+    } else
+        return 0;
 
-		default:
-			debug_printf( "unhandled unary lvalue '%s'\n", AST_NODE_TYPE_to_string( n->type ) );
-			return 1;
-		}
-	}
-	break;
-    
-	case AST_CAST:
-	{
-        lvalue(ctx, reg, n->cast_data.expr);
-        struct ast_node *from_type = n->cast_data.expr;
-        struct ast_node *to_type = n->cast_data.type;
-        switch(from_type->type)
-		{
-        case AST_IDENTIFIER:
-		{
-            struct ast_node *ident_node = identifier_data_node(ctx, n->cast_data.expr);
-            switch(ident_node->type)
-			{
-			default:
-                //pointers of different sizes will be handled in e.g data_type_size
-                if(ident_node->type != to_type->type)
-				{
-					printf( "lvalue: cannot cast identifier type '%s' to '%s'\n",
-							AST_NODE_TYPE_to_string( ident_node->type ), AST_NODE_TYPE_to_string( to_type->type ) );
-					exit( -1 );
-				}
-				break;
-			}
-		} break;
+    struct select_operand dst = { 0 };
+    int size;
+    if (!select_destination(ctx, lhs, &dst, &size))
+        return 0;
 
-		default:
-            if(from_type->type != to_type->type)
-			{
-				printf( "lvalue: cannot cast '%s' to '%s'\n", AST_NODE_TYPE_to_string( from_type->type ),
-						AST_NODE_TYPE_to_string( to_type->type ) );
-				exit( -1 );
-			}
-			break;
-		}
-	} break;
+    //the rhs as each of the nonterminals
+    struct select_operand src[NT_MAX] = { 0 };
+    bool valid[NT_MAX] = { 0 };
+    i32 value;
+    valid[NT_IMM] = select_constant(rhs, &value);
+    src[NT_IMM].operand = x86_imm(value);
+    valid[NT_ONE] = valid[NT_IMM] && value == 1;
+    valid[NT_ZERO] = valid[NT_IMM] && value == 0;
+    src[NT_ZERO].operand = dst.operand;
+    valid[NT_REG] = select_register(ctx, rhs, EAX, &src[NT_REG]);
+    //esi and edi have no byte registers
+    if (valid[NT_REG] && size == 1 && src[NT_REG].operand.reg >= ESP)
+        valid[NT_REG] = false;
+    valid[NT_EXPR] = true;
+    src[NT_EXPR].operand = x86_reg(EAX);
+    //rough cost of what rvalue generates, it's the same for every rule
+    src[NT_EXPR].cost = (struct select_cost){ 8, 4 };
+
+    const struct select_rule *best = NULL;
+    struct x86_instruction selected;
+    struct select_cost lowest;
+    for (int i = 0; i < COUNT_OF(select_rules); ++i)
+    {
+        const struct select_rule *r = &select_rules[i];
+        if (r->operator != operator || !valid[r->rhs])
+            continue;
+        struct x86_instruction in = { .mnemonic = r->mnemonic, .operands = { x86_size(dst.operand, size) } };
+        if (r->rhs != NT_ONE)
+            in.operands[1] = src[r->rhs].operand.kind == X86_IMM ? src[r->rhs].operand : x86_size(src[r->rhs].operand, size);
+        int length = select_encoded_size(&in);
+        if (!length)
+            continue;
+        struct select_cost cost = { dst.cost.size + src[r->rhs].cost.size + length,
+                                    dst.cost.cycles + src[r->rhs].cost.cycles + (dst.operand.kind == X86_MEM ? r->cycles : 1) };
+        if (!best || select_cheaper(ctx, cost, lowest))
+        {
+            best = r;
+            selected = in;
+            lowest = cost;
+        }
+    }
+    if (!best)
+        return 0;
 
-	default:
-        debug_printf("unhandled lvalue '%s'\n", AST_NODE_TYPE_to_string(n->type));
-        return 1;
-	}
-    return 0;
+    if (best->rhs == NT_EXPR)
+        rvalue(ctx, EAX, rhs);
+    for (int i = 0; i < src[best->rhs].numloads; ++i)
+        encode(ctx, &src[best->rhs].loads[i]);
+    for (int i = 0; i < dst.numloads; ++i)
+        encode(ctx, &dst.loads[i]);
+    encode(ctx, &selected);
+    return 1;
 }
 
 static struct scope *active_scope(compiler_t *ctx)
@@ -1739,16 +3599,7 @@ static int process(compiler_t *ctx, struct ast_node *n)
         struct ast_node *condition = n->if_stmt_data.test;
         struct ast_node *alternative = n->if_stmt_data.alternative;
 
-        rvalue(ctx, EAX, condition);
-		// test eax,eax
-		db( ctx, 0x85 );
-		db( ctx, 0xc0 );
-
-		// jz rel32
-		int jz_pos = instruction_position( ctx ); // jmp_pos + 2 = new_pos
-		db( ctx, 0x0f );
-		db( ctx, 0x84 );
-		dd( ctx, 0x0 ); // placeholder
+        int jz_pos = condition_jump(ctx, condition, 0);
         
         process(ctx, consequent);
         
@@ -1766,84 +3617,102 @@ static int process(compiler_t *ctx, struct ast_node *n)
     {
         struct ast_node *expr = n->return_stmt_data.argument;
         process(ctx, expr);
-        
-		//mov esp,ebp
-        //pop ebp
-        db(ctx, 0x89);
-        db(ctx, 0xec);
-        db(ctx, 0x5d);
-        
-        //ret
-        db(ctx, 0xc3);   
+        function_epilogue(ctx);
     } break;
     
     //TODO: implement this properly
     case AST_FUNCTION_DECL:
     {
         int loc = instruction_position(ctx);
-        if (n->func_decl_data.body) //no body means just a empty declaration, so ignore creating opcodes for it
+        if (n->func_decl_data.body || ast_function_is_lazy(n)) //no body means just a empty declaration, so ignore creating opcodes for it
         {
-            if (!strcmp(n->func_decl_data.id->identifier_data.name, "main"))
+            const char* function_name = n->func_decl_data.id->identifier_data.name;
+            struct function* pending = lookup_function_by_name(ctx, function_name);
+            if (pending && !pending->pending)
+                pending = NULL;
+            //functions are generated once they're referenced, so the ones that are never called aren't.
+            //main and functions whose address is taken always are, see the call graph in sema.c
+            if (!pending && strcmp(function_name, "main") && !n->sema.address_taken)
+                break;
+            //bodies parsed on first use haven't been seen by sema yet
+            int lazy = ast_function_is_lazy(n);
+            if (ast_parse_function_body(ctx->program, n) || (lazy && sema_function(ctx->program, n)))
+                exit(1);
+
+            if (!strcmp(function_name, "main"))
             {
                 //printf("set entry call to 0x%02X (%d)\n", instruction_position( ctx ), instruction_position( ctx ));
                 ctx->entry = instruction_position(ctx);
             }
             struct function func = {
                 .location = loc,
-                .name = n->func_decl_data.id->identifier_data.name,
+                .name = function_name,
                 .localvariablesize = 0,
-                .variables = hash_map_create(struct variable)
+                .variables = hash_map_create(struct variable),
+                .decl = n
             };
-            ctx->function = linked_list_prepend(ctx->functions, func);
+            if (pending)
+            {
+                *pending = func;
+                ctx->function = pending;
+            } else
+                ctx->function = linked_list_prepend(ctx->functions, func);
+            //parameters passed in registers are stored in the frame like local variables
+            int numregs = function_register_parameters(ctx, ctx->function);
             int offset = 0;
             for (int i = 0; i < n->func_decl_data.numparms; ++i)
             {
                 struct ast_node* parm = n->func_decl_data.parameters[i];
                 assert(parm->type == AST_VARIABLE_DECL);
 
-                offset += data_type_size(ctx, parm->variable_decl_data.data_type);
-
                 struct variable tv = {
-                        .offset = offset,
-                        .is_param = 1,
+                        .is_param = i >= numregs,
                         .data_type_node = parm->variable_decl_data.data_type
                 };
+                if (tv.is_param)
+                {
+                    offset += data_type_size(ctx, parm->variable_decl_data.data_type);
+                    tv.offset = offset;
+                } else
+                {
+                    ctx->function->localvariablesize += 4;
+                    tv.offset = ctx->function->localvariablesize;
+                }
 
                 assert(parm->variable_decl_data.id->type == AST_IDENTIFIER);
                 hash_map_insert(ctx->function->variables, parm->variable_decl_data.id->identifier_data.name, tv);
             }
             assert(n->func_decl_data.body->type == AST_BLOCK_STMT);
-            //int localsize = accumulate_local_variable_declaration_size(ctx, n->func_decl_data.body);
+            //with optimizations on the function is lowered to the ir first, functions it can't lower are generated below
+            if (!ir_function(ctx, n))
+            {
+                peephole_function(ctx, loc);
+                break;
+            }
+            //variables in registers don't take up space in the frame, so they're picked first
+            choose_register_variables(ctx, n);
             int localsize = function_variable_declaration_stack_size(ctx, n);
-            //push ebp
-            //mov ebp, esp
-            db(ctx, 0x55);
-            db(ctx, 0x89);
-            db(ctx, 0xe5);
+            push(ctx, EBP);
+            mov(ctx, EBP, ESP);
 
             //allocate some space
-
-            //sub esp, 4
-            //works for < 0xff
-            //db(ctx, 0x83);
-            //db(ctx, 0xec);
-            //db(ctx, 0x04);
-
-            //sub esp, imm32
-            db(ctx, 0x81);
-            db(ctx, 0xec);
-            dd(ctx, localsize);
+            if (localsize > 0)
+                emit(ctx, X86_SUB, x86_reg(ESP), x86_imm(localsize));
+            //they got the first 4 bytes each
+            for (int i = 0; i < numregs; ++i)
+                emit(ctx, X86_MOV, x86_mem(EBP, 0, 0, -(i + 1) * 4), x86_reg(parameter_registers[i]));
+
+            //save the registers we'll be using for variables and temporaries
+            ctx->function->framesize = localsize;
+            ctx->function->numtemporaries = n->sema.temporaries;
+            if (ctx->function->numregistervariables + ctx->function->numtemporaries > NUM_SAVED_REGISTERS)
+                ctx->function->numtemporaries = NUM_SAVED_REGISTERS - ctx->function->numregistervariables;
+            for (int i = 0; i < ctx->function->numregistervariables + ctx->function->numtemporaries; ++i)
+                push(ctx, saved_registers[i]);
 
             process(ctx, n->func_decl_data.body);
-
-            //mov esp,ebp
-            //pop ebp
-            db(ctx, 0x89);
-            db(ctx, 0xec);
-            db(ctx, 0x5d);
-
-            //ret
-            db(ctx, 0xc3);
+            function_epilogue(ctx);
+            peephole_function(ctx, loc);
         }
         else
         {
@@ -1906,18 +3775,8 @@ static int process(compiler_t *ctx, struct ast_node *n)
         int jmp_beg = instruction_position(ctx);
         
         process(ctx, n->while_stmt_data.body);
-        rvalue(ctx, EAX, n->while_stmt_data.test);
-        
-		// test eax,eax
-		db( ctx, 0x85 );
-		db( ctx, 0xc0 );
-
-        int jmp_end = instruction_position(ctx);
-        
-		// jnz rel32
-		db( ctx, 0x0f );
-		db( ctx, 0x85 );
-		dd( ctx,  jmp_beg - jmp_end - 6 );
+        int jmp_end = condition_jump(ctx, n->while_stmt_data.test, 1);
+		set32( ctx, jmp_end + 2, jmp_beg - jmp_end - 6 );
         
         for(int i = 0; i < scope.numbreaks; ++i)
 			set32( ctx, scope.breaks[i] + 1, instruction_position( ctx ) - scope.breaks[i] - 5 );
@@ -1929,17 +3788,7 @@ static int process(compiler_t *ctx, struct ast_node *n)
         struct scope scope;
         enter_scope(ctx, &scope);
         int pos = instruction_position(ctx);
-        rvalue(ctx, EAX, n->while_stmt_data.test);
-        
-		// test eax,eax
-		db( ctx, 0x85 );
-		db( ctx, 0xc0 );
-        
-		// jz rel32
-		int jz_pos = instruction_position( ctx ); // jmp_pos + 2 = new_pos
-		db( ctx, 0x0f );
-		db( ctx, 0x84 );
-		dd( ctx, 0x0 ); // placeholder
+        int jz_pos = condition_jump(ctx, n->while_stmt_data.test, 0);
         process(ctx, n->while_stmt_data.body);
         int tmp = instruction_position(ctx);
         
@@ -1972,35 +3821,9 @@ static int process(compiler_t *ctx, struct ast_node *n)
             process(ctx, n->for_stmt_data.init);
         
         int pos = instruction_position(ctx);
+        int jz_pos = 0;
         if(n->for_stmt_data.test)
-		{
-			rvalue( ctx, EAX, n->for_stmt_data.test );
-			// test eax,eax
-			db( ctx, 0x85 );
-			db( ctx, 0xc0 );
-		} else
-		{
-			db( ctx, 0x90 );
-			db( ctx, 0x90 );
-		}
-		// jz rel32
-		int jz_pos = instruction_position( ctx ); // jmp_pos + 2 = new_pos
-
-		if(n->for_stmt_data.test)
-		{
-			db( ctx, 0x0f );
-			db( ctx, 0x84 );
-			dd( ctx, 0x0 ); // placeholder
-		} else
-		{
-			db( ctx, 0x90 );
-			db( ctx, 0x90 );
-            
-			db( ctx, 0x90 );
-			db( ctx, 0x90 );
-			db( ctx, 0x90 );
-			db( ctx, 0x90 );
-		}
+            jz_pos = condition_jump(ctx, n->for_stmt_data.test, 0);
 
 		if(n->for_stmt_data.body)
             process(ctx, n->for_stmt_data.body);
@@ -2027,13 +3850,19 @@ static int process(compiler_t *ctx, struct ast_node *n)
         assert(id->type == AST_IDENTIFIER);
         const char *variable_name = id->identifier_data.name;
         
-        int variable_size = data_type_size(ctx, data_type_node);
-        assert(variable_size > 0);
-        ctx->function->localvariablesize += variable_size;
-
-        int offset = ctx->function->localvariablesize;
-        
-        struct variable tv = { .offset = offset, .is_param = 0, .data_type_node = data_type_node };
+        struct variable tv = { .is_param = 0, .data_type_node = data_type_node };
+        int index = register_variable_index(ctx, n);
+        if(index != -1)
+        {
+            tv.is_register = 1;
+            tv.reg = saved_registers[index];
+        } else
+        {
+            int alignment;
+            ctx->function->localvariablesize = local_variable_offset(ctx->function->localvariablesize, data_type_node, &alignment);
+            tv.offset = ctx->function->localvariablesize;
+            assert(tv.offset <= ctx->function->framesize);
+        }
         hash_map_insert( ctx->function->variables, variable_name, tv );
 
         if(iv)
@@ -2051,6 +3880,12 @@ static int process(compiler_t *ctx, struct ast_node *n)
         //TODO: FIXME
     } break;
     
+    case AST_ASSIGNMENT_EXPR:
+    case AST_UNARY_EXPR:
+        //the value isn't used, which may leave a cheaper instruction than what rvalue does
+        if(select_statement(ctx, n))
+            break;
+        //fall through
     default:
         if(rvalue(ctx, EAX, n))
 		{
@@ -2068,6 +3903,8 @@ int x86(struct ast_node *head, compiler_t *ctx)
     ctx->function = NULL;
     ctx->relocations = linked_list_create(struct relocation);
     ctx->functions = linked_list_create(struct function);
+    ctx->call_fixups = linked_list_create(struct call_fixup);
+    ctx->program = head->type == AST_PROGRAM ? head : NULL;
     ctx->data = NULL;
     //empty string
     heap_string_push(&ctx->data, 0);
@@ -2134,6 +3971,32 @@ int x86(struct ast_node *head, compiler_t *ctx)
 
     
     process(ctx, head);
+
+    //generate the functions that were referenced before they were parsed
+    struct function *fn;
+    while ((fn = next_pending_function(ctx)))
+        process(ctx, fn->decl);
+    if ((opt_flags & OPT_VERBOSE) && ctx->program)
+    {
+        int unreachable = 0;
+        linked_list_reversed_foreach(ctx->program->program_data.body, struct ast_node**, it,
+        {
+            struct ast_node *n = *it;
+            if (n->type == AST_FUNCTION_DECL && (n->func_decl_data.body || ast_function_is_lazy(n)) &&
+                !lookup_function_by_name(ctx, n->func_decl_data.id->identifier_data.name))
+                ++unreachable;
+        });
+        printf("x86: left out %d functions that are never called\n", unreachable);
+    }
+    if (ctx->optimize >= 1)
+        icf_fold_functions(ctx);
+    linked_list_reversed_foreach(ctx->call_fixups, struct call_fixup*, it,
+    {
+        set32(ctx, it->from, it->fn->location - it->from - 4);
+    });
+    linked_list_destroy(&ctx->call_fixups);
+    if (opt_flags & OPT_VERBOSE)
+        peephole_report();
     
     struct relocation reloc = {
         .from = from,